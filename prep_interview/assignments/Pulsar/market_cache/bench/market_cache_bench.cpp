@@ -0,0 +1,718 @@
+// =============================================================================
+// market_cache_bench.cpp — synthetic-feed benchmark suite for MarketDataCache
+// =============================================================================
+//
+// Drives a MarketDataCache with generated ticks and writes one JSON report:
+// insert throughput and latency (while the window fills, then while it
+// slides and evicts), insert_batch, remove_up_to, every query type on a full
+// window, and a writer racing 1..N reader threads.
+//
+// Latencies are per call, timed with steady_clock; the clock's own cost is
+// reported as timer_overhead_ns and is included in every sample.
+// Throughputs come from separate untimed passes over the same work.
+//
+// Usage: market_cache_bench [--key=value ...]   (--help lists the keys)
+
+#include "market_data_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Cache = MarketDataCache;
+using SpreadTick = MarketDataCacheBase::SpreadTick;
+
+constexpr int64_t SEC = 1'000'000'000;
+constexpr int64_t WINDOW_NS = Cache::BUCKET_NS * Cache::NUM_BUCKETS;
+constexpr int64_t T0 = 1'700'000'000 * SEC;
+
+// ---- Configuration ----------------------------------------------------------
+
+enum class SpreadDist { Uniform, LogNormal, Pareto };
+
+struct Config {
+  double rate = 1000.0;       // mean ticks per second of feed time
+  double duration_s = 4500.0; // feed length; past the 1 h window it evicts
+  SpreadDist dist = SpreadDist::LogNormal;
+  double dist_a = 0.5; // uniform: low,  lognormal: mu,    pareto: scale
+  double dist_b = 0.6; // uniform: high, lognormal: sigma, pareto: alpha
+  double gap_rate = 1.0 / 600; // feed gaps per second of feed time
+  double gap_mean_s = 20.0;    // mean gap length (exponential)
+  int readers = 4;             // concurrent phases run 1..readers
+  int queries = 20000;         // calls per query type
+  int phase_ms = 1000;         // length of each concurrent phase
+  uint64_t seed = 1;
+  std::string out; // report path; empty = stdout
+};
+
+const char *dist_name(SpreadDist d) {
+  switch (d) {
+  case SpreadDist::Uniform:
+    return "uniform";
+  case SpreadDist::LogNormal:
+    return "lognormal";
+  case SpreadDist::Pareto:
+    return "pareto";
+  }
+  return "?";
+}
+
+void usage(FILE *f) {
+  std::fprintf(
+      f,
+      "Usage: market_cache_bench [--key=value ...]\n"
+      "  --rate=N          mean ticks per second of feed time (1000)\n"
+      "  --seconds=S       feed length in seconds (4500; window is 3600)\n"
+      "  --spread=D:A:B    uniform:LO:HI | lognormal:MU:SIGMA |\n"
+      "                    pareto:SCALE:ALPHA (lognormal:0.5:0.6)\n"
+      "  --gap-rate=R      feed gaps per second, 0 = none (0.001667)\n"
+      "  --gap-seconds=S   mean gap length (20)\n"
+      "  --readers=N       run the concurrent phase with 1..N readers (4)\n"
+      "  --queries=N       calls per query type (20000)\n"
+      "  --phase-ms=MS     length of each concurrent phase (1000)\n"
+      "  --seed=N          generator seed (1)\n"
+      "  --out=PATH        write the JSON report to PATH (stdout)\n");
+}
+
+[[noreturn]] void bad_arg(const char *arg) {
+  std::fprintf(stderr, "market_cache_bench: bad argument '%s'\n", arg);
+  usage(stderr);
+  std::exit(2);
+}
+
+Config parse_args(int argc, char **argv) {
+  Config c;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (!std::strcmp(arg, "--help") || !std::strcmp(arg, "-h")) {
+      usage(stdout);
+      std::exit(0);
+    }
+    const char *eq = std::strchr(arg, '=');
+    if (std::strncmp(arg, "--", 2) != 0 || !eq)
+      bad_arg(arg);
+    std::string key(arg + 2, eq);
+    const char *val = eq + 1;
+    char *end = nullptr;
+    auto num = [&] {
+      double v = std::strtod(val, &end);
+      if (end == val || *end)
+        bad_arg(arg);
+      return v;
+    };
+    if (key == "rate")
+      c.rate = num();
+    else if (key == "seconds")
+      c.duration_s = num();
+    else if (key == "gap-rate")
+      c.gap_rate = num();
+    else if (key == "gap-seconds")
+      c.gap_mean_s = num();
+    else if (key == "readers")
+      c.readers = static_cast<int>(num());
+    else if (key == "queries")
+      c.queries = static_cast<int>(num());
+    else if (key == "phase-ms")
+      c.phase_ms = static_cast<int>(num());
+    else if (key == "seed")
+      c.seed = static_cast<uint64_t>(num());
+    else if (key == "out")
+      c.out = val;
+    else if (key == "spread") {
+      std::string s(val);
+      size_t p1 = s.find(':'), p2 = s.find(':', p1 + 1);
+      if (p1 == std::string::npos || p2 == std::string::npos)
+        bad_arg(arg);
+      std::string name = s.substr(0, p1);
+      if (name == "uniform")
+        c.dist = SpreadDist::Uniform;
+      else if (name == "lognormal")
+        c.dist = SpreadDist::LogNormal;
+      else if (name == "pareto")
+        c.dist = SpreadDist::Pareto;
+      else
+        bad_arg(arg);
+      c.dist_a = std::strtod(s.c_str() + p1 + 1, &end);
+      if (*end != ':')
+        bad_arg(arg);
+      c.dist_b = std::strtod(s.c_str() + p2 + 1, &end);
+      if (*end)
+        bad_arg(arg);
+    } else
+      bad_arg(arg);
+  }
+  if (c.rate <= 0 || c.duration_s <= 0 || c.gap_rate < 0 ||
+      c.gap_mean_s < 0 || c.readers < 1 || c.queries < 1 || c.phase_ms < 1)
+    bad_arg("value out of range");
+  return c;
+}
+
+// ---- Tick generator ---------------------------------------------------------
+
+// Poisson arrivals at `rate`, spreads drawn from the configured distribution,
+// and feed gaps: silences of exponential length starting at `gap_rate` per
+// second of feed time. Times are strictly increasing.
+class TickGenerator {
+public:
+  TickGenerator(const Config &c, int64_t start)
+      : cfg_(c), rng_(c.seed), arrival_(c.rate), start_(start) {
+    if (cfg_.gap_rate > 0)
+      next_gap_ = std::exponential_distribution<double>(cfg_.gap_rate)(rng_);
+  }
+
+  SpreadTick next() {
+    t_ += arrival_(rng_);
+    if (cfg_.gap_rate > 0 && t_ >= next_gap_) {
+      if (cfg_.gap_mean_s > 0)
+        t_ += std::exponential_distribution<double>(1.0 / cfg_.gap_mean_s)(
+            rng_);
+      next_gap_ =
+          t_ + std::exponential_distribution<double>(cfg_.gap_rate)(rng_);
+      ++gaps_;
+    }
+    int64_t time = start_ + static_cast<int64_t>(t_ * SEC);
+    time = std::max(time, last_ + 1);
+    last_ = time;
+    return {time, spread()};
+  }
+
+  int64_t gaps() const { return gaps_; }
+
+private:
+  double spread() {
+    switch (cfg_.dist) {
+    case SpreadDist::Uniform:
+      return cfg_.dist_a + (cfg_.dist_b - cfg_.dist_a) * unit_(rng_);
+    case SpreadDist::LogNormal:
+      return std::exp(cfg_.dist_a + cfg_.dist_b * normal_(rng_));
+    case SpreadDist::Pareto:
+      return cfg_.dist_a / std::pow(1.0 - unit_(rng_), 1.0 / cfg_.dist_b);
+    }
+    return 0.0;
+  }
+
+  const Config &cfg_;
+  std::mt19937_64 rng_;
+  std::exponential_distribution<double> arrival_;
+  std::uniform_real_distribution<double> unit_{0.0, 1.0};
+  std::normal_distribution<double> normal_{0.0, 1.0};
+  int64_t start_;
+  double t_ = 0.0; // seconds since start_
+  double next_gap_ = 0.0;
+  int64_t last_ = INT64_MIN;
+  int64_t gaps_ = 0;
+};
+
+// ---- Measurement ------------------------------------------------------------
+
+double elapsed_ns(Clock::time_point a, Clock::time_point b) {
+  return std::chrono::duration<double, std::nano>(b - a).count();
+}
+
+// Median cost of one back-to-back pair of clock reads.
+double timer_overhead_ns() {
+  std::vector<double> s(10001);
+  for (double &x : s) {
+    auto a = Clock::now();
+    auto b = Clock::now();
+    x = elapsed_ns(a, b);
+  }
+  std::nth_element(s.begin(), s.begin() + s.size() / 2, s.end());
+  return s[s.size() / 2];
+}
+
+struct Latency {
+  size_t n = 0;
+  double mean = 0, p50 = 0, p99 = 0, p999 = 0, max = 0;
+};
+
+// Nearest-rank percentiles; sorts `ns` in place.
+Latency summarize(std::vector<double> &ns) {
+  Latency l;
+  l.n = ns.size();
+  if (ns.empty())
+    return l;
+  std::sort(ns.begin(), ns.end());
+  auto at = [&](double q) {
+    size_t r = static_cast<size_t>(std::ceil(q * ns.size()));
+    return ns[std::clamp<size_t>(r, 1, ns.size()) - 1];
+  };
+  double sum = 0;
+  for (double x : ns)
+    sum += x;
+  l.mean = sum / ns.size();
+  l.p50 = at(0.50);
+  l.p99 = at(0.99);
+  l.p999 = at(0.999);
+  l.max = ns.back();
+  return l;
+}
+
+// Calls f(i) for i in [0, n) and returns one latency sample per call.
+template <typename F> std::vector<double> timed_calls(size_t n, F &&f) {
+  std::vector<double> ns(n);
+  for (size_t i = 0; i < n; ++i) {
+    auto a = Clock::now();
+    f(i);
+    auto b = Clock::now();
+    ns[i] = elapsed_ns(a, b);
+  }
+  return ns;
+}
+
+// Calls f(i) for i in [0, n) untimed and returns calls per second.
+template <typename F> double throughput(size_t n, F &&f) {
+  auto a = Clock::now();
+  for (size_t i = 0; i < n; ++i)
+    f(i);
+  double ns = elapsed_ns(a, Clock::now());
+  return ns > 0 ? n * 1e9 / ns : 0.0;
+}
+
+// Keeps results observable so the optimiser cannot drop a query.
+volatile double g_sink;
+
+// ---- JSON -------------------------------------------------------------------
+
+// Minimal streaming JSON writer: objects and arrays nest, keys keep their
+// insertion order, and nothing this tool emits needs escaping.
+class JsonWriter {
+public:
+  void begin_object(const char *key = nullptr) { open(key, '{'); }
+  void end_object() { close('}'); }
+  void begin_array(const char *key = nullptr) { open(key, '['); }
+  void end_array() { close(']'); }
+
+  void field(const char *key, double v) {
+    char buf[64];
+    if (std::isfinite(v))
+      std::snprintf(buf, sizeof buf, "%.6g", v);
+    else
+      std::snprintf(buf, sizeof buf, "null");
+    raw(key, buf);
+  }
+  void field(const char *key, int64_t v) { raw(key, std::to_string(v)); }
+  void field(const char *key, int v) { field(key, int64_t{v}); }
+  void field(const char *key, size_t v) { field(key, int64_t(v)); }
+  void field(const char *key, bool v) { raw(key, v ? "true" : "false"); }
+  void field(const char *key, const char *v) {
+    raw(key, std::string("\"") + v + "\"");
+  }
+
+  void field(const char *key, const Latency &l) {
+    begin_object(key);
+    field("n", l.n);
+    field("mean", l.mean);
+    field("p50", l.p50);
+    field("p99", l.p99);
+    field("p999", l.p999);
+    field("max", l.max);
+    end_object();
+  }
+
+  const std::string &str() const { return s_; }
+
+private:
+  void separate(const char *key) {
+    if (!first_)
+      s_ += ',';
+    first_ = false;
+    s_ += '\n';
+    s_.append(2 * depth_, ' ');
+    if (key) {
+      s_ += '"';
+      s_ += key;
+      s_ += "\": ";
+    }
+  }
+  void raw(const char *key, const std::string &v) {
+    separate(key);
+    s_ += v;
+  }
+  void open(const char *key, char c) {
+    if (depth_ > 0 || !s_.empty())
+      separate(key);
+    s_ += c;
+    ++depth_;
+    first_ = true;
+  }
+  void close(char c) {
+    --depth_;
+    if (!first_) {
+      s_ += '\n';
+      s_.append(2 * depth_, ' ');
+    }
+    s_ += c;
+    first_ = false;
+  }
+
+  std::string s_;
+  int depth_ = 0;
+  bool first_ = true;
+};
+
+// ---- Phases -----------------------------------------------------------------
+
+// Builds the one-level book whose spread is t.spread.
+struct TickBook {
+  PriceLevel levels[2];
+  MarketDataEntryView view(const SpreadTick &t) {
+    levels[0] = {100.0, 1.0};
+    levels[1] = {100.0 + t.spread, 1.0};
+    return {t.time, {&levels[0], 1}, {&levels[1], 1}};
+  }
+};
+
+struct TimeRange {
+  int64_t start_time;
+  int64_t end_time;
+};
+
+// Ranges of log-uniform length in [1 s, window] that end at a uniform point
+// of [now - window + length, now].
+std::vector<TimeRange> random_ranges(size_t n, int64_t now, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  std::vector<TimeRange> out(n);
+  double lo = std::log(double(SEC)), hi = std::log(double(WINDOW_NS));
+  for (auto &r : out) {
+    int64_t len = static_cast<int64_t>(std::exp(lo + (hi - lo) * u(rng)));
+    int64_t end = now - static_cast<int64_t>((WINDOW_NS - len) * u(rng));
+    r = {end - len + 1, end};
+  }
+  return out;
+}
+
+void bench_inserts(const std::vector<SpreadTick> &ticks, size_t fill,
+                   JsonWriter &js) {
+  TickBook book;
+  // Untimed passes for throughput, split at the first tick that evicts.
+  double fill_tput, slide_tput, batch_tput;
+  {
+    Cache cache;
+    fill_tput = throughput(fill, [&](size_t i) {
+      cache.insert(book.view(ticks[i]));
+    });
+    slide_tput = throughput(ticks.size() - fill, [&](size_t i) {
+      cache.insert(book.view(ticks[fill + i]));
+    });
+  }
+  {
+    // insert_batch in batches of 1024, building each batch included.
+    constexpr size_t BATCH = 1024;
+    Cache cache;
+    std::vector<TickBook> books(BATCH);
+    std::vector<MarketDataEntryView> views(BATCH);
+    size_t batches = (ticks.size() + BATCH - 1) / BATCH;
+    double per_batch = throughput(batches, [&](size_t b) {
+      size_t lo = b * BATCH, n = std::min(BATCH, ticks.size() - lo);
+      for (size_t j = 0; j < n; ++j)
+        views[j] = books[j].view(ticks[lo + j]);
+      cache.insert_batch(std::span(views.data(), n));
+    });
+    batch_tput = per_batch * ticks.size() / batches;
+  }
+
+  Cache cache;
+  auto fill_ns = timed_calls(fill, [&](size_t i) {
+    cache.insert(book.view(ticks[i]));
+  });
+  auto slide_ns = timed_calls(ticks.size() - fill, [&](size_t i) {
+    cache.insert(book.view(ticks[fill + i]));
+  });
+
+  js.begin_object("insert");
+  js.field("ops", fill);
+  js.field("ops_per_s", fill_tput);
+  js.field("latency_ns", summarize(fill_ns));
+  js.end_object();
+  js.begin_object("insert_evicting");
+  js.field("ops", ticks.size() - fill);
+  js.field("ops_per_s", slide_tput);
+  js.field("latency_ns", summarize(slide_ns));
+  js.end_object();
+  js.begin_object("insert_batch");
+  js.field("batch", int64_t{1024});
+  js.field("ticks_per_s", batch_tput);
+  js.end_object();
+}
+
+void bench_queries(const Cache &cache, int64_t now, const Config &cfg,
+                   JsonWriter &js) {
+  static constexpr double QS[] = {0.01, 0.05, 0.1, 0.25, 0.5,
+                                  0.75, 0.9,  0.95, 0.99};
+  const size_t n = cfg.queries;
+  auto ranges = random_ranges(n, now, cfg.seed + 1);
+
+  struct Query {
+    const char *name;
+    size_t calls;
+    std::function<void(size_t)> run;
+  };
+  auto start = [&](size_t i) { return ranges[i].start_time; };
+  auto end = [&](size_t i) { return ranges[i].end_time; };
+  // Exact quantiles copy out the whole range; run fewer of them.
+  size_t exact_n = std::max<size_t>(n / 50, 20);
+  std::vector<Query> queries = {
+      {"count_range", n,
+       [&](size_t i) { g_sink = cache.count_range(start(i), end(i)); }},
+      {"min_spread", n,
+       [&](size_t i) { g_sink = cache.min_spread(start(i), end(i)); }},
+      {"max_spread", n,
+       [&](size_t i) { g_sink = cache.max_spread(start(i), end(i)); }},
+      {"spread_percentiles", n,
+       [&](size_t i) {
+         g_sink = std::get<1>(cache.spread_percentiles(start(i), end(i)));
+       }},
+      {"spread_quantiles", n,
+       [&](size_t i) {
+         g_sink = cache.spread_quantiles(start(i), end(i), QS)[4];
+       }},
+      {"spread_percentiles_exact", exact_n,
+       [&](size_t i) {
+         g_sink =
+             std::get<1>(cache.spread_percentiles_exact(start(i), end(i)));
+       }},
+      {"spread_summary", n,
+       [&](size_t i) {
+         g_sink = cache.spread_summary(start(i), end(i), QS).count;
+       }},
+  };
+
+  js.begin_object("queries");
+  for (auto &q : queries) {
+    double tput = throughput(q.calls, q.run);
+    auto ns = timed_calls(q.calls, q.run);
+    js.begin_object(q.name);
+    js.field("ops_per_s", tput);
+    js.field("latency_ns", summarize(ns));
+    js.end_object();
+  }
+  js.end_object();
+}
+
+// A fresh cache holding ticks[0, fill): one full window.
+Cache filled_cache(const std::vector<SpreadTick> &ticks, size_t fill) {
+  Cache cache;
+  cache.insert_spreads(std::span(ticks.data(), fill));
+  return cache;
+}
+
+void bench_rolling(const std::vector<SpreadTick> &ticks, size_t fill,
+                   const Config &cfg, JsonWriter &js) {
+  static constexpr double QS[] = {0.5, 0.9, 0.99};
+  Cache cache;
+  int id = cache.subscribe(5 * 60 * SEC, QS);
+  cache.insert_spreads(std::span(ticks.data(), fill));
+  auto run = [&](size_t) { g_sink = cache.rolling_stats(id).count; };
+  double tput = throughput(cfg.queries, run);
+  auto ns = timed_calls(cfg.queries, run);
+  js.begin_object("rolling_stats");
+  js.field("window_s", int64_t{300});
+  js.field("ops_per_s", tput);
+  js.field("latency_ns", summarize(ns));
+  js.end_object();
+}
+
+void bench_eviction(const std::vector<SpreadTick> &ticks, size_t fill,
+                    JsonWriter &js) {
+  // Walk the cut through the full window in 1000 steps of 3.6 s each.
+  constexpr size_t STEPS = 1000;
+  Cache cache = filled_cache(ticks, fill);
+  int64_t begin = ticks[fill - 1].time - WINDOW_NS;
+  int64_t before = cache.count();
+  auto ns = timed_calls(STEPS, [&](size_t i) {
+    cache.remove_up_to(begin + static_cast<int64_t>(i + 1) * WINDOW_NS /
+                                   static_cast<int64_t>(STEPS));
+  });
+  js.begin_object("remove_up_to");
+  js.field("steps", STEPS);
+  js.field("step_ns", WINDOW_NS / static_cast<int64_t>(STEPS));
+  js.field("ticks_removed", before - cache.count());
+  js.field("latency_ns", summarize(ns));
+  js.end_object();
+}
+
+// One writer replays ticks[fill, end) (shifted forward on every lap) while
+// `readers` threads loop a query mix over ranges ending at the writer's
+// newest tick.
+void bench_concurrent(const std::vector<SpreadTick> &ticks, size_t fill,
+                      const Config &cfg, int readers, JsonWriter &js) {
+  Cache cache = filled_cache(ticks, fill);
+  std::atomic<int64_t> newest{ticks[fill - 1].time};
+  std::atomic<bool> stop{false};
+  auto lengths = random_ranges(4096, WINDOW_NS, cfg.seed + 2);
+
+  std::vector<double> insert_ns;
+  insert_ns.reserve(1 << 20);
+  std::thread writer([&] {
+    TickBook book;
+    int64_t shift = 0;
+    const int64_t lap = ticks.back().time - ticks[fill].time + SEC;
+    for (size_t i = fill; !stop.load(std::memory_order_relaxed); ++i) {
+      if (i == ticks.size()) {
+        i = fill;
+        shift += lap;
+      }
+      SpreadTick t{ticks[i].time + shift, ticks[i].spread};
+      auto a = Clock::now();
+      cache.insert(book.view(t));
+      auto b = Clock::now();
+      insert_ns.push_back(elapsed_ns(a, b));
+      newest.store(t.time, std::memory_order_relaxed);
+    }
+  });
+
+  std::vector<std::vector<double>> query_ns(readers);
+  std::vector<std::thread> pool;
+  for (int r = 0; r < readers; ++r)
+    pool.emplace_back([&, r] {
+      static constexpr double QS[] = {0.5, 0.9, 0.99};
+      auto &out = query_ns[r];
+      out.reserve(1 << 20);
+      for (size_t i = r; !stop.load(std::memory_order_relaxed); ++i) {
+        int64_t len = lengths[i % lengths.size()].end_time -
+                      lengths[i % lengths.size()].start_time;
+        int64_t e = newest.load(std::memory_order_relaxed);
+        int64_t s = e - len;
+        auto a = Clock::now();
+        switch (i % 5) {
+        case 0:
+          g_sink = cache.count_range(s, e);
+          break;
+        case 1:
+          g_sink = cache.min_spread(s, e);
+          break;
+        case 2:
+          g_sink = std::get<1>(cache.spread_percentiles(s, e));
+          break;
+        case 3:
+          g_sink = cache.spread_quantiles(s, e, QS)[0];
+          break;
+        case 4:
+          g_sink = cache.spread_summary(s, e, QS).count;
+          break;
+        }
+        out.push_back(elapsed_ns(a, Clock::now()));
+      }
+    });
+
+  auto t0 = Clock::now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(cfg.phase_ms));
+  stop.store(true);
+  writer.join();
+  for (auto &t : pool)
+    t.join();
+  double secs = elapsed_ns(t0, Clock::now()) / 1e9;
+
+  std::vector<double> all;
+  for (auto &v : query_ns)
+    all.insert(all.end(), v.begin(), v.end());
+
+  js.begin_object();
+  js.field("readers", readers);
+  js.field("queries_per_s", all.size() / secs);
+  js.field("query_latency_ns", summarize(all));
+  js.field("inserts_per_s", insert_ns.size() / secs);
+  js.field("insert_latency_ns", summarize(insert_ns));
+  js.end_object();
+}
+
+} // namespace
+
+// =============================================================================
+// main
+// =============================================================================
+int main(int argc, char **argv) {
+  Config cfg = parse_args(argc, argv);
+
+  TickGenerator gen(cfg, T0);
+  const int64_t end_time = T0 + static_cast<int64_t>(cfg.duration_s * SEC);
+  std::vector<SpreadTick> ticks;
+  ticks.reserve(static_cast<size_t>(cfg.rate * cfg.duration_s * 1.05));
+  for (SpreadTick t = gen.next(); t.time < end_time; t = gen.next())
+    ticks.push_back(t);
+  // The last tick before the window first has to slide.
+  size_t fill = std::lower_bound(ticks.begin(), ticks.end(), T0 + WINDOW_NS,
+                                 [](const SpreadTick &t, int64_t v) {
+                                   return t.time < v;
+                                 }) -
+                ticks.begin();
+  if (fill == 0 || fill == ticks.size()) {
+    std::fprintf(stderr,
+                 "market_cache_bench: need ticks on both sides of the %llds "
+                 "window (raise --rate or --seconds)\n",
+                 static_cast<long long>(WINDOW_NS / SEC));
+    return 2;
+  }
+  int64_t now = ticks[fill - 1].time;
+
+  JsonWriter js;
+  js.begin_object();
+  js.begin_object("config");
+  js.field("cache", "MarketDataCache");
+  js.field("bucket_ns", Cache::BUCKET_NS);
+  js.field("num_buckets", Cache::NUM_BUCKETS);
+  js.field("rate", cfg.rate);
+  js.field("seconds", cfg.duration_s);
+  js.field("spread", dist_name(cfg.dist));
+  js.field("spread_a", cfg.dist_a);
+  js.field("spread_b", cfg.dist_b);
+  js.field("gap_rate", cfg.gap_rate);
+  js.field("gap_seconds", cfg.gap_mean_s);
+  js.field("readers", cfg.readers);
+  js.field("queries", cfg.queries);
+  js.field("phase_ms", cfg.phase_ms);
+  js.field("seed", static_cast<int64_t>(cfg.seed));
+  js.end_object();
+  js.begin_object("environment");
+  js.field("instrumented", CacheInstrument::ENABLED);
+  js.field("hardware_threads",
+           static_cast<int64_t>(std::thread::hardware_concurrency()));
+  js.field("timer_overhead_ns", timer_overhead_ns());
+  js.end_object();
+  js.begin_object("feed");
+  js.field("ticks", ticks.size());
+  js.field("ticks_in_window", fill);
+  js.field("gaps", gen.gaps());
+  js.end_object();
+
+  bench_inserts(ticks, fill, js);
+  {
+    Cache cache = filled_cache(ticks, fill);
+    bench_queries(cache, now, cfg, js);
+  }
+  bench_rolling(ticks, fill, cfg, js);
+  bench_eviction(ticks, fill, js);
+  js.begin_array("concurrent");
+  for (int r = 1; r <= cfg.readers; ++r)
+    bench_concurrent(ticks, fill, cfg, r, js);
+  js.end_array();
+  js.end_object();
+
+  std::string report = js.str() + "\n";
+  if (cfg.out.empty()) {
+    std::fputs(report.c_str(), stdout);
+  } else {
+    FILE *f = std::fopen(cfg.out.c_str(), "w");
+    if (!f || std::fputs(report.c_str(), f) < 0 || std::fclose(f) != 0) {
+      std::fprintf(stderr, "market_cache_bench: cannot write %s\n",
+                   cfg.out.c_str());
+      return 1;
+    }
+  }
+  return 0;
+}
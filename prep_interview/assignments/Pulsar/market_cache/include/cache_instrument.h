@@ -0,0 +1,403 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <string>
+
+// ---- Cache instrumentation --------------------------------------------------
+
+// Per-method latency histograms, lock wait vs locked time and event counters
+// for BasicMarketDataCache. Compiled in only with -DMARKET_CACHE_INSTRUMENT
+// (the CMake option of the same name); otherwise CacheInstrument is an empty
+// member whose hooks are empty inline functions, and stats() returns an
+// all-zero snapshot with enabled == false.
+
+// Public cache methods timed separately. Overloads and _percentiles /
+// _quantiles pairs share an entry.
+enum class CacheOp : uint8_t {
+  Insert,          // insert
+  InsertBatch,     // insert_batch, insert_spreads
+  RemoveUpTo,      // remove_up_to
+  CountRange,      // count_range
+  MinMax,          // min_spread, max_spread
+  Quantiles,       // spread_percentiles, spread_quantiles
+  QuantilesExact,  // the _exact and _exact_parallel variants
+  QuantilesSketch, // spread_quantiles_sketch
+  Summary,         // spread_summary
+  RollingStats,    // rolling_stats
+  MetricSummary,   // metric_summary
+  NUM_OPS
+};
+
+inline const char *cache_op_name(CacheOp op) {
+  static constexpr const char *kNames[] = {
+      "insert",          "insert_batch",     "remove_up_to",
+      "count_range",     "min/max_spread",   "quantiles",
+      "quantiles_exact", "quantiles_sketch", "spread_summary",
+      "rolling_stats",   "metric_summary"};
+  static_assert(std::size(kNames) == static_cast<size_t>(CacheOp::NUM_OPS));
+  return kNames[static_cast<size_t>(op)];
+}
+
+enum class CacheCounter : uint8_t {
+  BucketsEvicted,      // buckets dropped by window moves and remove_up_to
+  FenwickUpdates,      // bucket updates applied to the histogram trees
+  OptimisticRetries,   // optimistic reads that collided with a writer
+  OptimisticFallbacks, // ... and then gave up and took the shared lock
+  NUM_COUNTERS
+};
+
+// Latency distribution of one op: percentiles are read from log-linear bins
+// (four per power of two), so they are within ~12% of the true value.
+struct LatencySummary {
+  uint64_t count = 0;
+  double mean_ns = 0;
+  double p50_ns = 0;
+  double p99_ns = 0;
+  double max_ns = 0;
+};
+
+struct CacheStats {
+  struct Op {
+    LatencySummary total;
+    // Calls that took a lock (the shared or the unique one): time spent
+    // waiting to acquire it, and from acquiring it to returning.
+    LatencySummary lock_wait;
+    LatencySummary locked;
+  };
+
+  bool enabled = false;
+  std::array<Op, static_cast<size_t>(CacheOp::NUM_OPS)> ops{};
+  std::array<uint64_t, static_cast<size_t>(CacheCounter::NUM_COUNTERS)>
+      counters{};
+
+  const Op &op(CacheOp o) const { return ops[static_cast<size_t>(o)]; }
+  uint64_t counter(CacheCounter c) const {
+    return counters[static_cast<size_t>(c)];
+  }
+
+  // One line per op that was called, then the counters.
+  std::string to_string() const {
+    std::string s;
+    char line[256];
+    if (!enabled)
+      return "instrumentation compiled out (MARKET_CACHE_INSTRUMENT)\n";
+    for (size_t i = 0; i < ops.size(); ++i) {
+      const Op &o = ops[i];
+      if (o.total.count == 0)
+        continue;
+      std::snprintf(line, sizeof(line),
+                    "%-16s %10llu calls  mean %8.0f  p50 %8.0f  p99 %9.0f  "
+                    "max %10.0f ns",
+                    cache_op_name(static_cast<CacheOp>(i)),
+                    static_cast<unsigned long long>(o.total.count),
+                    o.total.mean_ns, o.total.p50_ns, o.total.p99_ns,
+                    o.total.max_ns);
+      s += line;
+      if (o.lock_wait.count > 0) {
+        std::snprintf(line, sizeof(line),
+                      "  | wait p50 %6.0f p99 %8.0f  locked p50 %6.0f p99 "
+                      "%8.0f ns",
+                      o.lock_wait.p50_ns, o.lock_wait.p99_ns,
+                      o.locked.p50_ns, o.locked.p99_ns);
+        s += line;
+      }
+      s += '\n';
+    }
+    std::snprintf(line, sizeof(line),
+                  "buckets evicted %llu  fenwick updates %llu  optimistic "
+                  "retries %llu (fallbacks %llu)\n",
+                  static_cast<unsigned long long>(
+                      counter(CacheCounter::BucketsEvicted)),
+                  static_cast<unsigned long long>(
+                      counter(CacheCounter::FenwickUpdates)),
+                  static_cast<unsigned long long>(
+                      counter(CacheCounter::OptimisticRetries)),
+                  static_cast<unsigned long long>(
+                      counter(CacheCounter::OptimisticFallbacks)));
+    s += line;
+    return s;
+  }
+};
+
+#ifdef MARKET_CACHE_INSTRUMENT
+
+// Timestamps are raw TSC reads (steady_clock elsewhere), converted to ns
+// only when a snapshot is taken. Each thread records into its own shard,
+// picked by a thread_local index and allocated on its first record, with
+// relaxed load + store rather than locked read-modify-writes, so recording
+// costs two TSC reads and a few uncontended stores per call. More than
+// MAX_SHARDS threads share shards and may then lose an occasional count.
+// stats() sums the shards while they are written, so it can be a few calls
+// behind but never reads a torn counter.
+//
+// A Scope times one public call; nested scopes on the same thread (an
+// overload forwarding to another) are ignored, so each call counts once.
+class CacheInstrument {
+public:
+  static constexpr bool ENABLED = true;
+  static constexpr size_t MAX_SHARDS = 16;
+  // Up to 2^40 ticks; the last bin is open-ended.
+  static constexpr int NUM_BINS = 160;
+
+  CacheInstrument() = default;
+  CacheInstrument(CacheInstrument &&other) noexcept { steal(other); }
+  CacheInstrument &operator=(CacheInstrument &&other) noexcept {
+    if (this != &other) {
+      release();
+      steal(other);
+    }
+    return *this;
+  }
+  ~CacheInstrument() { release(); }
+
+  class Scope {
+  public:
+    Scope(const CacheInstrument &owner, CacheOp op)
+        : owner_(current_ ? nullptr : &owner), op_(op) {
+      if (owner_) {
+        current_ = this;
+        start_ = now();
+      }
+    }
+    ~Scope() {
+      if (!owner_)
+        return;
+      uint64_t end = now();
+      Shard &s = owner_->shard();
+      auto &rows = s.ops[static_cast<size_t>(op_)];
+      record(rows[0], end - start_);
+      if (locked_ != 0) {
+        record(rows[1], locked_ - start_);
+        record(rows[2], end - locked_);
+      }
+      current_ = nullptr;
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    friend class CacheInstrument;
+    const CacheInstrument *owner_;
+    CacheOp op_;
+    uint64_t start_ = 0;
+    uint64_t locked_ = 0;
+  };
+
+  // The calling thread's open Scope on this cache just acquired a lock.
+  void locked() const {
+    if (current_ && current_->owner_ == this && current_->locked_ == 0)
+      current_->locked_ = now();
+  }
+
+  void add(CacheCounter c, uint64_t n = 1) const {
+    bump(shard().counters[static_cast<size_t>(c)], n);
+  }
+
+  CacheStats stats() const {
+    CacheStats out;
+    out.enabled = true;
+    double ns = ns_per_tick();
+    for (size_t op = 0; op < out.ops.size(); ++op) {
+      Row merged[3]{};
+      for (auto &slot : shards_)
+        if (const Shard *s = slot.load(std::memory_order_acquire))
+          for (int k = 0; k < 3; ++k)
+            merged[k].add(s->ops[op][k]);
+      out.ops[op].total = merged[0].summary(ns);
+      out.ops[op].lock_wait = merged[1].summary(ns);
+      out.ops[op].locked = merged[2].summary(ns);
+    }
+    for (auto &slot : shards_)
+      if (const Shard *s = slot.load(std::memory_order_acquire))
+        for (size_t c = 0; c < out.counters.size(); ++c)
+          out.counters[c] += s->counters[c].load(std::memory_order_relaxed);
+    return out;
+  }
+
+  // Zero every shard. Records racing with it may survive.
+  void reset() {
+    for (auto &slot : shards_)
+      if (Shard *s = slot.load(std::memory_order_acquire)) {
+        for (auto &rows : s->ops)
+          for (auto &h : rows)
+            h.clear();
+        for (auto &c : s->counters)
+          c.store(0, std::memory_order_relaxed);
+      }
+  }
+
+private:
+  using Counter = std::atomic<uint64_t>;
+
+  struct Hist {
+    Counter count, sum, max;
+    std::array<Counter, NUM_BINS> bins;
+
+    void clear() {
+      count.store(0, std::memory_order_relaxed);
+      sum.store(0, std::memory_order_relaxed);
+      max.store(0, std::memory_order_relaxed);
+      for (auto &b : bins)
+        b.store(0, std::memory_order_relaxed);
+    }
+  };
+
+  struct alignas(64) Shard {
+    // [op][total, lock wait, locked]
+    std::array<std::array<Hist, 3>, static_cast<size_t>(CacheOp::NUM_OPS)>
+        ops;
+    std::array<Counter,
+               static_cast<size_t>(CacheCounter::NUM_COUNTERS)>
+        counters;
+  };
+
+  // Plain copy of a Hist, summed over shards.
+  struct Row {
+    uint64_t count = 0, sum = 0, max = 0;
+    std::array<uint64_t, NUM_BINS> bins{};
+
+    void add(const Hist &h) {
+      count += h.count.load(std::memory_order_relaxed);
+      sum += h.sum.load(std::memory_order_relaxed);
+      max = std::max(max, h.max.load(std::memory_order_relaxed));
+      for (int b = 0; b < NUM_BINS; ++b)
+        bins[b] += h.bins[b].load(std::memory_order_relaxed);
+    }
+    double percentile(double q) const {
+      uint64_t rank = std::max<uint64_t>(
+          1, static_cast<uint64_t>(q * static_cast<double>(count) + 0.5));
+      uint64_t seen = 0;
+      for (int b = 0; b < NUM_BINS; ++b) {
+        seen += bins[b];
+        if (seen >= rank)
+          return std::min<double>(bin_mid(b), static_cast<double>(max));
+      }
+      return static_cast<double>(max);
+    }
+    LatencySummary summary(double ns) const {
+      LatencySummary s;
+      s.count = count;
+      if (count == 0)
+        return s;
+      s.mean_ns = static_cast<double>(sum) / count * ns;
+      s.p50_ns = percentile(0.50) * ns;
+      s.p99_ns = percentile(0.99) * ns;
+      s.max_ns = static_cast<double>(max) * ns;
+      return s;
+    }
+  };
+
+  mutable std::array<std::atomic<Shard *>, MAX_SHARDS> shards_{};
+  static inline thread_local Scope *current_ = nullptr;
+
+  static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return static_cast<uint64_t>(
+        std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+  }
+
+  // Ticks of now() to ns, measured once against steady_clock over ~5 ms.
+  static double ns_per_tick() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const double ratio = [] {
+      using clock = std::chrono::steady_clock;
+      auto t0 = clock::now();
+      uint64_t c0 = now();
+      while (clock::now() - t0 < std::chrono::milliseconds(5)) {
+      }
+      auto t1 = clock::now();
+      uint64_t c1 = now();
+      double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+      return c1 > c0 ? ns / static_cast<double>(c1 - c0) : 1.0;
+    }();
+    return ratio;
+#else
+    return std::chrono::duration<double, std::nano>(
+               std::chrono::steady_clock::duration(1))
+        .count();
+#endif
+  }
+
+  // Values below 4 get a bin each; above, each power of two is split in
+  // four: v in [2^e, 2^(e + 1)) goes to bin 4 (e - 1) + the two bits after
+  // its leading one.
+  static int bin_of(uint64_t v) {
+    if (v < 4)
+      return static_cast<int>(v);
+    int e = std::bit_width(v) - 1;
+    int b = 4 * (e - 1) + static_cast<int>((v >> (e - 2)) & 3);
+    return std::min(b, NUM_BINS - 1);
+  }
+  static double bin_mid(int b) {
+    if (b < 4)
+      return b;
+    int e = b / 4 + 1;
+    double lo = static_cast<double>(uint64_t(4 + b % 4) << (e - 2));
+    return lo + static_cast<double>(uint64_t(1) << (e - 2)) / 2;
+  }
+
+  static void bump(Counter &c, uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  static void record(Hist &h, uint64_t ticks) {
+    bump(h.count, 1);
+    bump(h.sum, ticks);
+    if (ticks > h.max.load(std::memory_order_relaxed))
+      h.max.store(ticks, std::memory_order_relaxed);
+    bump(h.bins[bin_of(ticks)], 1);
+  }
+
+  Shard &shard() const {
+    static std::atomic<unsigned> next_thread{0};
+    static thread_local size_t slot =
+        next_thread.fetch_add(1, std::memory_order_relaxed) % MAX_SHARDS;
+    Shard *s = shards_[slot].load(std::memory_order_acquire);
+    if (!s) {
+      auto fresh = std::make_unique<Shard>();
+      if (shards_[slot].compare_exchange_strong(s, fresh.get(),
+                                                std::memory_order_acq_rel))
+        s = fresh.release();
+    }
+    return *s;
+  }
+
+  void steal(CacheInstrument &other) {
+    for (size_t i = 0; i < MAX_SHARDS; ++i)
+      shards_[i].store(other.shards_[i].exchange(nullptr),
+                       std::memory_order_relaxed);
+  }
+  void release() {
+    for (auto &slot : shards_)
+      delete slot.exchange(nullptr);
+  }
+};
+
+#else
+
+class CacheInstrument {
+public:
+  static constexpr bool ENABLED = false;
+
+  class Scope {
+  public:
+    Scope(const CacheInstrument &, CacheOp) {}
+  };
+
+  void locked() const {}
+  void add(CacheCounter, uint64_t = 1) const {}
+  CacheStats stats() const { return {}; }
+  void reset() {}
+};
+
+#endif
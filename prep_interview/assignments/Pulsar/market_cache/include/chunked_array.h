@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// ---- Chunked array ----------------------------------------------------------
+
+// Fixed-capacity array whose elements are allocated CHUNK at a time, on first
+// touch through at(). Chunks never move or shrink once allocated, and their
+// pointers are published with release stores, so a lock-free (seqlock) reader
+// going through find() sees either a fully constructed chunk or nullptr.
+//
+// at() is writer-only: callers serialise it externally.
+template <typename T, size_t CHUNK> class ChunkedArray {
+public:
+  static constexpr size_t CHUNK_SIZE = CHUNK;
+
+  ChunkedArray() = default;
+  explicit ChunkedArray(size_t capacity)
+      : capacity_(capacity), num_chunks_((capacity + CHUNK - 1) / CHUNK),
+        chunks_(new std::atomic<T *>[num_chunks_]()), owned_(num_chunks_) {}
+
+  // Moved-from arrays are left empty (capacity 0).
+  ChunkedArray(ChunkedArray &&other) noexcept
+      : capacity_(std::exchange(other.capacity_, 0)),
+        num_chunks_(std::exchange(other.num_chunks_, 0)),
+        allocated_(std::exchange(other.allocated_, 0)),
+        chunks_(std::move(other.chunks_)), owned_(std::move(other.owned_)) {}
+  ChunkedArray &operator=(ChunkedArray &&other) noexcept {
+    capacity_ = std::exchange(other.capacity_, 0);
+    num_chunks_ = std::exchange(other.num_chunks_, 0);
+    allocated_ = std::exchange(other.allocated_, 0);
+    chunks_ = std::move(other.chunks_);
+    owned_ = std::move(other.owned_);
+    return *this;
+  }
+
+  size_t capacity() const { return capacity_; }
+  size_t num_chunks() const { return num_chunks_; }
+  size_t allocated_chunks() const { return allocated_; }
+
+  // Element i, allocating (value-initialising) its chunk if needed.
+  T &at(size_t i) {
+    size_t c = i / CHUNK;
+    if (!owned_[c]) {
+      owned_[c] = std::make_unique<T[]>(CHUNK);
+      chunks_[c].store(owned_[c].get(), std::memory_order_release);
+      ++allocated_;
+    }
+    return owned_[c][i % CHUNK];
+  }
+
+  // Element i, or nullptr if its chunk was never allocated or i is out of
+  // range.
+  const T *find(size_t i) const {
+    if (i >= capacity_)
+      return nullptr;
+    T *chunk = chunks_[i / CHUNK].load(std::memory_order_acquire);
+    return chunk ? chunk + i % CHUNK : nullptr;
+  }
+  T *find(size_t i) {
+    return const_cast<T *>(std::as_const(*this).find(i));
+  }
+
+  // Visit every element of every allocated chunk as f(index, element).
+  template <typename F> void for_each_allocated(F &&f) const {
+    for (size_t c = 0; c < num_chunks_; ++c) {
+      if (!owned_[c])
+        continue;
+      size_t end = std::min(CHUNK, capacity_ - c * CHUNK);
+      for (size_t k = 0; k < end; ++k)
+        f(c * CHUNK + k, owned_[c][k]);
+    }
+  }
+
+  // Heap bytes: chunk table plus allocated chunks (not what T itself owns).
+  size_t memory_usage() const {
+    return num_chunks_ *
+               (sizeof(std::atomic<T *>) + sizeof(std::unique_ptr<T[]>)) +
+           allocated_ * CHUNK * sizeof(T);
+  }
+
+private:
+  size_t capacity_ = 0;
+  size_t num_chunks_ = 0;
+  size_t allocated_ = 0;
+  std::unique_ptr<std::atomic<T *>[]> chunks_; // reader-visible
+  std::vector<std::unique_ptr<T[]>> owned_;    // writer-side ownership
+};
@@ -1,17 +1,28 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
 #include <climits>
 #include <cmath>
 #include <cstdint>
+#include <deque>
 #include <limits>
 #include <memory>
 #include <mutex>
 #include <shared_mutex>
+#include <span>
 #include <string>
 #include <tuple>
 #include <vector>
 
+#include "cache_instrument.h"
+#include "chunked_array.h"
+#include "rollup_ring.h"
+#include "spread_sketch.h"
+#include "spread_slab.h"
+
 // ---- Data types -------------------------------------------------------------
 
 struct PriceLevel {
@@ -19,47 +30,285 @@ struct PriceLevel {
   double amount;
 };
 
+// How a feed orders the levels of MarketDataEntry::bids / asks.
+enum class LevelOrder {
+  // Any order: every level is scanned for the best bid and ask (AVX2 when
+  // the CPU has it).
+  Unsorted,
+  // Best level first (bids by descending, asks by ascending price): only
+  // bids[0] and asks[0] are read.
+  BestFirst,
+};
+
+// Entry whose levels live elsewhere (a reused buffer, a RunArena reset per
+// batch): what the ingest path reads, so a producer need not allocate per
+// tick.
+struct MarketDataEntryView {
+  int64_t time; // UTC epoch in nanoseconds
+  std::span<const PriceLevel> bids;
+  std::span<const PriceLevel> asks;
+
+  // Spread = lowest ask price - highest bid price; NaN if a side is empty.
+  // With BestFirst the levels are trusted to be sorted and not checked.
+  double compute_spread(LevelOrder order = LevelOrder::Unsorted) const;
+};
+
 struct MarketDataEntry {
   int64_t time; // UTC epoch in nanoseconds
   std::vector<PriceLevel> bids;
   std::vector<PriceLevel> asks;
 
-  // Spread = lowest ask price - highest bid price.
-  double compute_spread() const;
+  MarketDataEntryView view() const { return {time, bids, asks}; }
+  double compute_spread(LevelOrder order = LevelOrder::Unsorted) const {
+    return view().compute_spread(order);
+  }
+};
+
+// ---- Book metrics -----------------------------------------------------------
+
+// The best levels of each side of one entry, best first (bids by descending,
+// asks by ascending price), gathered in a single scan of the levels. The
+// cache derives the spread and every registered metric from it. NaN prices
+// are skipped as in compute_spread; with BestFirst the leading levels are
+// taken as they are.
+struct BookTop {
+  static constexpr int MAX_LEVELS = 16;
+
+  bool two_sided = false; // neither side of the entry was empty
+  int num_bids = 0;
+  int num_asks = 0;
+  PriceLevel bids[MAX_LEVELS];
+  PriceLevel asks[MAX_LEVELS];
+
+  // Keep the best min(levels, MAX_LEVELS) levels of each side.
+  void build(const MarketDataEntryView &entry, LevelOrder order, int levels);
+
+  // Same as entry.compute_spread(order).
+  double spread() const;
+  // Amount on the best `levels` kept levels of one side.
+  double bid_depth(int levels) const;
+  double ask_depth(int levels) const;
+};
+
+enum class BookMetric : uint8_t {
+  Mid,        // (best bid + best ask) / 2
+  Microprice, // best prices, each weighted by the other side's best amount
+  Depth,      // amount on the best `levels` levels of both sides
+  Imbalance,  // (bid - ask) / (bid + ask) depth over the best `levels`
+  Custom,     // fn(top), top holding the best `levels` of each side
+};
+
+struct MetricSpec {
+  BookMetric kind = BookMetric::Mid;
+  int levels = 1; // 1 .. BookTop::MAX_LEVELS
+  double (*fn)(const BookTop &) = nullptr; // Custom only
+
+  // The metric's value for one entry; NaN leaves the entry out of it.
+  double eval(const BookTop &top) const;
 };
 
 // ---- Cache ------------------------------------------------------------------
 
-class MarketDataCache {
+// Geometry-independent options, shared by every BasicMarketDataCache.
+struct MarketDataCacheBase {
+  // Layout of the per-bin Fenwick trees behind spread_percentiles.
+  enum class HistIndex {
+    // One Fenwick tree per bin, stored bin after bin: a percentile query runs
+    // two prefix walks per bin (~100 x 2 x log N scattered loads).
+    BinMajorFenwick,
+    // One Fenwick tree whose nodes are whole NUM_HIST_BINS histograms, stored
+    // bucket after bucket: a range histogram is ~2 x log N contiguous
+    // 400-byte row adds that the compiler vectorizes.
+    BucketMajorFenwick,
+  };
+
+  // How the range indexes are laid out. In both modes a bucket only costs
+  // memory (~0.5 KB plus its spreads) while it holds entries.
+  enum class Storage {
+    // Segment tree and Fenwick index over every bucket (~18 MB once active
+    // for MarketDataCache). Fastest queries whatever the range.
+    Dense,
+    // Segment tree and bucket-major Fenwick over blocks of HIST_BLOCK buckets
+    // (~600 KB for MarketDataCache). Range ends that cut a block are read
+    // from the buckets themselves, so results are identical to Dense at the
+    // cost of a few dozen bucket reads per query. Spread pages are also
+    // freed whenever the whole window is dropped. hist_index is ignored
+    // (always BucketMajorFenwick).
+    Compact,
+  };
+
+  // One coarser tier behind the live window, see enable_rollups().
+  struct RollupTier {
+    int64_t bucket_ns;
+    int num_buckets;
+  };
+  // 1 s cells for an hour, 1 min for a day, 1 h for a week.
+  static constexpr RollupTier DEFAULT_ROLLUPS[] = {
+      {1'000'000'000LL, 3'600},
+      {60'000'000'000LL, 1'440},
+      {3'600'000'000'000LL, 168},
+  };
+
+  // A tick whose spread is already computed (see insert_spreads).
+  struct SpreadTick {
+    int64_t time;
+    double spread;
+  };
+
+  // Result of spread_summary(). min/max are NaN and every quantile is NaN
+  // when count is 0.
+  struct SpreadSummary {
+    int64_t count = 0;
+    double min_spread;
+    double max_spread;
+    std::vector<double> quantiles;
+  };
+
+  // Result of metric_summary(). mean, min and max are NaN when count is 0.
+  struct MetricSummary {
+    int64_t count = 0;
+    double sum = 0.0;
+    double mean;
+    double min;
+    double max;
+  };
+
+  // Result of rolling_stats(): the spread_summary() of the subscription's
+  // window [start_time, end_time], which ends with the newest bucket. Before
+  // the subscription has seen any tick, end_time < start_time.
+  struct RollingStats : SpreadSummary {
+    int64_t start_time = 0;
+    int64_t end_time = -1;
+  };
+};
+
+// Rolling window of NumBuckets buckets of BucketNs nanoseconds each, with a
+// NumHistBins-bin histogram per bucket. The geometry is fixed at compile time
+// so bucket and bin arithmetic constant-folds; when BucketNs / NumBuckets are
+// powers of two, time -> bucket and bucket -> ring slot are a shift and a
+// mask.
+//
+// Member definitions live in market_data_cache_impl.h. The geometries aliased
+// at the end of this file are instantiated once in market_data_cache.cpp; to
+// use another one, include market_data_cache_impl.h and instantiate it.
+template <int64_t BucketNs, int NumBuckets, int NumHistBins>
+class BasicMarketDataCache : public MarketDataCacheBase {
+  static_assert(BucketNs > 0 && NumBuckets > 0 && NumHistBins > 0);
+  // Fenwick cell indices are int.
+  static_assert(static_cast<int64_t>(NumBuckets + 1) * NumHistBins <= INT_MAX);
+
 public:
   // --- Configuration constants ---
-  static constexpr int64_t BUCKET_NS = 100'000'000LL; // 100 ms
-  static constexpr int NUM_BUCKETS = 36'000;          // 1 hour
-  static constexpr int SEG_TREE_SIZE = 4 * NUM_BUCKETS;
-  static constexpr int NUM_HIST_BINS = 100;
+  static constexpr int64_t BUCKET_NS = BucketNs;
+  static constexpr int NUM_BUCKETS = NumBuckets;
+  // Bottom-up segment tree: leaves start at SEG_LEAVES (power of two).
+  static constexpr int SEG_LEAVES = [] {
+    int n = 1;
+    while (n < NUM_BUCKETS)
+      n <<= 1;
+    return n;
+  }();
+  static constexpr int SEG_TREE_SIZE = 2 * SEG_LEAVES;
+  static constexpr int NUM_HIST_BINS = NumHistBins;
+  // Compact storage indexes blocks of HIST_BLOCK buckets.
+  static constexpr int HIST_BLOCK = 32;
+  static constexpr int NUM_BLOCKS = (NUM_BUCKETS + HIST_BLOCK - 1) / HIST_BLOCK;
+  static constexpr int SEG_BLOCK_LEAVES = [] {
+    int n = 1;
+    while (n < NUM_BLOCKS)
+      n <<= 1;
+    return n;
+  }();
+  // Run lengths of the exact-quantile index: 8 .. 4096 buckets.
+  static constexpr int EXACT_MIN_LEVEL = 3;
+  static constexpr int EXACT_MAX_LEVEL =
+      std::min<int>(12, std::bit_width(static_cast<unsigned>(NUM_BUCKETS)) - 1);
 
   // --- Construction ---
-  explicit MarketDataCache(double hist_min = -5.0, double hist_max = 95.0);
+  explicit BasicMarketDataCache(
+      double hist_min = -5.0, double hist_max = 95.0,
+      HistIndex hist_index = HistIndex::BinMajorFenwick,
+      Storage storage = Storage::Dense);
 
   // Move constructor / assignment (shared_mutex is not movable, so we
   // construct a fresh one — the moved-from object must not be used).
-  MarketDataCache(MarketDataCache &&other) noexcept;
-  MarketDataCache &operator=(MarketDataCache &&other) noexcept;
+  BasicMarketDataCache(BasicMarketDataCache &&other) noexcept;
+  BasicMarketDataCache &operator=(BasicMarketDataCache &&other) noexcept;
 
   // Not copyable (contains mutex).
-  MarketDataCache(const MarketDataCache &) = delete;
-  MarketDataCache &operator=(const MarketDataCache &) = delete;
+  BasicMarketDataCache(const BasicMarketDataCache &) = delete;
+  BasicMarketDataCache &operator=(const BasicMarketDataCache &) = delete;
 
   // Load entries from a JSON file (format: {"market_data_entries": [...]}).
-  static MarketDataCache with_file(const std::string &file_path,
-                                   double hist_min = -5.0,
-                                   double hist_max = 95.0);
+  static BasicMarketDataCache with_file(const std::string &file_path,
+                                        double hist_min = -5.0,
+                                        double hist_max = 95.0);
+
+  // Same format, but the file is mmap'd and parsed in place with
+  // std::from_chars into views over a reused arena; entries are inserted in
+  // batches as they are parsed instead of being collected first, with no
+  // allocation per entry. Entries with a null utc_epoch_ns are skipped.
+  static BasicMarketDataCache with_file_mmap(const std::string &file_path,
+                                             double hist_min = -5.0,
+                                             double hist_max = 95.0);
+
+  // Parallel variant of with_file_mmap: the entries array is split at entry
+  // boundaries into `num_threads` chunks (0 = WorkerPool::shared()'s
+  // concurrency) that the shared pool parses concurrently; parsed chunks are
+  // then inserted in file order, so the result is identical to the
+  // sequential loaders.
+  static BasicMarketDataCache with_file_parallel(const std::string &file_path,
+                                                 double hist_min = -5.0,
+                                                 double hist_max = 95.0,
+                                                 unsigned num_threads = 0);
+
+  // --- Snapshots ---
+  // Write the window (buckets with their spreads, segment tree, Fenwick
+  // cells and window bookkeeping) to `path` in the versioned layout of
+  // market_data_snapshot.h. The file is written next to `path` and renamed
+  // over it, so a concurrent reader sees the old snapshot or the new one,
+  // never a partial one. Takes the shared lock. The opt-in indexes (exact,
+  // sketch, rollups) and subscriptions are not saved. Throws
+  // std::runtime_error on I/O failure.
+  void save_snapshot(const std::string &path) const;
+
+  // Cache restored from save_snapshot: the file is mapped read-only (another
+  // process may own it) and each section is copied into place, so a restart
+  // costs a page-in and a memcpy instead of re-inserting every tick. Throws
+  // std::runtime_error if the file is truncated, not a snapshot, or was
+  // written by another version or geometry.
+  static BasicMarketDataCache load_snapshot(const std::string &path);
 
   // --- Mutators ---
+  // Views and owning entries insert alike. Once the window has filled and
+  // scratch capacities have settled, neither form allocates per tick (with
+  // dense storage and no opt-in index or subscription).
   void insert(const MarketDataEntry &data);
+  void insert(const MarketDataEntryView &data);
+
+  // Insert a burst of entries under a single lock acquisition. Bucket data is
+  // updated per entry, but the Fenwick trees get one delta per touched
+  // (bin, bucket) and the segment tree is refreshed once over all touched
+  // buckets. Equivalent to calling insert() on each entry in order.
+  void insert_batch(std::span<const MarketDataEntry> batch);
+  void insert_batch(std::span<const MarketDataEntryView> batch);
+  // insert_batch for ticks whose spreads were computed elsewhere (e.g. on
+  // the feed thread, see MarketDataIngestor). Spreads must not be NaN.
+  void insert_spreads(std::span<const SpreadTick> ticks);
   void remove_up_to(int64_t time);
 
+  // How this cache's feed orders its levels; insert and insert_batch compute
+  // spreads accordingly. Unsorted until set. Can be changed while inserts
+  // run: each entry uses either the old order or the new one.
+  void set_level_order(LevelOrder order);
+  LevelOrder level_order() const;
+
   // --- Queries (hot-path) ---
+  // count, count_range, min/max_spread, spread_percentiles and
+  // spread_quantiles are answered optimistically under a seqlock and never
+  // touch mutex_ unless a reader keeps colliding with the writer; the _exact
+  // variants take the shared lock because they walk per-bucket vectors the
+  // writer may reallocate.
   int64_t count() const;
   int64_t count_range(int64_t start_time, int64_t end_time) const;
 
@@ -69,15 +318,155 @@ public:
   std::tuple<double, double, double>
   spread_percentiles_exact(int64_t start_time, int64_t end_time) const;
 
+  // Any number of quantiles at once: result[i] is the qs[i]-quantile (nearest
+  // rank, qs[i] in [0, 1]), NaN if the range is empty. The approximate
+  // version answers every q from one cumulative sweep of the range
+  // histogram; the exact one partitions the collected spreads once around all
+  // requested ranks (O(n log k) for k quantiles), or goes through the exact
+  // index when enable_exact_index() was called. Throws
+  // std::invalid_argument on a q outside [0, 1].
+  std::vector<double> spread_quantiles(int64_t start_time, int64_t end_time,
+                                       std::span<const double> qs) const;
+  std::vector<double> spread_quantiles_exact(int64_t start_time,
+                                             int64_t end_time,
+                                             std::span<const double> qs) const;
+
+  // spread_quantiles_exact for long ranges, split over up to `num_threads`
+  // workers of WorkerPool::shared() (0 = all of them). The range histogram
+  // names the bin holding each requested rank; workers scan disjoint slices
+  // of the range, taking the shared lock for a few hundred buckets at a
+  // time, skip buckets with no tick in those bins and copy out only the
+  // ticks that are, and each bin's ranks are then selected on its own worker
+  // with no lock held. Returns exactly what spread_quantiles_exact does for
+  // the state at the call; ranges under PARALLEL_EXACT_MIN_TICKS ticks and
+  // caches with the exact index take the sequential path.
+  static constexpr int64_t PARALLEL_EXACT_MIN_TICKS = 1 << 16;
+  std::vector<double>
+  spread_quantiles_exact_parallel(int64_t start_time, int64_t end_time,
+                                  std::span<const double> qs,
+                                  unsigned num_threads = 0) const;
+  std::tuple<double, double, double>
+  spread_percentiles_exact_parallel(int64_t start_time, int64_t end_time,
+                                    unsigned num_threads = 0) const;
+
   double min_spread(int64_t start_time, int64_t end_time) const;
   double max_spread(int64_t start_time, int64_t end_time) const;
 
+  // --- Exact-quantile index (opt-in) ---
+  // Keeps sorted copies of the spreads of aligned runs of 2^h buckets
+  // (EXACT_MIN_LEVEL <= h <= EXACT_MAX_LEVEL) once the window has moved past
+  // them. The _exact queries then cover their range with O(log n) sorted runs
+  // plus at most 3 x 2^EXACT_MIN_LEVEL loose buckets and select each rank by
+  // pivoting on the runs' medians, so their cost no longer grows with the
+  // number of ticks in range. Costs one extra copy of every spread per level,
+  // and a merge per level as the window advances. Enabling indexes the
+  // current contents; throws std::logic_error if NUM_BUCKETS is shorter than
+  // one run.
+  void enable_exact_index();
+  bool exact_index_enabled() const;
+
+  // --- Relative-error sketch (opt-in) ---
+  // Keeps a DDSketch-style log-bucket sketch (spread_sketch.h) per bucket
+  // plus a Fenwick tree of per-block sketches, so spread_quantiles_sketch
+  // answers any range with ~2 log NUM_BLOCKS sketch merges plus the bucket
+  // sketches of the two partly covered edge blocks. Each quantile is within a factor
+  // (1 +- alpha) of the exact nearest-rank value whatever its sign or
+  // magnitude: unlike the histogram there is no range to configure and
+  // outliers are not clamped into the edge bins. Enabling sketches the
+  // current contents; calling it again rebuilds with the new alpha. Throws
+  // std::invalid_argument unless 0 < alpha < 1.
+  void enable_sketch(double alpha = 0.01);
+  bool sketch_enabled() const;
+  // Same contract as spread_quantiles. Takes the shared lock; throws
+  // std::logic_error if enable_sketch() was never called.
+  std::vector<double> spread_quantiles_sketch(int64_t start_time,
+                                              int64_t end_time,
+                                              std::span<const double> qs) const;
+
+  // --- Rollup tiers (opt-in) ---
+  // Buckets evicted from the window are folded into a cascade of coarser
+  // rings (rollup_ring.h) instead of being dropped; cells evicted from the
+  // last tier are dropped, so memory stays fixed. Each tier's bucket_ns must
+  // be a multiple of the previous tier's (the first one's, of BUCKET_NS).
+  // remove_up_to also drops tier cells that end at or before its time.
+  // Replaces any tiers enabled before. Throws std::invalid_argument on a bad
+  // tier list.
+  void enable_rollups(std::span<const RollupTier> tiers = DEFAULT_ROLLUPS);
+  bool rollups_enabled() const;
+
+  // count, min, max and approximate quantiles of [start_time, end_time]
+  // stitched from the window and every rollup tier; with no tiers it covers
+  // the window alone. Each part answers at its own granularity, so a tier
+  // cell that overlaps the range counts whole. One range query per tier,
+  // whatever the length of the range. Takes the shared lock.
+  SpreadSummary spread_summary(int64_t start_time, int64_t end_time,
+                               std::span<const double> qs = {}) const;
+
+  // --- Rolling subscriptions ---
+  // A subscription follows the last `window_ns` (rounded up to whole
+  // buckets, capped at the window) up to the newest bucket and keeps its
+  // count, histogram and sliding min / max current as ticks arrive: O(1)
+  // per subscription per insert, plus one histogram row per bucket that
+  // slides out, whatever the window length. rolling_stats() then reads them
+  // in O(NUM_HIST_BINS) instead of querying the range. A tick that lands
+  // late, in an older bucket of the window, keeps counts and quantiles
+  // incremental but sends min / max through the segment tree until that
+  // bucket slides out. Ids are never reused. subscribe() throws
+  // std::invalid_argument on window_ns <= 0 or a q outside [0, 1];
+  // rolling_stats() takes the shared lock and throws std::out_of_range on an
+  // unknown id.
+  int subscribe(int64_t window_ns, std::span<const double> qs = {});
+  void unsubscribe(int id);
+  RollingStats rolling_stats(int id) const;
+
+  // --- Book metrics (opt-in) ---
+  // Aggregates of up to MAX_METRICS more per-entry metrics (mid,
+  // microprice, top-N depth, imbalance, or a function of the book top).
+  // Each metric has its own columns: separate count, sum, min and max
+  // arrays with one cell per bucket holding data, and a segment tree over
+  // buckets. A query on one metric therefore reads nothing of the others or
+  // of the spread. Once a metric exists, insert and insert_batch scan each
+  // entry's levels once (a BookTop) for the spread and every metric. A
+  // metric covers entries inserted after it was added. An entry whose value
+  // is NaN is left out of that metric alone. insert_spreads (and so
+  // MarketDataIngestor) carries no levels and feeds no metric. Cells (32
+  // bytes per bucket) grow with the occupied buckets, as the bucket pool
+  // does, whatever the Storage; only the tree is allocated up front (5.2 MB
+  // per metric for MarketDataCache). They are not saved in snapshots.
+  // add_metric returns the metric's id (0, 1, ...). It throws
+  // std::invalid_argument on a bad spec and std::length_error past
+  // MAX_METRICS.
+  static constexpr int MAX_METRICS = 8;
+  int add_metric(const MetricSpec &spec);
+  int num_metrics() const;
+  // count, sum, mean, min and max of metric `id` over [start_time,
+  // end_time]. Answered optimistically like count_range. Throws
+  // std::out_of_range on an unknown id.
+  MetricSummary metric_summary(int id, int64_t start_time,
+                               int64_t end_time) const;
+
+  // --- Instrumentation ---
+  // Latency of each public method (split into lock wait and locked time
+  // where it locks) and counters for evictions, Fenwick updates and
+  // optimistic-read collisions, summed over threads; see
+  // cache_instrument.h. Recorded only in builds with MARKET_CACHE_INSTRUMENT,
+  // else stats().enabled is false. Cheap enough to poll and log
+  // periodically; reset_stats() starts a new interval.
+  CacheStats stats() const { return instrument_.stats(); }
+  void reset_stats() { instrument_.reset(); }
+
   // --- Accessors ---
   double hist_min() const { return hist_min_; }
   double hist_max() const {
     return hist_min_ + NUM_HIST_BINS * hist_bin_width_;
   }
   double hist_bin_width() const { return hist_bin_width_; }
+  HistIndex hist_index() const { return hist_index_; }
+  Storage storage() const { return storage_; }
+
+  // Heap bytes held by this cache. Zero until the first insert: bucket and
+  // index storage is allocated lazily.
+  size_t memory_usage() const;
 
 private:
   static constexpr double POS_INF = std::numeric_limits<double>::infinity();
@@ -86,6 +475,13 @@ private:
   // ---- Histogram helpers ----
   double hist_min_;
   double hist_bin_width_;
+  HistIndex hist_index_;
+  Storage storage_;
+  std::atomic<LevelOrder> level_order_{LevelOrder::Unsorted};
+
+  bool compact() const { return storage_ == Storage::Compact; }
+
+  using HistRow = std::array<int32_t, NUM_HIST_BINS>;
 
   int spread_to_bin(double spread) const {
     int b = static_cast<int>((spread - hist_min_) / hist_bin_width_);
@@ -105,56 +501,555 @@ private:
     int64_t entry_count = 0;
     double min_spread = POS_INF;
     double max_spread = NEG_INF;
-    std::vector<double> spreads;
-    std::array<int32_t, NUM_HIST_BINS> hist{};
+    SpreadSlab::List spreads; // in spread_slab_
+    HistRow hist{};
+    int32_t batch_slot = -1; // index into batch_touched_ while batching
 
+    // Leaves `spreads` to the caller, which owns the slab.
     void clear() {
       abs_index = -1;
       entry_count = 0;
       min_spread = POS_INF;
       max_spread = NEG_INF;
-      spreads.clear();
       hist.fill(0);
     }
   };
 
-  std::vector<Bucket> buckets_;
+  // Only occupied buckets hold a Bucket: bucket_slot_[local] indexes
+  // bucket_pool_ (-1 while empty), and cleared Buckets go back on a free list
+  // for reuse. The pool grows a chunk at a time up to NUM_BUCKETS entries.
+  // Buckets dropped with the whole window are only detached from
+  // bucket_slot_ and parked on bucket_stale_; buckets cut off by a longer
+  // partial eviction stay attached and indexed (see evicted_). Later
+  // writes clear STALE_SWEEP of either kind per tick, probing at most
+  // SWEEP_PROBES empty evicted positions.
+  static constexpr size_t BUCKET_POOL_CHUNK = 64;
+  static constexpr size_t STALE_SWEEP = 1;
+  static constexpr int SWEEP_PROBES = 64;
+  std::vector<int32_t> bucket_slot_;
+  ChunkedArray<Bucket, BUCKET_POOL_CHUNK> bucket_pool_;
+  std::vector<int32_t> bucket_free_;
+  std::vector<int32_t> bucket_stale_;
+  int32_t bucket_pool_used_ = 0;
+  // Every bucket's spreads. Dropping the whole window resets it wholesale,
+  // so stale buckets' lists need no per-bucket clear.
+  SpreadSlab spread_slab_;
+
+  void sweep_stale(size_t budget);
+
+  const Bucket *find_bucket(int local) const {
+    return bucket_pool_.find(static_cast<size_t>(bucket_slot_[local]));
+  }
+  Bucket *find_bucket(int local) {
+    return bucket_pool_.find(static_cast<size_t>(bucket_slot_[local]));
+  }
+  // Bucket at `local`; an empty slot takes one from the pool, stamped with
+  // `abs`. Callers clear a stale bucket first.
+  Bucket &bucket_at(int local, int64_t abs);
+  bool bucket_holds(int local, int64_t abs) const {
+    const Bucket *b = find_bucket(local);
+    return b && b->abs_index == abs;
+  }
 
   // ---- Segment tree (count / min / max) ----
-  struct SegNode {
+  // Iterative, power-of-two sized: node i has children 2i and 2i+1, leaf for
+  // position `pos` is seg_leaves_ + pos, padding leaves hold the identity.
+  // A position is a bucket (Dense) or a block (Compact), see seg_pos().
+  // 32-byte nodes put every sibling pair in one 64-byte line, so each level
+  // of an update or query touches a single cache line.
+  struct alignas(32) SegNode {
     int64_t count = 0;
     double min_spread = POS_INF;
     double max_spread = NEG_INF;
+    uint32_t epoch = 0; // see epoch_; ignored on query results
   };
   std::vector<SegNode> seg_;
+  int seg_leaves_ = SEG_LEAVES;
 
-  void seg_update(int node, int lo, int hi, int pos);
-  SegNode seg_query(int node, int lo, int hi, int ql, int qr) const;
+  // Node as of the current epoch: one written in an older epoch reads as
+  // the identity.
+  const SegNode &seg_at(int node) const {
+    static constexpr SegNode kEmpty{};
+    return seg_[node].epoch == epoch_ ? seg_[node] : kEmpty;
+  }
+
+  int seg_pos(int local) const {
+    return compact() ? local / HIST_BLOCK : local;
+  }
+
+  static void seg_combine(SegNode &into, const SegNode &other) {
+    into.count += other.count;
+    into.min_spread = std::min(into.min_spread, other.min_spread);
+    into.max_spread = std::max(into.max_spread, other.max_spread);
+  }
+  void seg_set_leaf(int pos);
+  void seg_pull(int node);
+  void seg_update(int pos);
+  // Fold one spread into leaf `pos` without rereading bucket data.
+  void seg_add_tick(int pos, double spread);
+  // Refresh every leaf in the sorted range [first, last), then each touched
+  // ancestor exactly once, level by level. Clobbers the range.
+  void seg_update_many(int *first, int *last);
+  SegNode seg_query(int l, int r) const;
 
   // ---- Fenwick trees (one per histogram bin) ----
+  // Dense: (NUM_BUCKETS + 1) x NUM_HIST_BINS cells for either HistIndex; only
+  // the cell order differs. Compact: (NUM_BLOCKS + 1) bucket-major rows.
+  // The update functions take a bucket's local index, fw_row_range takes
+  // tree positions.
   std::vector<int32_t> fenwick_;
+  // Epoch each tree position was last written in (index 1..positions); the
+  // cells of a stale position read as zero and are zeroed on first write.
+  std::vector<uint32_t> fw_epoch_;
+
+  bool fw_live(int p) const { return fw_epoch_[p] == epoch_; }
+  void fw_touch(int p);
 
-  int fw_idx(int bin, int pos) const { return bin * (NUM_BUCKETS + 1) + pos; }
+  int fw_positions() const { return compact() ? NUM_BLOCKS : NUM_BUCKETS; }
+  int fw_pos(int local) const {
+    return compact() ? local / HIST_BLOCK : local;
+  }
+  int fw_idx(int bin, int pos) const {
+    return hist_index_ == HistIndex::BucketMajorFenwick
+               ? pos * NUM_HIST_BINS + bin
+               : bin * (NUM_BUCKETS + 1) + pos;
+  }
   void fw_update(int bin, int local_pos, int delta);
-  int fw_prefix(int bin, int local_pos) const;
   int fw_range(int bin, int l, int r) const;
 
+  // Bucket-major only: whole-row update and range histogram.
+  void fw_row_update(int local_pos, const int32_t *delta, int sign);
+  void fw_row_range(int lo, int hi, int32_t *out, int sign) const;
+  // Apply a bucket's histogram (sign = +1 / -1) to whichever index is active.
+  void fw_add_hist(int local_pos, const HistRow &hist, int sign);
+
   // ---- Window bookkeeping ----
+  // Bumped whenever every index is dropped at once: Fenwick positions and
+  // segment-tree nodes written in an older epoch count as empty, so
+  // dropping the whole window costs a pass over bucket_slot_ instead of one
+  // tree update per bucket.
+  uint32_t epoch_ = 0;
   int64_t total_count_ = 0;
   int64_t window_start_abs_ = INT64_MAX;
   int64_t window_end_abs_ = INT64_MIN;
+  // Buckets of the evicted ranges still attached were evicted but are still
+  // in every index; they have left total_count_. Each sits at the position
+  // of abs + NUM_BUCKETS, and no live bucket does, so queries skip those
+  // positions (for_each_live_range) and a write to one first takes it out of
+  // its range (release_evicted). Ranges are disjoint and oldest first; a
+  // fixed array, since optimistic readers walk it unlocked.
+  struct EvictedRange {
+    int64_t first;
+    int64_t last;
+  };
+  static constexpr int MAX_EVICTED_RANGES = 8;
+  std::array<EvictedRange, MAX_EVICTED_RANGES> evicted_{};
+  int num_evicted_ = 0;
 
-  static int64_t to_abs_bucket(int64_t time_ns);
-  static int to_local(int64_t abs_bucket);
+  // Set (release) once bucket_slot_/bucket_pool_/seg_/fenwick_ are allocated;
+  // they are never reallocated afterwards (pool chunks are added but never
+  // move), so optimistic readers that observe it (acquire) can index them
+  // safely.
+  std::atomic<bool> storage_ready_{false};
+  void ensure_storage();
+  bool has_data() const {
+    return storage_ready_.load(std::memory_order_acquire) &&
+           window_start_abs_ <= window_end_abs_;
+  }
+
+  // Floor division / modulo that also round negative times down.
+  static int64_t to_abs_bucket(int64_t time_ns) {
+    if constexpr (std::has_single_bit(static_cast<uint64_t>(BUCKET_NS))) {
+      return time_ns >> std::countr_zero(static_cast<uint64_t>(BUCKET_NS));
+    } else {
+      if (time_ns >= 0)
+        return time_ns / BUCKET_NS;
+      return (time_ns - BUCKET_NS + 1) / BUCKET_NS;
+    }
+  }
+  static int to_local(int64_t abs_bucket) {
+    if constexpr (std::has_single_bit(static_cast<unsigned>(NUM_BUCKETS))) {
+      return static_cast<int>(abs_bucket & (NUM_BUCKETS - 1));
+    } else {
+      int local = static_cast<int>(abs_bucket % NUM_BUCKETS);
+      if (local < 0)
+        local += NUM_BUCKETS;
+      return local;
+    }
+  }
 
   void clear_bucket_at(int local);
 
+  // Evict every bucket in [window_start_abs_, new_start), rolling each up
+  // first if `roll_up` and tiers are enabled; the caller moves
+  // window_start_abs_. Dropping the whole window is an epoch bump plus a pass
+  // over bucket_slot_, and up to EAGER_EVICT buckets are cleared on the spot.
+  // More only leave total_count_ and join the evicted ranges, and
+  // sweep_stale takes them out of the indexes a few per later write.
+  static constexpr int64_t EAGER_EVICT = 8;
+  void evict_before(int64_t new_start, bool roll_up);
+  void evict_all();
+  void bump_epoch();
+  // Clear the evicted buckets of [first, last] still attached.
+  void sweep_evicted(int64_t first, int64_t last);
+  // Clears evicted bucket `abs` and splits its range around it.
+  void release_evicted(int64_t abs);
+  // Inserts in order, extending the range just before when adjacent; past
+  // MAX_EVICTED_RANGES the shortest range is swept whole. Returns whether
+  // [first, last] was kept rather than swept.
+  bool add_evicted_range(int64_t first, int64_t last);
+  void drop_evicted_range(int i);
+
   SegNode query_seg_range(int64_t start_abs, int64_t end_abs) const;
   int query_fw_range(int bin, int64_t start_abs, int64_t end_abs) const;
+  // Bucket-major only: histogram of [start_abs, end_abs] added into `out`.
+  void query_hist_range(int64_t start_abs, int64_t end_abs, HistRow &out) const;
+
+  // Calls f(l, r) for each unwrapped local range [l, r] covering the part of
+  // [start_abs, end_abs] that can hold data: the window minus the positions
+  // of evicted buckets not yet swept.
+  template <typename F>
+  void for_each_live_range(int64_t start_abs, int64_t end_abs, F &&f) const {
+    if (!has_data())
+      return;
+    start_abs = std::max(start_abs, window_start_abs_);
+    end_abs = std::min(end_abs, window_end_abs_);
+    auto emit = [&](int64_t a, int64_t b) {
+      if (a > b)
+        return;
+      int l = to_local(a), r = to_local(b);
+      if (l <= r) {
+        f(l, r);
+      } else {
+        f(l, NUM_BUCKETS - 1);
+        f(0, r);
+      }
+    };
+    int n = std::clamp(num_evicted_, 0, MAX_EVICTED_RANGES);
+    for (int i = 0; i < n && start_abs <= end_abs; ++i) {
+      const EvictedRange &e = evicted_[i];
+      emit(start_abs, std::min(end_abs, e.first + NUM_BUCKETS - 1));
+      start_abs = std::max(start_abs, e.last + NUM_BUCKETS + 1);
+    }
+    emit(start_abs, end_abs);
+  }
+
+  // Unwrapped local ranges [l, r].
+  SegNode seg_range_local(int l, int r) const;
+  void hist_range_local(int l, int r, int32_t *out, int sign) const;
+
+  // Compact: split [l, r] into up to two runs of buckets that only partly
+  // cover a block, on_buckets(lo, hi), and whole blocks, on_blocks(lo, hi).
+  template <typename OnBuckets, typename OnBlocks>
+  static void split_blocks(int l, int r, OnBuckets &&on_buckets,
+                           OnBlocks &&on_blocks) {
+    int first = (l + HIST_BLOCK - 1) / HIST_BLOCK;
+    int end = r == NUM_BUCKETS - 1 ? NUM_BLOCKS : (r + 1) / HIST_BLOCK;
+    if (first >= end) {
+      on_buckets(l, r);
+      return;
+    }
+    if (l < first * HIST_BLOCK)
+      on_buckets(l, first * HIST_BLOCK - 1);
+    on_blocks(first, end - 1);
+    if (end * HIST_BLOCK <= r)
+      on_buckets(end * HIST_BLOCK, r);
+  }
 
   void collect_spreads(int64_t start_abs, int64_t end_abs,
                        std::vector<double> &out) const;
 
+  // ---- Insert with a precomputed spread ----
+  // `metrics` holds the entry's first `num_metrics` metric values, if any.
+  void insert_spread(int64_t time, double spread,
+                     const double *metrics = nullptr, int num_metrics = 0);
+
+  // Slide the window so `abs` is inside it, evicting buckets that fall out.
+  // Returns false if `abs` is older than the window (the entry is dropped).
+  bool advance_window(int64_t abs);
+  // Add one spread (and its metric values) to bucket data and
+  // total_count_; the trees are left to the caller. Returns the local index.
+  int add_to_bucket(int64_t abs, double spread, int bin,
+                    const double *metrics = nullptr, int num_metrics = 0);
+
+  // ---- Batch insert (writer-only scratch, guarded by the unique lock) ----
+  // Scratch beyond BATCH_SCRATCH_KEEP touched buckets is released after each
+  // flush so one large load does not pin ~14 MB of base rows per cache.
+  static constexpr size_t BATCH_SCRATCH_KEEP = 1024;
+  std::vector<int> batch_touched_;
+  std::vector<HistRow> batch_base_;
+
+  // insert_batch computes spreads into a thread_local scratch before taking
+  // the lock, so concurrent batches do not share it and none of them
+  // allocates once it has grown; it is released past BATCH_TICKS_KEEP.
+  static constexpr size_t BATCH_TICKS_KEEP = 16384;
+  // Entries per insert_batch in with_file_mmap.
+  static constexpr size_t LOAD_BATCH = 4096;
+  template <typename Entry>
+  void insert_entries(std::span<const Entry> batch);
+
+  // metrics: num_metrics values per tick, row after row, or null.
+  void insert_spreads_locked(std::span<const SpreadTick> ticks,
+                             const double *metrics = nullptr,
+                             int num_metrics = 0);
+  void flush_batch();
+
+  // ---- Quantiles ----
+  // 1-based nearest rank of quantile q among n values.
+  static int64_t quantile_rank(double q, int64_t n) {
+    return std::max<int64_t>(1, static_cast<int64_t>(std::ceil(q * n)));
+  }
+  static void check_quantiles(std::span<const double> qs);
+
+  // Hand each bin of a cumulative histogram sweep to every requested rank it
+  // reaches; bin_count(bin) is only called until the highest rank is met.
+  template <typename BinCount>
+  void sweep_quantiles(int64_t total, std::span<const double> qs,
+                       BinCount &&bin_count, double *out) const;
+  // Approximate quantiles of [sa, ea] into out[0 .. qs.size()).
+  void query_quantiles(int64_t sa, int64_t ea, std::span<const double> qs,
+                       double *out) const;
+  void exact_quantiles(int64_t sa, int64_t ea, std::span<const double> qs,
+                       double *out) const;
+  // exact_quantiles_parallel copies ticks EXACT_SCAN_SLICE buckets per
+  // shared-lock hold; a pass that sees an eviction is redone, and the last
+  // of EXACT_SCAN_ATTEMPTS passes keeps the lock throughout.
+  static constexpr int64_t EXACT_SCAN_SLICE = 256;
+  static constexpr int EXACT_SCAN_ATTEMPTS = 4;
+  void exact_quantiles_parallel(int64_t sa, int64_t ea,
+                                std::span<const double> qs, double *out,
+                                unsigned num_threads) const;
+  // Partition base[lo, hi) so that base[k] holds its sorted-order value for
+  // every k in the sorted, distinct ranks [k_first, k_last) (all in [lo, hi)).
+  static void multi_select(double *base, size_t lo, size_t hi,
+                           const size_t *k_first, const size_t *k_last);
+
+  // ---- Exact-quantile index ----
+  // Level h holds runs of 2^h buckets aligned on absolute bucket numbers: run
+  // `id` covers [id * 2^h, (id + 1) * 2^h) and lives in ring slot
+  // id mod exact_ring(h), enough for every run that fits in the window. A run
+  // is built ("sealed") once it lies wholly inside the window and the window
+  // end has moved past it: from its buckets at EXACT_MIN_LEVEL, by merging
+  // its two halves above. Ticks that arrive later for a sealed run are
+  // inserted into it in place. Runs that fall out of the window are never
+  // looked at again and are overwritten when their slot comes round.
+  // Guarded by mutex_ (unique for the writer, shared for queries).
+  struct ExactRun {
+    int64_t id = INT64_MIN;
+    std::vector<double> sorted;
+  };
+  std::unique_ptr<std::vector<std::vector<ExactRun>>> exact_;
+
+  static constexpr int64_t exact_ring(int h) { return (NUM_BUCKETS >> h) + 2; }
+  const ExactRun *exact_find(int h, int64_t id) const {
+    int64_t ring = exact_ring(h);
+    const ExactRun &run = (*exact_)[h][((id % ring) + ring) % ring];
+    return run.id == id ? &run : nullptr;
+  }
+  ExactRun &exact_slot(int h, int64_t id) {
+    int64_t ring = exact_ring(h);
+    return (*exact_)[h][((id % ring) + ring) % ring];
+  }
+  // Build every run whose end lies in [old_end, window_end_abs_).
+  void exact_seal(int64_t old_end);
+  void exact_build(int h, int64_t id);
+  void exact_add_late(int64_t abs, double spread);
+  void exact_reset();
+  // Value of 1-based rank k in the union of sorted runs.
+  static double select_rank(std::span<const std::span<const double>> runs,
+                            int64_t k);
+  // exact_quantiles through the index; caller holds the shared lock.
+  void indexed_quantiles(int64_t sa, int64_t ea, std::span<const double> qs,
+                         double *out) const;
+
+  // ---- Sketch index ----
+  // Bucket sketches are indexed by local bucket and live exactly as long as
+  // the bucket (clear_bucket_at subtracts and clears them). The Fenwick tree
+  // over blocks has whole sketches as nodes: sketch counts subtract like
+  // histogram rows. Guarded by mutex_.
+  struct SketchIndex {
+    SketchMapping mapping;
+    ChunkedArray<SpreadSketch, BUCKET_POOL_CHUNK> buckets;
+    std::vector<SpreadSketch> fenwick; // 1-based over NUM_BLOCKS
+  };
+  std::unique_ptr<SketchIndex> sketch_;
+
+  void sketch_add_tick(int local, double spread);
+  void sketch_remove_bucket(int local);
+  // Blocks [0, pos) into `out` with `sign`.
+  void sketch_prefix(int pos, SpreadSketch &out, int sign) const;
+  void sketch_range_local(int l, int r, SpreadSketch &out, int sign) const;
+
+  // ---- Rollup tiers ----
+  // rollups_[0] takes the buckets evicted from the window, each tier the
+  // cells evicted from the one before. Empty when disabled. Guarded by
+  // mutex_.
+  using Rollup = RollupRing<NUM_HIST_BINS>;
+  std::vector<Rollup> rollups_;
+
+  // Push a window bucket about to be evicted into the tiers.
+  void rollup_bucket(int local);
+  void rollup_push(size_t tier, const typename Rollup::Cell &cell);
+
+  // ---- Rolling subscriptions ----
+  // count / hist sum buckets [first_abs, end_abs]; first_abs is
+  // end_abs - span + 1 unless remove_up_to cut the window shorter. mins /
+  // maxs are sliding-extremum deques: (bucket, min) of every bucket that no
+  // later bucket undercuts, oldest first (and the same for max), so the
+  // front is the window's extreme. A late tick cannot be placed in them in
+  // O(1); they stay exact for buckets after late_abs. Indexed by id,
+  // unsubscribed ids stay null. Guarded by mutex_.
+  struct Subscription {
+    int64_t span = 0; // buckets
+    std::vector<double> qs;
+    int64_t first_abs = INT64_MAX;
+    int64_t end_abs = INT64_MIN;
+    int64_t late_abs = INT64_MIN;
+    int64_t count = 0;
+    HistRow hist{};
+    std::deque<std::pair<int64_t, double>> mins;
+    std::deque<std::pair<int64_t, double>> maxs;
+
+    void reset();
+    // Fold bucket `abs`'s extremes into the deques; `abs` is the newest.
+    void push_extremes(int64_t abs, double lo, double hi);
+  };
+  std::vector<std::unique_ptr<Subscription>> subs_;
+
+  // Slide every subscription to end at `abs`. Called before the window
+  // evicts anything, so the buckets sliding out can still be read.
+  void subs_advance(int64_t abs);
+  void subs_add_tick(int64_t abs, double spread, int bin);
+  // remove_up_to: drop buckets before `new_start`.
+  void subs_cut(int64_t new_start);
+  void sub_remove_bucket(Subscription &sub, int64_t abs);
+
+  // ---- Book metrics ----
+  // metric_specs_[0, metric_count_) never change once published, so the
+  // insert paths read them before taking the lock. Each MetricColumn holds
+  // one metric's per-bucket count, sum, min and max as four separate arrays
+  // and a segment tree over buckets with seg_'s layout and epoch rule. The
+  // arrays are indexed by bucket_pool_ slot and allocated a pool chunk at a
+  // time as buckets take data, so only the tree is sized by NUM_BUCKETS. A
+  // slot's min and max mean something only while its count is non-zero.
+  // Every path that detaches a bucket empties its cells first, so cells
+  // never outlive their bucket. Columns are allocated by add_metric and
+  // never move afterwards, so optimistic readers can index them; readers
+  // only touch the trees. Guarded by mutex_.
+  struct MetricNode {
+    int64_t count = 0;
+    double sum = 0.0;
+    double min = POS_INF;
+    double max = NEG_INF;
+    uint32_t epoch = 0; // see epoch_; ignored on query results
+  };
+  struct MetricColumn {
+    ChunkedArray<int64_t, BUCKET_POOL_CHUNK> count; // by pool slot
+    ChunkedArray<double, BUCKET_POOL_CHUNK> sum;
+    ChunkedArray<double, BUCKET_POOL_CHUNK> min;
+    ChunkedArray<double, BUCKET_POOL_CHUNK> max;
+    std::vector<MetricNode> seg; // 2 * SEG_LEAVES
+  };
+  std::array<MetricSpec, MAX_METRICS> metric_specs_{};
+  std::atomic<int> metric_count_{0};
+  std::unique_ptr<std::vector<MetricColumn>> metrics_; // MAX_METRICS reserved
+
+  const MetricNode &metric_at(const MetricColumn &col, int node) const {
+    static constexpr MetricNode kEmpty{};
+    return col.seg[node].epoch == epoch_ ? col.seg[node] : kEmpty;
+  }
+  static void metric_combine(MetricNode &into, const MetricNode &other) {
+    into.count += other.count;
+    into.sum += other.sum;
+    into.min = std::min(into.min, other.min);
+    into.max = std::max(into.max, other.max);
+  }
+  // Scan `entry`'s levels once: its spread is returned and metric i's
+  // value written to out[i] for i < num_metrics.
+  double eval_metrics(const MarketDataEntryView &entry, LevelOrder order,
+                      int num_metrics, double *out) const;
+  // Empty the cells of pool slot `slot` in every column (trees untouched).
+  void metrics_clear_cells(int32_t slot);
+  // Rebuild leaf `local` of a column's tree from its cells, then its path.
+  void metric_seg_update(MetricColumn &col, int local);
+  void metric_seg_add(MetricColumn &col, int local, double value);
+  MetricNode query_metric_range(const MetricColumn &col, int64_t start_abs,
+                                int64_t end_abs) const;
+  MetricNode metric_seg_query(const MetricColumn &col, int l, int r) const;
+
+  // Empty unless built with MARKET_CACHE_INSTRUMENT.
+  [[no_unique_address]] CacheInstrument instrument_;
+
   // Thread safety — mutable so const query methods can lock.
   mutable std::shared_mutex mutex_;
-};
\ No newline at end of file
+
+  // ---- Seqlock for the optimistic read path ----
+  // Odd while a writer is inside its critical section. Writers always hold
+  // the unique lock too, so they stay serialised with each other and with
+  // shared-lock readers. On its own cache line so reader polling does not
+  // false-share with the writer's data.
+  alignas(64) std::atomic<uint64_t> seq_{0};
+  char seq_pad_[64 - sizeof(std::atomic<uint64_t>)];
+
+  // Unique lock plus the odd/even seq_ bump around the critical section.
+  class WriteLock {
+  public:
+    explicit WriteLock(BasicMarketDataCache &c) : cache_(c), lock_(c.mutex_) {
+      c.instrument_.locked();
+      start_ = c.seq_.load(std::memory_order_relaxed);
+      c.seq_.store(start_ + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+    ~WriteLock() {
+      cache_.seq_.store(start_ + 2, std::memory_order_release);
+    }
+
+  private:
+    BasicMarketDataCache &cache_;
+    std::unique_lock<std::shared_mutex> lock_;
+    uint64_t start_;
+  };
+
+  // Run `f` without locking and keep its result only if no writer ran
+  // meanwhile. `f` may observe a half-written state, so it must only do
+  // bounded work with in-range indices (true of the tree/Fenwick walks:
+  // every index comes from to_local or a fixed loop). After a few failed
+  // attempts fall back to the shared lock so a reader cannot starve.
+  static constexpr int OPTIMISTIC_READ_ATTEMPTS = 64;
+
+  template <typename F> auto read_optimistic(F &&f) const -> decltype(f()) {
+    for (int attempt = 0; attempt < OPTIMISTIC_READ_ATTEMPTS; ++attempt) {
+      uint64_t before = seq_.load(std::memory_order_acquire);
+      if (before & 1) {
+        instrument_.add(CacheCounter::OptimisticRetries);
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        continue;
+      }
+      auto result = f();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == before)
+        return result;
+      instrument_.add(CacheCounter::OptimisticRetries);
+    }
+    instrument_.add(CacheCounter::OptimisticFallbacks);
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    instrument_.locked();
+    return f();
+  }
+};
+
+// ---- Standard geometries ----------------------------------------------------
+
+// 100 ms x 36,000 buckets: one hour.
+using MarketDataCache = BasicMarketDataCache<100'000'000LL, 36'000, 100>;
+// 10 ms x 6,000 buckets: one minute, for HFT monitoring.
+using HftMarketDataCache = BasicMarketDataCache<10'000'000LL, 6'000, 100>;
+// 1 s x 86,400 buckets: one day, for daily risk.
+using DailyMarketDataCache =
+    BasicMarketDataCache<1'000'000'000LL, 86'400, 100>;
+
+extern template class BasicMarketDataCache<100'000'000LL, 36'000, 100>;
+extern template class BasicMarketDataCache<10'000'000LL, 6'000, 100>;
+extern template class BasicMarketDataCache<1'000'000'000LL, 86'400, 100>;
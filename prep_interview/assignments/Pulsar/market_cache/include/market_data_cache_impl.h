@@ -0,0 +1,2505 @@
+#pragma once
+
+// Member definitions of BasicMarketDataCache. Only needed to instantiate a
+// geometry other than the ones declared extern in market_data_cache.h.
+
+#include "market_data_cache.h"
+#include "market_data_json.h"
+#include "market_data_snapshot.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+// =============================================================================
+// Construction
+// =============================================================================
+
+template <int64_t B, int N, int H>
+BasicMarketDataCache<B, N, H>::BasicMarketDataCache(double hist_min,
+                                                    double hist_max,
+                                                    HistIndex hist_index,
+                                                    Storage storage)
+    : hist_min_(hist_min),
+      hist_bin_width_((hist_max - hist_min) / NUM_HIST_BINS),
+      hist_index_(storage == Storage::Compact ? HistIndex::BucketMajorFenwick
+                                              : hist_index),
+      storage_(storage),
+      seg_leaves_(storage == Storage::Compact ? SEG_BLOCK_LEAVES : SEG_LEAVES) {
+  if (hist_max <= hist_min || hist_bin_width_ <= 0)
+    throw std::invalid_argument("Invalid histogram range");
+}
+
+// Index storage is allocated by the first insert so idle caches stay small;
+// Buckets are taken from bucket_pool_ as they fill.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::ensure_storage() {
+  if (storage_ready_.load(std::memory_order_relaxed))
+    return;
+  bucket_slot_.assign(NUM_BUCKETS, -1);
+  bucket_pool_ = ChunkedArray<Bucket, BUCKET_POOL_CHUNK>(NUM_BUCKETS);
+  seg_.assign(2 * static_cast<size_t>(seg_leaves_), SegNode{});
+  fenwick_.assign(static_cast<size_t>(NUM_HIST_BINS) * (fw_positions() + 1),
+                  0);
+  fw_epoch_.assign(static_cast<size_t>(fw_positions()) + 1, epoch_);
+  storage_ready_.store(true, std::memory_order_release);
+}
+
+template <int64_t B, int N, int H>
+size_t BasicMarketDataCache<B, N, H>::memory_usage() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  instrument_.locked();
+  size_t bytes = bucket_slot_.capacity() * sizeof(int32_t) +
+                 bucket_pool_.memory_usage() +
+                 bucket_free_.capacity() * sizeof(int32_t) +
+                 bucket_stale_.capacity() * sizeof(int32_t) +
+                 seg_.capacity() * sizeof(SegNode) +
+                 fenwick_.capacity() * sizeof(int32_t) +
+                 fw_epoch_.capacity() * sizeof(uint32_t) +
+                 batch_touched_.capacity() * sizeof(int) +
+                 batch_base_.capacity() * sizeof(HistRow);
+  bytes += spread_slab_.memory_usage();
+  for (auto &tier : rollups_)
+    bytes += tier.memory_usage();
+  bytes += subs_.capacity() * sizeof(std::unique_ptr<Subscription>);
+  for (auto &sub : subs_) {
+    if (sub)
+      bytes += sizeof(Subscription) + sub->qs.capacity() * sizeof(double) +
+               (sub->mins.size() + sub->maxs.size()) *
+                   sizeof(std::pair<int64_t, double>);
+  }
+  if (sketch_) {
+    bytes += sketch_->buckets.memory_usage() +
+             sketch_->fenwick.capacity() * sizeof(SpreadSketch);
+    sketch_->buckets.for_each_allocated([&](size_t, const SpreadSketch &sk) {
+      bytes += sk.memory_usage();
+    });
+    for (auto &sk : sketch_->fenwick)
+      bytes += sk.memory_usage();
+  }
+  if (metrics_) {
+    bytes += metrics_->capacity() * sizeof(MetricColumn);
+    for (auto &col : *metrics_)
+      bytes += col.count.memory_usage() + col.sum.memory_usage() +
+               col.min.memory_usage() + col.max.memory_usage() +
+               col.seg.capacity() * sizeof(MetricNode);
+  }
+  if (exact_) {
+    for (auto &level : *exact_) {
+      bytes += level.capacity() * sizeof(ExactRun);
+      for (auto &run : level)
+        bytes += run.sorted.capacity() * sizeof(double);
+    }
+  }
+  return bytes;
+}
+
+// Move constructor: move all data members, construct a fresh mutex.
+template <int64_t B, int N, int H>
+BasicMarketDataCache<B, N, H>::BasicMarketDataCache(
+    BasicMarketDataCache &&other) noexcept
+    : hist_min_(other.hist_min_), hist_bin_width_(other.hist_bin_width_),
+      hist_index_(other.hist_index_), storage_(other.storage_),
+      level_order_(other.level_order_.load()),
+      bucket_slot_(std::move(other.bucket_slot_)),
+      bucket_pool_(std::move(other.bucket_pool_)),
+      bucket_free_(std::move(other.bucket_free_)),
+      bucket_stale_(std::move(other.bucket_stale_)),
+      bucket_pool_used_(other.bucket_pool_used_),
+      spread_slab_(std::move(other.spread_slab_)), seg_(std::move(other.seg_)),
+      seg_leaves_(other.seg_leaves_), fenwick_(std::move(other.fenwick_)),
+      fw_epoch_(std::move(other.fw_epoch_)), epoch_(other.epoch_),
+      total_count_(other.total_count_),
+      window_start_abs_(other.window_start_abs_),
+      window_end_abs_(other.window_end_abs_), evicted_(other.evicted_),
+      num_evicted_(other.num_evicted_),
+      storage_ready_(other.storage_ready_.load()),
+      exact_(std::move(other.exact_)), sketch_(std::move(other.sketch_)),
+      rollups_(std::move(other.rollups_)), subs_(std::move(other.subs_)),
+      metric_specs_(other.metric_specs_),
+      metric_count_(other.metric_count_.load()),
+      metrics_(std::move(other.metrics_)),
+      instrument_(std::move(other.instrument_))
+// mutex_ is default-constructed (fresh mutex)
+{
+  other.storage_ready_ = false;
+  other.bucket_pool_used_ = 0;
+  other.total_count_ = 0;
+  other.window_start_abs_ = INT64_MAX;
+  other.window_end_abs_ = INT64_MIN;
+  other.num_evicted_ = 0;
+  other.metric_count_ = 0;
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::operator=(
+    BasicMarketDataCache &&other) noexcept -> BasicMarketDataCache & {
+  if (this != &other) {
+    hist_min_ = other.hist_min_;
+    hist_bin_width_ = other.hist_bin_width_;
+    hist_index_ = other.hist_index_;
+    storage_ = other.storage_;
+    level_order_ = other.level_order_.load();
+    bucket_slot_ = std::move(other.bucket_slot_);
+    bucket_pool_ = std::move(other.bucket_pool_);
+    bucket_free_ = std::move(other.bucket_free_);
+    bucket_stale_ = std::move(other.bucket_stale_);
+    bucket_pool_used_ = other.bucket_pool_used_;
+    spread_slab_ = std::move(other.spread_slab_);
+    seg_ = std::move(other.seg_);
+    seg_leaves_ = other.seg_leaves_;
+    fenwick_ = std::move(other.fenwick_);
+    fw_epoch_ = std::move(other.fw_epoch_);
+    epoch_ = other.epoch_;
+    total_count_ = other.total_count_;
+    window_start_abs_ = other.window_start_abs_;
+    window_end_abs_ = other.window_end_abs_;
+    evicted_ = other.evicted_;
+    num_evicted_ = other.num_evicted_;
+    storage_ready_ = other.storage_ready_.load();
+    exact_ = std::move(other.exact_);
+    sketch_ = std::move(other.sketch_);
+    rollups_ = std::move(other.rollups_);
+    subs_ = std::move(other.subs_);
+    metric_specs_ = other.metric_specs_;
+    metric_count_ = other.metric_count_.load();
+    metrics_ = std::move(other.metrics_);
+    instrument_ = std::move(other.instrument_);
+    // mutex_ stays as-is (already constructed)
+
+    other.storage_ready_ = false;
+    other.bucket_pool_used_ = 0;
+    other.total_count_ = 0;
+    other.window_start_abs_ = INT64_MAX;
+    other.window_end_abs_ = INT64_MIN;
+    other.num_evicted_ = 0;
+    other.metric_count_ = 0;
+  }
+  return *this;
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::with_file(const std::string &file_path,
+                                              double hist_min, double hist_max)
+    -> BasicMarketDataCache {
+  std::ifstream ifs(file_path);
+  if (!ifs)
+    throw std::runtime_error("Cannot open file: " + file_path);
+  std::ostringstream oss;
+  oss << ifs.rdbuf();
+  std::string json = oss.str();
+
+  auto entries = parse_market_data_json(json);
+
+  BasicMarketDataCache cache(hist_min, hist_max);
+  for (auto &e : entries)
+    cache.insert(e);
+  return cache; // uses move constructor
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::with_file_mmap(const std::string &file_path,
+                                                   double hist_min,
+                                                   double hist_max)
+    -> BasicMarketDataCache {
+  MappedFile file(file_path);
+  MarketDataJsonReader reader(file.begin(), file.end());
+
+  // Entries are parsed into an arena and inserted LOAD_BATCH at a time.
+  BasicMarketDataCache cache(hist_min, hist_max);
+  RunArena<PriceLevel> arena;
+  std::vector<MarketDataEntryView> batch;
+  batch.reserve(LOAD_BATCH);
+  MarketDataEntryView entry{};
+  while (true) {
+    bool more = reader.next(entry, arena);
+    if (more)
+      batch.push_back(entry);
+    if (batch.size() == LOAD_BATCH || (!more && !batch.empty())) {
+      cache.insert_batch(batch);
+      batch.clear();
+      arena.reset();
+    }
+    if (!more)
+      return cache;
+  }
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::with_file_parallel(
+    const std::string &file_path, double hist_min, double hist_max,
+    unsigned num_threads) -> BasicMarketDataCache {
+  WorkerPool &pool = WorkerPool::shared();
+  if (num_threads == 0)
+    num_threads = pool.concurrency();
+
+  MappedFile file(file_path);
+  auto bounds = MarketDataJsonReader::split_entries(file.begin(), file.end(),
+                                                    num_threads);
+
+  // Workers only parse and compute spreads; insertion stays on this thread in
+  // chunk (= file) order so eviction decisions match the sequential path.
+  std::vector<std::vector<SpreadTick>> parts(bounds.size() - 1);
+  pool.run(static_cast<unsigned>(parts.size()), [&](unsigned c) {
+    MarketDataJsonReader reader(file.begin(), bounds[c], bounds[c + 1]);
+    RunArena<PriceLevel> arena;
+    MarketDataEntryView entry{};
+    while (reader.next(entry, arena)) {
+      double spread = entry.compute_spread();
+      if (!std::isnan(spread))
+        parts[c].push_back({entry.time, spread});
+      arena.reset();
+    }
+  });
+
+  BasicMarketDataCache cache(hist_min, hist_max);
+  for (auto &ticks : parts) {
+    WriteLock lock(cache);
+    cache.insert_spreads_locked(ticks);
+    std::vector<SpreadTick>().swap(ticks);
+  }
+  return cache;
+}
+
+// =============================================================================
+// Snapshots
+// =============================================================================
+
+// Stale index entries (see epoch_) are written as empty, so the file always
+// describes epoch 0.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::save_snapshot(
+    const std::string &path) const {
+  using Record = SnapshotBucket<NUM_HIST_BINS>;
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  instrument_.locked();
+  bool ready = storage_ready_.load(std::memory_order_relaxed);
+
+  std::vector<int> locals;
+  uint64_t num_spreads = 0;
+  for (int local = 0; ready && local < NUM_BUCKETS; ++local) {
+    if (const Bucket *b = find_bucket(local)) {
+      locals.push_back(local);
+      num_spreads += static_cast<uint64_t>(b->entry_count);
+    }
+  }
+
+  auto align = [](uint64_t off) {
+    return (off + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+  };
+  SnapshotHeader h{};
+  std::memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+  h.version = SNAPSHOT_VERSION;
+  h.byte_order = SNAPSHOT_BYTE_ORDER;
+  h.bucket_ns = BUCKET_NS;
+  h.num_buckets = NUM_BUCKETS;
+  h.num_hist_bins = NUM_HIST_BINS;
+  h.hist_index = static_cast<int32_t>(hist_index_);
+  h.storage = static_cast<int32_t>(storage_);
+  h.hist_min = hist_min_;
+  h.hist_bin_width = hist_bin_width_;
+  h.total_count = total_count_;
+  h.window_start_abs = window_start_abs_;
+  h.window_end_abs = window_end_abs_;
+  h.buckets_offset = align(sizeof(h));
+  h.num_buckets_saved = locals.size();
+  h.spreads_offset =
+      align(h.buckets_offset + h.num_buckets_saved * sizeof(Record));
+  h.num_spreads = num_spreads;
+  h.seg_offset = align(h.spreads_offset + num_spreads * sizeof(double));
+  h.num_seg_nodes = ready ? seg_.size() : 0;
+  h.fenwick_offset =
+      align(h.seg_offset + h.num_seg_nodes * sizeof(SnapshotSegNode));
+  h.num_fenwick_cells = ready ? fenwick_.size() : 0;
+  h.file_size = h.fenwick_offset + h.num_fenwick_cells * sizeof(int32_t);
+
+  std::string tmp = path + ".tmp";
+  std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+  if (!out)
+    throw std::runtime_error("Cannot open file: " + tmp);
+  uint64_t pos = 0;
+  auto put = [&](const void *data, size_t bytes) {
+    out.write(static_cast<const char *>(data),
+              static_cast<std::streamsize>(bytes));
+    pos += bytes;
+  };
+  auto pad_to = [&](uint64_t off) {
+    static constexpr char zeros[SNAPSHOT_ALIGN] = {};
+    put(zeros, off - pos);
+  };
+
+  put(&h, sizeof(h));
+  pad_to(h.buckets_offset);
+  uint64_t spreads_begin = 0;
+  for (int local : locals) {
+    const Bucket *b = find_bucket(local);
+    Record r{};
+    r.local = local;
+    r.abs_index = b->abs_index;
+    r.entry_count = b->entry_count;
+    r.min_spread = b->min_spread;
+    r.max_spread = b->max_spread;
+    r.spreads_begin = spreads_begin;
+    std::memcpy(r.hist, b->hist.data(), sizeof(r.hist));
+    put(&r, sizeof(r));
+    spreads_begin += static_cast<uint64_t>(b->entry_count);
+  }
+  pad_to(h.spreads_offset);
+  for (int local : locals) {
+    spread_slab_.for_each_run(
+        find_bucket(local)->spreads, [&](const double *run, size_t n) {
+          put(run, n * sizeof(double));
+        });
+  }
+
+  // The index sections go through small buffers so stale entries can be
+  // blanked without copying the whole tree.
+  pad_to(h.seg_offset);
+  SnapshotSegNode nodes[256];
+  for (size_t i = 0; i < h.num_seg_nodes; i += std::size(nodes)) {
+    size_t n = std::min(std::size(nodes), size_t(h.num_seg_nodes - i));
+    for (size_t k = 0; k < n; ++k) {
+      const SegNode &node = seg_at(static_cast<int>(i + k));
+      nodes[k] = {node.count, node.min_spread, node.max_spread};
+    }
+    put(nodes, n * sizeof(SnapshotSegNode));
+  }
+  pad_to(h.fenwick_offset);
+  bool bucket_major = hist_index_ == HistIndex::BucketMajorFenwick;
+  int32_t cells[4096];
+  for (size_t i = 0; i < h.num_fenwick_cells; i += std::size(cells)) {
+    size_t n = std::min(std::size(cells), size_t(h.num_fenwick_cells - i));
+    for (size_t k = 0; k < n; ++k) {
+      size_t idx = i + k;
+      int p = static_cast<int>(bucket_major ? idx / NUM_HIST_BINS
+                                            : idx % (NUM_BUCKETS + 1));
+      cells[k] = fw_live(p) ? fenwick_[idx] : 0;
+    }
+    put(cells, n * sizeof(int32_t));
+  }
+
+  out.close();
+  if (!out) {
+    std::remove(tmp.c_str());
+    throw std::runtime_error("Cannot write file: " + tmp);
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    throw std::runtime_error("Cannot rename " + tmp + " to " + path);
+  }
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::load_snapshot(const std::string &path)
+    -> BasicMarketDataCache {
+  using Record = SnapshotBucket<NUM_HIST_BINS>;
+  MappedFile file(path);
+  auto bad = [&](const char *why) {
+    return std::runtime_error("Bad snapshot " + path + ": " + why);
+  };
+
+  SnapshotHeader h;
+  if (file.size() < sizeof(h))
+    throw bad("truncated");
+  std::memcpy(&h, file.data(), sizeof(h));
+  if (std::memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 ||
+      h.byte_order != SNAPSHOT_BYTE_ORDER)
+    throw bad("not a snapshot");
+  if (h.version != SNAPSHOT_VERSION)
+    throw bad("unsupported version");
+  if (h.bucket_ns != BUCKET_NS || h.num_buckets != NUM_BUCKETS ||
+      h.num_hist_bins != NUM_HIST_BINS)
+    throw bad("geometry mismatch");
+  if (h.file_size != file.size())
+    throw bad("truncated");
+  if (h.hist_index < 0 || h.hist_index > 1 || h.storage < 0 ||
+      h.storage > 1 || !(h.hist_bin_width > 0))
+    throw bad("invalid configuration");
+  // Start of a section of `count` elements of `size` bytes.
+  auto section = [&](uint64_t offset, uint64_t count, size_t size) {
+    if (offset % SNAPSHOT_ALIGN != 0 || offset > file.size() ||
+        count > (file.size() - offset) / size)
+      throw bad("section out of range");
+    return file.data() + offset;
+  };
+
+  BasicMarketDataCache cache(
+      h.hist_min, h.hist_min + NUM_HIST_BINS * h.hist_bin_width,
+      static_cast<HistIndex>(h.hist_index), static_cast<Storage>(h.storage));
+  cache.hist_bin_width_ = h.hist_bin_width;
+  if (h.num_seg_nodes == 0 && h.num_fenwick_cells == 0 &&
+      h.num_buckets_saved == 0)
+    return cache; // saved before its first insert
+
+  cache.ensure_storage();
+  if (h.num_seg_nodes != cache.seg_.size() ||
+      h.num_fenwick_cells != cache.fenwick_.size() ||
+      h.num_buckets_saved > static_cast<uint64_t>(NUM_BUCKETS))
+    throw bad("index size mismatch");
+
+  const char *seg = section(h.seg_offset, h.num_seg_nodes,
+                            sizeof(SnapshotSegNode));
+  for (size_t i = 0; i < h.num_seg_nodes; ++i) {
+    SnapshotSegNode node;
+    std::memcpy(&node, seg + i * sizeof(node), sizeof(node));
+    cache.seg_[i] = {node.count, node.min_spread, node.max_spread};
+  }
+  std::memcpy(cache.fenwick_.data(),
+              section(h.fenwick_offset, h.num_fenwick_cells, sizeof(int32_t)),
+              h.num_fenwick_cells * sizeof(int32_t));
+
+  const char *records =
+      section(h.buckets_offset, h.num_buckets_saved, sizeof(Record));
+  const auto *spreads = reinterpret_cast<const double *>(
+      section(h.spreads_offset, h.num_spreads, sizeof(double)));
+  std::vector<int> evicted;
+  for (size_t i = 0; i < h.num_buckets_saved; ++i) {
+    Record r;
+    std::memcpy(&r, records + i * sizeof(r), sizeof(r));
+    if (r.local < 0 || r.local >= NUM_BUCKETS ||
+        r.local != to_local(r.abs_index) ||
+        r.abs_index < h.window_start_abs - NUM_BUCKETS ||
+        r.abs_index > h.window_end_abs ||
+        cache.bucket_slot_[r.local] >= 0 || r.entry_count < 0 ||
+        r.spreads_begin > h.num_spreads ||
+        static_cast<uint64_t>(r.entry_count) > h.num_spreads - r.spreads_begin)
+      throw bad("corrupt bucket");
+    Bucket &b = cache.bucket_pool_.at(i);
+    b.abs_index = r.abs_index;
+    b.entry_count = r.entry_count;
+    b.min_spread = r.min_spread;
+    b.max_spread = r.max_spread;
+    cache.spread_slab_.assign(b.spreads, spreads + r.spreads_begin,
+                              static_cast<size_t>(r.entry_count));
+    std::memcpy(b.hist.data(), r.hist, sizeof(r.hist));
+    cache.bucket_slot_[r.local] = static_cast<int32_t>(i);
+    if (r.abs_index < h.window_start_abs)
+      evicted.push_back(r.local);
+  }
+  cache.bucket_pool_used_ = static_cast<int32_t>(h.num_buckets_saved);
+  cache.total_count_ = h.total_count;
+  cache.window_start_abs_ = h.window_start_abs;
+  cache.window_end_abs_ = h.window_end_abs;
+  // Evicted buckets not yet swept when the snapshot was taken are still in
+  // the saved trees; take them out now.
+  for (int local : evicted)
+    cache.clear_bucket_at(local);
+  return cache;
+}
+
+// =============================================================================
+// Helpers
+// =============================================================================
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::clear_bucket_at(int local) {
+  Bucket *b = find_bucket(local);
+  if (!b)
+    return;
+
+  // Evicted buckets left total_count_ when they were cut.
+  if (b->abs_index >= window_start_abs_)
+    total_count_ -= b->entry_count;
+
+  fw_add_hist(local, b->hist, -1);
+  if (sketch_)
+    sketch_remove_bucket(local);
+
+  spread_slab_.clear(b->spreads);
+  b->clear();
+  if (metrics_)
+    metrics_clear_cells(bucket_slot_[local]);
+  bucket_free_.push_back(bucket_slot_[local]);
+  bucket_slot_[local] = -1;
+  seg_update(seg_pos(local));
+  if (metrics_)
+    for (auto &col : *metrics_)
+      metric_seg_update(col, local);
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::bucket_at(int local, int64_t abs)
+    -> Bucket & {
+  int32_t slot = bucket_slot_[local];
+  if (slot < 0) {
+    if (bucket_free_.empty() && bucket_pool_used_ == NUM_BUCKETS)
+      sweep_stale(1); // the pool is full only if something is stale
+    if (!bucket_free_.empty()) {
+      slot = bucket_free_.back();
+      bucket_free_.pop_back();
+    } else {
+      slot = bucket_pool_used_++;
+    }
+    bucket_pool_.at(slot).abs_index = abs;
+    bucket_slot_[local] = slot;
+  }
+  return bucket_pool_.at(slot);
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::sweep_stale(size_t budget) {
+  for (; budget > 0 && !bucket_stale_.empty(); --budget) {
+    int32_t slot = bucket_stale_.back();
+    bucket_stale_.pop_back();
+    Bucket &b = bucket_pool_.at(slot);
+    spread_slab_.clear(b.spreads);
+    b.clear();
+    bucket_free_.push_back(slot);
+  }
+  // Evicted buckets, oldest first; empty positions only cost a probe.
+  for (int probes = 0;
+       budget > 0 && num_evicted_ > 0 && probes < SWEEP_PROBES; ++probes) {
+    EvictedRange &e = evicted_[0];
+    int local = to_local(e.first);
+    if (bucket_holds(local, e.first)) {
+      clear_bucket_at(local);
+      --budget;
+    }
+    if (e.first++ == e.last)
+      drop_evicted_range(0);
+  }
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::sweep_evicted(int64_t first,
+                                                  int64_t last) {
+  for (int64_t a = first; a <= last; ++a)
+    if (bucket_holds(to_local(a), a))
+      clear_bucket_at(to_local(a));
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::release_evicted(int64_t abs) {
+  for (int i = 0; i < num_evicted_; ++i) {
+    EvictedRange e = evicted_[i];
+    if (abs < e.first || abs > e.last)
+      continue;
+    sweep_evicted(abs, abs);
+    drop_evicted_range(i);
+    add_evicted_range(e.first, abs - 1);
+    add_evicted_range(abs + 1, e.last);
+    return;
+  }
+}
+
+template <int64_t B, int N, int H>
+bool BasicMarketDataCache<B, N, H>::add_evicted_range(int64_t first,
+                                                      int64_t last) {
+  if (first > last)
+    return false;
+  int at = 0;
+  while (at < num_evicted_ && evicted_[at].first < first)
+    ++at;
+  if (at > 0 && evicted_[at - 1].last + 1 == first) {
+    evicted_[at - 1].last = last;
+    return true;
+  }
+  if (num_evicted_ == MAX_EVICTED_RANGES) {
+    int shortest = 0;
+    for (int i = 1; i < num_evicted_; ++i)
+      if (evicted_[i].last - evicted_[i].first <
+          evicted_[shortest].last - evicted_[shortest].first)
+        shortest = i;
+    const EvictedRange &s = evicted_[shortest];
+    if (last - first <= s.last - s.first) {
+      sweep_evicted(first, last);
+      return false;
+    }
+    sweep_evicted(s.first, s.last);
+    drop_evicted_range(shortest);
+    if (shortest < at)
+      --at;
+  }
+  for (int i = num_evicted_; i > at; --i)
+    evicted_[i] = evicted_[i - 1];
+  evicted_[at] = {first, last};
+  ++num_evicted_;
+  return true;
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::drop_evicted_range(int i) {
+  for (; i + 1 < num_evicted_; ++i)
+    evicted_[i] = evicted_[i + 1];
+  --num_evicted_;
+}
+
+// =============================================================================
+// Eviction
+// =============================================================================
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::evict_before(int64_t new_start,
+                                                 bool roll_up) {
+  int64_t last = std::min(new_start - 1, window_end_abs_);
+  if (last < window_start_abs_)
+    return;
+  // Tiers take buckets oldest first.
+  if (roll_up && !rollups_.empty())
+    for (int64_t a = window_start_abs_; a <= last; ++a)
+      if (bucket_holds(to_local(a), a))
+        rollup_bucket(to_local(a));
+  if (last == window_end_abs_) {
+    evict_all();
+    return;
+  }
+
+  // An evicted bucket's position is NUM_BUCKETS ahead of it, so one the new
+  // start passes would turn up inside the window: those go first.
+  int64_t passed = new_start - NUM_BUCKETS;
+  while (num_evicted_ > 0 && evicted_[0].first < passed) {
+    EvictedRange &e = evicted_[0];
+    sweep_evicted(e.first, std::min(e.last, passed - 1));
+    if (e.last < passed)
+      drop_evicted_range(0);
+    else
+      e.first = passed;
+  }
+
+  // Every bucket attached at a cut position is live, so the slots count
+  // them without touching the pool.
+  int64_t evicted = 0;
+  for (int64_t a = window_start_abs_; a <= last; ++a)
+    evicted += bucket_slot_[to_local(a)] >= 0;
+  instrument_.add(CacheCounter::BucketsEvicted, evicted);
+  if (evicted <= EAGER_EVICT) {
+    sweep_evicted(window_start_abs_, last);
+    return;
+  }
+  // A cut swept on the spot already left total_count_ bucket by bucket.
+  int64_t ticks = query_seg_range(window_start_abs_, last).count;
+  if (add_evicted_range(window_start_abs_, last))
+    total_count_ -= ticks;
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::evict_all() {
+  int64_t evicted = 0;
+  for (int local = 0; local < NUM_BUCKETS; ++local) {
+    int32_t &slot = bucket_slot_[local];
+    if (slot >= 0) {
+      if (metrics_)
+        metrics_clear_cells(slot);
+      bucket_stale_.push_back(slot);
+      slot = -1;
+      ++evicted;
+    }
+  }
+  instrument_.add(CacheCounter::BucketsEvicted, evicted);
+  total_count_ = 0;
+  num_evicted_ = 0;
+  spread_slab_.reset(compact());
+  if (sketch_) {
+    sketch_->buckets.for_each_allocated(
+        [](size_t, SpreadSketch &sk) { sk.clear(); });
+    for (auto &sk : sketch_->fenwick)
+      sk.clear();
+  }
+  bump_epoch();
+}
+
+// On wrap-around, nodes stamped 2^32 epochs ago would read as live again, so
+// the indexes are zeroed for real.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::bump_epoch() {
+  if (++epoch_ != 0)
+    return;
+  std::fill(seg_.begin(), seg_.end(), SegNode{});
+  std::fill(fenwick_.begin(), fenwick_.end(), 0);
+  std::fill(fw_epoch_.begin(), fw_epoch_.end(), 0);
+  if (metrics_)
+    for (auto &col : *metrics_)
+      std::fill(col.seg.begin(), col.seg.end(), MetricNode{});
+}
+
+// =============================================================================
+// Segment tree
+// =============================================================================
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::seg_set_leaf(int pos) {
+  auto &leaf = seg_[seg_leaves_ + pos];
+  leaf = SegNode{};
+  if (!compact()) {
+    if (const Bucket *b = find_bucket(pos))
+      leaf = {b->entry_count, b->min_spread, b->max_spread};
+  } else {
+    // Compact: the leaf aggregates the block's buckets.
+    int end = std::min((pos + 1) * HIST_BLOCK, NUM_BUCKETS);
+    for (int i = pos * HIST_BLOCK; i < end; ++i)
+      if (const Bucket *b = find_bucket(i))
+        seg_combine(leaf, {b->entry_count, b->min_spread, b->max_spread});
+  }
+  leaf.epoch = epoch_;
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::seg_pull(int node) {
+  SegNode n = seg_at(2 * node);
+  seg_combine(n, seg_at(2 * node + 1));
+  n.epoch = epoch_;
+  seg_[node] = n;
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::seg_update(int pos) {
+  seg_set_leaf(pos);
+  for (int node = (seg_leaves_ + pos) >> 1; node > 0; node >>= 1)
+    seg_pull(node);
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::seg_add_tick(int pos, double spread) {
+  SegNode &leaf = seg_[seg_leaves_ + pos];
+  if (leaf.epoch != epoch_) {
+    leaf = SegNode{};
+    leaf.epoch = epoch_;
+  }
+  seg_combine(leaf, {1, spread, spread});
+  for (int node = (seg_leaves_ + pos) >> 1; node > 0; node >>= 1)
+    seg_pull(node);
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::seg_update_many(int *first, int *last) {
+  if (first == last)
+    return;
+  for (int *p = first; p != last; ++p) {
+    seg_set_leaf(*p);
+    *p += seg_leaves_;
+  }
+  // Walk up one level at a time; sorted input stays sorted after >> 1, so
+  // deduplicating is a single pass.
+  while (*first > 1) {
+    int *out = first;
+    for (int *p = first; p != last; ++p) {
+      int parent = *p >> 1;
+      if (out == first || out[-1] != parent)
+        *out++ = parent;
+    }
+    last = out;
+    for (int *p = first; p != last; ++p)
+      seg_pull(*p);
+  }
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::seg_query(int l, int r) const -> SegNode {
+  SegNode res;
+  for (l += seg_leaves_, r += seg_leaves_ + 1; l < r; l >>= 1, r >>= 1) {
+    if (l & 1)
+      seg_combine(res, seg_at(l++));
+    if (r & 1)
+      seg_combine(res, seg_at(--r));
+  }
+  return res;
+}
+
+// =============================================================================
+// Fenwick trees
+// =============================================================================
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::fw_touch(int p) {
+  if (fw_live(p))
+    return;
+  fw_epoch_[p] = epoch_;
+  for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+    fenwick_[fw_idx(bin, p)] = 0;
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::fw_update(int bin, int local_pos,
+                                              int delta) {
+  instrument_.add(CacheCounter::FenwickUpdates);
+  int n = fw_positions();
+  for (int p = fw_pos(local_pos) + 1; p <= n; p += p & (-p)) {
+    fw_touch(p);
+    fenwick_[fw_idx(bin, p)] += delta;
+  }
+}
+
+// Walks the two prefix paths down together and stops where they meet: the
+// shared tail cancels, so a short range reads only the nodes near its ends.
+template <int64_t B, int N, int H>
+int BasicMarketDataCache<B, N, H>::fw_range(int bin, int l, int r) const {
+  if (l > r)
+    return 0;
+  int sum = 0;
+  for (int i = r + 1, j = l; i != j;) {
+    for (; i > j; i -= i & (-i))
+      if (fw_live(i))
+        sum += fenwick_[fw_idx(bin, i)];
+    for (; j > i; j -= j & (-j))
+      if (fw_live(j))
+        sum -= fenwick_[fw_idx(bin, j)];
+  }
+  return sum;
+}
+
+// The row loops work on local copies so the compiler can prove they do not
+// alias fenwick_ and vectorize them.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::fw_row_update(int local_pos,
+                                                  const int32_t *delta,
+                                                  int sign) {
+  HistRow d;
+  for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+    d[bin] = sign * delta[bin];
+  int n = fw_positions();
+  for (int p = fw_pos(local_pos) + 1; p <= n; p += p & (-p)) {
+    fw_touch(p);
+    int32_t *row = &fenwick_[fw_idx(0, p)];
+    for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+      row[bin] += d[bin];
+  }
+}
+
+// As fw_range, for whole rows.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::fw_row_range(int lo, int hi, int32_t *out,
+                                                 int sign) const {
+  HistRow acc{};
+  for (int i = hi + 1, j = lo; i != j;) {
+    for (; i > j; i -= i & (-i)) {
+      if (!fw_live(i))
+        continue;
+      const int32_t *row = &fenwick_[fw_idx(0, i)];
+      for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+        acc[bin] += row[bin];
+    }
+    for (; j > i; j -= j & (-j)) {
+      if (!fw_live(j))
+        continue;
+      const int32_t *row = &fenwick_[fw_idx(0, j)];
+      for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+        acc[bin] -= row[bin];
+    }
+  }
+  for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+    out[bin] += sign * acc[bin];
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::fw_add_hist(int local_pos,
+                                                const HistRow &hist, int sign) {
+  instrument_.add(CacheCounter::FenwickUpdates);
+  if (hist_index_ == HistIndex::BucketMajorFenwick) {
+    fw_row_update(local_pos, hist.data(), sign);
+    return;
+  }
+  // Positions are stamped once here rather than once per bin.
+  int n = fw_positions(), first = fw_pos(local_pos) + 1;
+  for (int p = first; p <= n; p += p & (-p))
+    fw_touch(p);
+  for (int bin = 0; bin < NUM_HIST_BINS; ++bin) {
+    if (hist[bin] == 0)
+      continue;
+    int delta = sign * hist[bin];
+    for (int p = first; p <= n; p += p & (-p))
+      fenwick_[fw_idx(bin, p)] += delta;
+  }
+}
+
+// =============================================================================
+// Wraparound-aware range helpers
+// =============================================================================
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::query_seg_range(int64_t start_abs,
+                                                    int64_t end_abs) const
+    -> SegNode {
+  SegNode res;
+  for_each_live_range(start_abs, end_abs, [&](int l, int r) {
+    seg_combine(res, seg_range_local(l, r));
+  });
+  return res;
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::seg_range_local(int l, int r) const
+    -> SegNode {
+  if (!compact())
+    return seg_query(l, r);
+  SegNode res;
+  split_blocks(
+      l, r,
+      [&](int lo, int hi) {
+        for (int i = lo; i <= hi; ++i)
+          if (const Bucket *b = find_bucket(i))
+            seg_combine(res, {b->entry_count, b->min_spread, b->max_spread});
+      },
+      [&](int lo, int hi) { seg_combine(res, seg_query(lo, hi)); });
+  return res;
+}
+
+template <int64_t B, int N, int H>
+int BasicMarketDataCache<B, N, H>::query_fw_range(int bin, int64_t start_abs,
+                                                  int64_t end_abs) const {
+  int sum = 0;
+  for_each_live_range(start_abs, end_abs,
+                      [&](int l, int r) { sum += fw_range(bin, l, r); });
+  return sum;
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::query_hist_range(int64_t start_abs,
+                                                     int64_t end_abs,
+                                                     HistRow &out) const {
+  for_each_live_range(start_abs, end_abs, [&](int l, int r) {
+    hist_range_local(l, r, out.data(), +1);
+  });
+}
+
+// Compact: whole blocks come from the block Fenwick. An edge block the range
+// only partly covers is summed from its buckets, or, when the range covers
+// most of it, taken whole minus the buckets outside the range, so each edge
+// costs at most HIST_BLOCK / 2 bucket rows.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::hist_range_local(int l, int r, int32_t *out,
+                                                     int sign) const {
+  if (!compact()) {
+    fw_row_range(l, r, out, sign);
+    return;
+  }
+  // Bucket rows go through a local accumulator so the adds vectorize.
+  HistRow acc{};
+  auto add_buckets = [&](int lo, int hi, int s) {
+    for (int i = lo; i <= hi; ++i) {
+      const Bucket *b = find_bucket(i);
+      if (!b)
+        continue;
+      const HistRow row = b->hist;
+      for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+        acc[bin] += s * row[bin];
+    }
+  };
+  auto flush = [&] {
+    for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+      out[bin] += acc[bin];
+  };
+  auto block_end = [](int blk) {
+    return std::min((blk + 1) * HIST_BLOCK, NUM_BUCKETS) - 1;
+  };
+
+  int bl = l / HIST_BLOCK, br = r / HIST_BLOCK;
+  int bl_start = bl * HIST_BLOCK, br_start = br * HIST_BLOCK;
+  int br_end = block_end(br);
+  if (bl == br) {
+    if ((l - bl_start) + (br_end - r) < r - l + 1) {
+      fw_row_range(bl, bl, out, sign);
+      add_buckets(bl_start, l - 1, -sign);
+      add_buckets(r + 1, br_end, -sign);
+    } else {
+      add_buckets(l, r, sign);
+    }
+    flush();
+    return;
+  }
+
+  int lo = bl, hi = br;
+  if (l - bl_start < block_end(bl) - l + 1) {
+    add_buckets(bl_start, l - 1, -sign);
+  } else {
+    add_buckets(l, block_end(bl), sign);
+    ++lo;
+  }
+  if (br_end - r < r - br_start + 1) {
+    add_buckets(r + 1, br_end, -sign);
+  } else {
+    add_buckets(br_start, r, sign);
+    --hi;
+  }
+  if (lo <= hi)
+    fw_row_range(lo, hi, out, sign);
+  flush();
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::collect_spreads(
+    int64_t start_abs, int64_t end_abs, std::vector<double> &out) const {
+  if (!has_data())
+    return;
+
+  start_abs = std::max(start_abs, window_start_abs_);
+  end_abs = std::min(end_abs, window_end_abs_);
+  if (start_abs > end_abs)
+    return;
+
+  for (int64_t ab = start_abs; ab <= end_abs; ++ab) {
+    const Bucket *bkt = find_bucket(to_local(ab));
+    if (bkt && bkt->abs_index == ab && bkt->entry_count > 0) {
+      spread_slab_.for_each_run(bkt->spreads, [&](const double *run,
+                                                  size_t n) {
+        out.insert(out.end(), run, run + n);
+      });
+    }
+  }
+}
+
+// =============================================================================
+// insert
+// =============================================================================
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::insert(const MarketDataEntry &data) {
+  insert(data.view());
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::insert(const MarketDataEntryView &data) {
+  CacheInstrument::Scope op(instrument_, CacheOp::Insert);
+  if (int nm = metric_count_.load(std::memory_order_acquire)) {
+    double values[MAX_METRICS];
+    double spread = eval_metrics(data, level_order(), nm, values);
+    if (!std::isnan(spread))
+      insert_spread(data.time, spread, values, nm);
+    return;
+  }
+  double spread = data.compute_spread(level_order());
+  if (std::isnan(spread))
+    return;
+  insert_spread(data.time, spread);
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::insert_spread(int64_t time, double spread,
+                                                  const double *metrics,
+                                                  int num_metrics) {
+  int64_t abs = to_abs_bucket(time);
+
+  WriteLock lock(*this);
+  ensure_storage();
+
+  sweep_stale(STALE_SWEEP);
+  if (!advance_window(abs))
+    return;
+
+  int bin = spread_to_bin(spread);
+  int local = add_to_bucket(abs, spread, bin, metrics, num_metrics);
+
+  seg_add_tick(seg_pos(local), spread);
+  fw_update(bin, local, 1);
+  for (int m = 0; m < num_metrics; ++m)
+    if (!std::isnan(metrics[m]))
+      metric_seg_add((*metrics_)[m], local, metrics[m]);
+}
+
+template <int64_t B, int N, int H>
+bool BasicMarketDataCache<B, N, H>::advance_window(int64_t abs) {
+  if (abs > window_end_abs_ && !subs_.empty())
+    subs_advance(abs);
+  if (window_start_abs_ > window_end_abs_) {
+    window_start_abs_ = abs;
+    window_end_abs_ = abs;
+  } else if (abs > window_end_abs_) {
+    int64_t new_start = abs - NUM_BUCKETS + 1;
+    if (new_start > window_start_abs_) {
+      evict_before(new_start, true);
+      window_start_abs_ = new_start;
+    }
+    int64_t old_end = window_end_abs_;
+    window_end_abs_ = abs;
+    if (exact_)
+      exact_seal(old_end);
+  } else if (abs < window_start_abs_) {
+    return false;
+  }
+  release_evicted(abs - NUM_BUCKETS);
+  return true;
+}
+
+template <int64_t B, int N, int H>
+int BasicMarketDataCache<B, N, H>::add_to_bucket(int64_t abs, double spread,
+                                                 int bin, const double *metrics,
+                                                 int num_metrics) {
+  int local = to_local(abs);
+  if (!bucket_holds(local, abs))
+    clear_bucket_at(local);
+  Bucket &bkt = bucket_at(local, abs);
+
+  bkt.entry_count++;
+  if (spread < bkt.min_spread)
+    bkt.min_spread = spread;
+  if (spread > bkt.max_spread)
+    bkt.max_spread = spread;
+  spread_slab_.push_back(bkt.spreads, spread);
+  bkt.hist[bin]++;
+  if (sketch_)
+    sketch_add_tick(local, spread);
+  if (!subs_.empty())
+    subs_add_tick(abs, spread, bin);
+  if (exact_ && abs < window_end_abs_)
+    exact_add_late(abs, spread);
+  for (int m = 0; m < num_metrics; ++m) {
+    double v = metrics[m];
+    if (std::isnan(v))
+      continue;
+    MetricColumn &col = (*metrics_)[m];
+    size_t slot = static_cast<size_t>(bucket_slot_[local]);
+    double &lo = col.min.at(slot), &hi = col.max.at(slot);
+    col.sum.at(slot) += v;
+    if (col.count.at(slot)++ == 0) {
+      lo = hi = v;
+    } else {
+      lo = std::min(lo, v);
+      hi = std::max(hi, v);
+    }
+  }
+
+  total_count_++;
+  return local;
+}
+
+// =============================================================================
+// insert_batch
+// =============================================================================
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::insert_batch(
+    std::span<const MarketDataEntry> batch) {
+  insert_entries(batch);
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::insert_batch(
+    std::span<const MarketDataEntryView> batch) {
+  insert_entries(batch);
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::insert_spreads(
+    std::span<const SpreadTick> ticks) {
+  CacheInstrument::Scope op(instrument_, CacheOp::InsertBatch);
+  WriteLock lock(*this);
+  insert_spreads_locked(ticks);
+}
+
+template <int64_t B, int N, int H>
+template <typename Entry>
+void BasicMarketDataCache<B, N, H>::insert_entries(
+    std::span<const Entry> batch) {
+  CacheInstrument::Scope op(instrument_, CacheOp::InsertBatch);
+  thread_local std::vector<SpreadTick> ticks;
+  thread_local std::vector<double> values; // nm per tick
+  ticks.clear();
+  values.clear();
+  LevelOrder order = level_order();
+  int nm = metric_count_.load(std::memory_order_acquire);
+  for (auto &e : batch) {
+    if (nm == 0) {
+      double spread = e.compute_spread(order);
+      if (!std::isnan(spread))
+        ticks.push_back({e.time, spread});
+      continue;
+    }
+    size_t at = values.size();
+    values.resize(at + nm);
+    MarketDataEntryView view{e.time, e.bids, e.asks};
+    double spread = eval_metrics(view, order, nm, values.data() + at);
+    if (std::isnan(spread))
+      values.resize(at);
+    else
+      ticks.push_back({e.time, spread});
+  }
+
+  {
+    WriteLock lock(*this);
+    insert_spreads_locked(ticks, nm ? values.data() : nullptr, nm);
+  }
+  if (ticks.capacity() > BATCH_TICKS_KEEP) {
+    ticks.clear();
+    ticks.shrink_to_fit();
+    values.clear();
+    values.shrink_to_fit();
+  }
+}
+
+// Bucket data is updated per tick; the Fenwick trees and segment tree are
+// brought up to date once per touched bucket by flush_batch(). Anything that
+// would clear a touched bucket (window eviction, slot reuse) flushes first so
+// clear_bucket_at always sees consistent trees.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::insert_spreads_locked(
+    std::span<const SpreadTick> ticks, const double *metrics,
+    int num_metrics) {
+  if (ticks.empty())
+    return;
+  ensure_storage();
+  for (size_t i = 0; i < ticks.size(); ++i) {
+    const SpreadTick &t = ticks[i];
+    int64_t abs = to_abs_bucket(t.time);
+
+    if (!batch_touched_.empty()) {
+      bool evicts = window_start_abs_ <= window_end_abs_ &&
+                    abs > window_end_abs_ &&
+                    abs - NUM_BUCKETS + 1 > window_start_abs_;
+      const Bucket *slot = find_bucket(to_local(abs));
+      if (evicts ||
+          (slot && slot->batch_slot >= 0 && slot->abs_index != abs))
+        flush_batch();
+    }
+
+    if (!advance_window(abs))
+      continue;
+
+    int local = to_local(abs);
+    if (!bucket_holds(local, abs))
+      clear_bucket_at(local);
+    Bucket &bkt = bucket_at(local, abs);
+    if (bkt.batch_slot < 0) {
+      bkt.batch_slot = static_cast<int32_t>(batch_touched_.size());
+      batch_touched_.push_back(local);
+      batch_base_.push_back(bkt.hist);
+    }
+    add_to_bucket(abs, t.spread, spread_to_bin(t.spread),
+                  metrics ? metrics + i * num_metrics : nullptr, num_metrics);
+  }
+  flush_batch();
+  sweep_stale(STALE_SWEEP * ticks.size());
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::flush_batch() {
+  if (batch_touched_.empty())
+    return;
+
+  // One Fenwick delta per touched (bin, bucket); batch_base_ is turned into
+  // the delta row in place.
+  for (size_t i = 0; i < batch_touched_.size(); ++i) {
+    Bucket &b = *find_bucket(batch_touched_[i]);
+    auto &delta = batch_base_[i];
+    for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+      delta[bin] = b.hist[bin] - delta[bin];
+    fw_add_hist(batch_touched_[i], delta, +1);
+    b.batch_slot = -1;
+  }
+
+  if (metrics_)
+    for (auto &col : *metrics_)
+      for (int local : batch_touched_)
+        metric_seg_update(col, local);
+
+  // One segment-tree pass over all touched leaves (blocks when compact).
+  for (int &pos : batch_touched_)
+    pos = seg_pos(pos);
+  std::sort(batch_touched_.begin(), batch_touched_.end());
+  auto last = std::unique(batch_touched_.begin(), batch_touched_.end());
+  seg_update_many(batch_touched_.data(),
+                  batch_touched_.data() + (last - batch_touched_.begin()));
+
+  batch_touched_.clear();
+  batch_base_.clear();
+  if (batch_base_.capacity() > BATCH_SCRATCH_KEEP) {
+    batch_touched_.shrink_to_fit();
+    batch_base_.shrink_to_fit();
+  }
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::set_level_order(LevelOrder order) {
+  level_order_.store(order, std::memory_order_relaxed);
+}
+
+template <int64_t B, int N, int H>
+LevelOrder BasicMarketDataCache<B, N, H>::level_order() const {
+  return level_order_.load(std::memory_order_relaxed);
+}
+
+// =============================================================================
+// remove_up_to
+// =============================================================================
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::remove_up_to(int64_t time) {
+  CacheInstrument::Scope op(instrument_, CacheOp::RemoveUpTo);
+  int64_t abs_limit = to_abs_bucket(time);
+
+  WriteLock lock(*this);
+  for (auto &tier : rollups_)
+    tier.drop_up_to(time);
+
+  if (window_start_abs_ > window_end_abs_)
+    return;
+
+  int64_t new_start = abs_limit + 1;
+  if (new_start <= window_start_abs_)
+    return;
+
+  if (!subs_.empty())
+    subs_cut(new_start);
+  evict_before(new_start, false);
+  if (new_start > window_end_abs_) {
+    window_start_abs_ = INT64_MAX;
+    window_end_abs_ = INT64_MIN;
+    if (exact_)
+      exact_reset();
+    return;
+  }
+  window_start_abs_ = new_start;
+}
+
+// =============================================================================
+// count / count_range
+// =============================================================================
+
+template <int64_t B, int N, int H>
+int64_t BasicMarketDataCache<B, N, H>::count() const {
+  return read_optimistic([&] { return total_count_; });
+}
+
+template <int64_t B, int N, int H>
+int64_t BasicMarketDataCache<B, N, H>::count_range(int64_t start_time,
+                                                   int64_t end_time) const {
+  CacheInstrument::Scope op(instrument_, CacheOp::CountRange);
+  int64_t sa = to_abs_bucket(start_time);
+  int64_t ea = to_abs_bucket(end_time);
+
+  return read_optimistic([&] { return query_seg_range(sa, ea).count; });
+}
+
+// =============================================================================
+// min_spread / max_spread
+// =============================================================================
+
+template <int64_t B, int N, int H>
+double BasicMarketDataCache<B, N, H>::min_spread(int64_t start_time,
+                                                 int64_t end_time) const {
+  CacheInstrument::Scope op(instrument_, CacheOp::MinMax);
+  int64_t sa = to_abs_bucket(start_time);
+  int64_t ea = to_abs_bucket(end_time);
+
+  auto res = read_optimistic([&] { return query_seg_range(sa, ea); });
+  return (res.count > 0) ? res.min_spread
+                         : std::numeric_limits<double>::quiet_NaN();
+}
+
+template <int64_t B, int N, int H>
+double BasicMarketDataCache<B, N, H>::max_spread(int64_t start_time,
+                                                 int64_t end_time) const {
+  CacheInstrument::Scope op(instrument_, CacheOp::MinMax);
+  int64_t sa = to_abs_bucket(start_time);
+  int64_t ea = to_abs_bucket(end_time);
+
+  auto res = read_optimistic([&] { return query_seg_range(sa, ea); });
+  return (res.count > 0) ? res.max_spread
+                         : std::numeric_limits<double>::quiet_NaN();
+}
+
+// =============================================================================
+// spread_percentiles / spread_quantiles  (approximate, histogram-based)
+// =============================================================================
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::check_quantiles(
+    std::span<const double> qs) {
+  for (double q : qs)
+    if (!(q >= 0.0 && q <= 1.0))
+      throw std::invalid_argument("Quantile outside [0, 1]");
+}
+
+template <int64_t B, int N, int H>
+std::tuple<double, double, double>
+BasicMarketDataCache<B, N, H>::spread_percentiles(int64_t start_time,
+                                                  int64_t end_time) const {
+  CacheInstrument::Scope op(instrument_, CacheOp::Quantiles);
+  static constexpr double kPercentiles[] = {0.10, 0.50, 0.90};
+  int64_t sa = to_abs_bucket(start_time);
+  int64_t ea = to_abs_bucket(end_time);
+
+  auto res = read_optimistic([&] {
+    std::array<double, 3> out;
+    query_quantiles(sa, ea, kPercentiles, out.data());
+    return out;
+  });
+  return {res[0], res[1], res[2]};
+}
+
+template <int64_t B, int N, int H>
+std::vector<double> BasicMarketDataCache<B, N, H>::spread_quantiles(
+    int64_t start_time, int64_t end_time, std::span<const double> qs) const {
+  CacheInstrument::Scope op(instrument_, CacheOp::Quantiles);
+  check_quantiles(qs);
+  int64_t sa = to_abs_bucket(start_time);
+  int64_t ea = to_abs_bucket(end_time);
+
+  return read_optimistic([&] {
+    std::vector<double> out(qs.size());
+    query_quantiles(sa, ea, qs, out.data());
+    return out;
+  });
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::query_quantiles(int64_t sa, int64_t ea,
+                                                    std::span<const double> qs,
+                                                    double *out) const {
+  std::fill(out, out + qs.size(), std::numeric_limits<double>::quiet_NaN());
+  int64_t total = query_seg_range(sa, ea).count;
+  if (total == 0 || qs.empty())
+    return;
+
+  // Bucket-major: fetch the whole range histogram in one pass up front.
+  // Bin-major: query bins lazily so the sweep can stop at the highest rank.
+  if (hist_index_ == HistIndex::BucketMajorFenwick) {
+    HistRow hist{};
+    query_hist_range(sa, ea, hist);
+    sweep_quantiles(total, qs, [&](int bin) { return hist[bin]; }, out);
+  } else {
+    sweep_quantiles(
+        total, qs, [&](int bin) { return query_fw_range(bin, sa, ea); }, out);
+  }
+}
+
+template <int64_t B, int N, int H>
+template <typename BinCount>
+void BasicMarketDataCache<B, N, H>::sweep_quantiles(int64_t total,
+                                                    std::span<const double> qs,
+                                                    BinCount &&bin_count,
+                                                    double *out) const {
+  // Requested ranks in ascending order, so one sweep can hand each bin to
+  // every rank it reaches. Small requests stay on the stack.
+  using RankSlot = std::pair<int64_t, size_t>;
+  constexpr size_t kInlineRanks = 16;
+  RankSlot inline_ranks[kInlineRanks];
+  std::vector<RankSlot> heap_ranks;
+  RankSlot *ranks = inline_ranks;
+  if (qs.size() > kInlineRanks) {
+    heap_ranks.resize(qs.size());
+    ranks = heap_ranks.data();
+  }
+  for (size_t i = 0; i < qs.size(); ++i)
+    ranks[i] = {quantile_rank(qs[i], total), i};
+  std::sort(ranks, ranks + qs.size());
+
+  size_t next = 0;
+  int64_t cumulative = 0;
+  for (int bin = 0; bin < NUM_HIST_BINS && next < qs.size(); ++bin) {
+    int64_t cnt = bin_count(bin);
+    if (cnt == 0)
+      continue;
+    cumulative += cnt;
+    for (; next < qs.size() && cumulative >= ranks[next].first; ++next)
+      out[ranks[next].second] = bin_mid(bin);
+  }
+}
+
+// =============================================================================
+// spread_percentiles_exact / spread_quantiles_exact
+// =============================================================================
+
+template <int64_t B, int N, int H>
+std::tuple<double, double, double>
+BasicMarketDataCache<B, N, H>::spread_percentiles_exact(
+    int64_t start_time, int64_t end_time) const {
+  CacheInstrument::Scope op(instrument_, CacheOp::QuantilesExact);
+  static constexpr double kPercentiles[] = {0.10, 0.50, 0.90};
+  double out[3];
+  exact_quantiles(to_abs_bucket(start_time), to_abs_bucket(end_time),
+                  kPercentiles, out);
+  return {out[0], out[1], out[2]};
+}
+
+template <int64_t B, int N, int H>
+std::vector<double> BasicMarketDataCache<B, N, H>::spread_quantiles_exact(
+    int64_t start_time, int64_t end_time, std::span<const double> qs) const {
+  CacheInstrument::Scope op(instrument_, CacheOp::QuantilesExact);
+  check_quantiles(qs);
+  std::vector<double> out(qs.size());
+  exact_quantiles(to_abs_bucket(start_time), to_abs_bucket(end_time), qs,
+                  out.data());
+  return out;
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::exact_quantiles(int64_t sa, int64_t ea,
+                                                    std::span<const double> qs,
+                                                    double *out) const {
+  std::fill(out, out + qs.size(), std::numeric_limits<double>::quiet_NaN());
+
+  // Only the copy needs the lock; selection runs on the private vector.
+  std::vector<double> spreads;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    instrument_.locked();
+    if (exact_) {
+      indexed_quantiles(sa, ea, qs, out);
+      return;
+    }
+    collect_spreads(sa, ea, spreads);
+  }
+  size_t n = spreads.size();
+  if (n == 0 || qs.empty())
+    return;
+
+  std::vector<size_t> idx(qs.size());
+  for (size_t i = 0; i < qs.size(); ++i)
+    idx[i] = static_cast<size_t>(quantile_rank(qs[i], n)) - 1;
+  std::vector<size_t> targets(idx);
+  std::sort(targets.begin(), targets.end());
+  targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+  multi_select(spreads.data(), 0, n, targets.data(),
+               targets.data() + targets.size());
+  for (size_t i = 0; i < qs.size(); ++i)
+    out[i] = spreads[idx[i]];
+}
+
+// Select the middle target, then recurse into the halves on either side with
+// the targets that fall there: each level of recursion partitions every
+// element at most once, so k ranks cost O(n log k) instead of O(n k).
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::multi_select(double *base, size_t lo,
+                                                 size_t hi,
+                                                 const size_t *k_first,
+                                                 const size_t *k_last) {
+  if (k_first == k_last)
+    return;
+  const size_t *mid = k_first + (k_last - k_first) / 2;
+  std::nth_element(base + lo, base + *mid, base + hi);
+  multi_select(base, lo, *mid, k_first, mid);
+  multi_select(base, *mid + 1, hi, mid + 1, k_last);
+}
+
+// =============================================================================
+// spread_percentiles_exact_parallel / spread_quantiles_exact_parallel
+// =============================================================================
+
+template <int64_t B, int N, int H>
+std::tuple<double, double, double>
+BasicMarketDataCache<B, N, H>::spread_percentiles_exact_parallel(
+    int64_t start_time, int64_t end_time, unsigned num_threads) const {
+  CacheInstrument::Scope op(instrument_, CacheOp::QuantilesExact);
+  static constexpr double kPercentiles[] = {0.10, 0.50, 0.90};
+  double out[3];
+  exact_quantiles_parallel(to_abs_bucket(start_time), to_abs_bucket(end_time),
+                           kPercentiles, out, num_threads);
+  return {out[0], out[1], out[2]};
+}
+
+template <int64_t B, int N, int H>
+std::vector<double>
+BasicMarketDataCache<B, N, H>::spread_quantiles_exact_parallel(
+    int64_t start_time, int64_t end_time, std::span<const double> qs,
+    unsigned num_threads) const {
+  CacheInstrument::Scope op(instrument_, CacheOp::QuantilesExact);
+  check_quantiles(qs);
+  std::vector<double> out(qs.size());
+  exact_quantiles_parallel(to_abs_bucket(start_time), to_abs_bucket(end_time),
+                           qs, out.data(), num_threads);
+  return out;
+}
+
+// Phase 1 (one short shared lock): rank -> bin through the range histogram,
+// and each bucket holding ticks in a target bin notes its tick count. Phase 2
+// (pool workers, shared lock per slice): each worker copies the target-bin
+// ticks of its slice of buckets, EXACT_SCAN_SLICE buckets per lock hold, so
+// writers get in between slices. A bucket's list only grows at its end, so
+// copying the noted count of oldest ticks reads exactly the phase-1 state; a
+// bucket evicted meanwhile (or a new epoch) discards the pass, and after
+// EXACT_SCAN_ATTEMPTS passes the lock is held across the whole scan. Phase 3
+// (no lock): each target bin's candidates are merged and its ranks selected.
+// Only ticks in target bins are ever copied, so a few quantiles move a few
+// percent of the range instead of all of it.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::exact_quantiles_parallel(
+    int64_t sa, int64_t ea, std::span<const double> qs, double *out,
+    unsigned num_threads) const {
+  WorkerPool &pool = WorkerPool::shared();
+  if (num_threads == 0)
+    num_threads = pool.concurrency();
+  std::fill(out, out + qs.size(), std::numeric_limits<double>::quiet_NaN());
+  if (qs.empty())
+    return;
+
+  // Target bins get a slot; each quantile is a 0-based rank in its slot.
+  struct Target {
+    int slot;
+    size_t rank;
+  };
+  std::vector<Target> targets(qs.size());
+  std::vector<int> bin_slot;
+  std::vector<int> slot_bin;
+  std::vector<int64_t> noted; // [bucket - lo] -> ticks to copy
+  std::vector<std::vector<std::vector<double>>> found; // [worker][slot]
+  for (int attempt = 1;; ++attempt) {
+    bool hold = attempt >= EXACT_SCAN_ATTEMPTS;
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    instrument_.locked();
+    int64_t total = exact_ ? 0 : query_seg_range(sa, ea).count;
+    if (total < PARALLEL_EXACT_MIN_TICKS) {
+      lock.unlock();
+      exact_quantiles(sa, ea, qs, out);
+      return;
+    }
+    int64_t lo = std::max(sa, window_start_abs_);
+    int64_t hi = std::min(ea, window_end_abs_);
+
+    HistRow hist{};
+    if (hist_index_ == HistIndex::BucketMajorFenwick) {
+      query_hist_range(lo, hi, hist);
+    } else {
+      for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+        hist[bin] = query_fw_range(bin, lo, hi);
+    }
+    bin_slot.assign(NUM_HIST_BINS, -1);
+    slot_bin.clear();
+    for (size_t i = 0; i < qs.size(); ++i) {
+      int64_t rank = quantile_rank(qs[i], total) - 1;
+      int bin = 0;
+      while (bin + 1 < NUM_HIST_BINS && rank >= hist[bin])
+        rank -= hist[bin++];
+      if (bin_slot[bin] < 0) {
+        bin_slot[bin] = static_cast<int>(slot_bin.size());
+        slot_bin.push_back(bin);
+      }
+      targets[i] = {bin_slot[bin], static_cast<size_t>(rank)};
+    }
+
+    noted.assign(hi - lo + 1, 0);
+    for (int64_t ab = lo; ab <= hi; ++ab) {
+      const Bucket *bkt = find_bucket(to_local(ab));
+      if (!bkt || bkt->abs_index != ab)
+        continue;
+      for (int bin : slot_bin)
+        if (bkt->hist[bin] > 0)
+          noted[ab - lo] = bkt->entry_count;
+    }
+    uint32_t epoch = epoch_;
+    if (!hold)
+      lock.unlock();
+
+    unsigned workers = static_cast<unsigned>(
+        std::min<int64_t>(std::min(num_threads, pool.concurrency()),
+                          hi - lo + 1));
+    found.assign(workers, std::vector<std::vector<double>>(slot_bin.size()));
+    std::atomic<bool> moved{false};
+    pool.run(workers, [&](unsigned w) {
+      auto &mine = found[w];
+      for (size_t s = 0; s < slot_bin.size(); ++s)
+        mine[s].reserve(hist[slot_bin[s]] / workers);
+      int64_t len = hi - lo + 1;
+      int64_t end = lo + len * (w + 1) / workers;
+      for (int64_t from = lo + len * w / workers; from < end;
+           from += EXACT_SCAN_SLICE) {
+        std::shared_lock<std::shared_mutex> slice(mutex_, std::defer_lock);
+        if (!hold) {
+          slice.lock();
+          instrument_.locked();
+        }
+        if (moved.load(std::memory_order_relaxed) || epoch_ != epoch) {
+          moved.store(true, std::memory_order_relaxed);
+          return;
+        }
+        for (int64_t ab = from; ab < std::min(end, from + EXACT_SCAN_SLICE);
+             ++ab) {
+          int64_t left = noted[ab - lo];
+          if (left == 0)
+            continue;
+          const Bucket *bkt = find_bucket(to_local(ab));
+          if (!bkt || bkt->abs_index != ab || bkt->entry_count < left) {
+            moved.store(true, std::memory_order_relaxed);
+            return;
+          }
+          spread_slab_.for_each_run(bkt->spreads, [&](const double *run,
+                                                      size_t n) {
+            size_t take = static_cast<size_t>(std::min<int64_t>(n, left));
+            left -= static_cast<int64_t>(take);
+            for (size_t j = 0; j < take; ++j) {
+              int s = bin_slot[spread_to_bin(run[j])];
+              if (s >= 0)
+                mine[s].push_back(run[j]);
+            }
+          });
+        }
+      }
+    });
+    if (!moved.load())
+      break;
+    instrument_.add(CacheCounter::OptimisticRetries);
+  }
+
+  unsigned slots = static_cast<unsigned>(slot_bin.size());
+  unsigned selectors = std::min({num_threads, pool.concurrency(), slots});
+  std::vector<std::vector<double>> merged(slots);
+  pool.run(selectors, [&](unsigned w) {
+    for (unsigned s = w; s < slots; s += selectors) {
+      auto &v = merged[s];
+      size_t n = 0;
+      for (auto &part : found)
+        n += part[s].size();
+      v = std::move(found[0][s]);
+      v.reserve(n);
+      for (size_t p = 1; p < found.size(); ++p)
+        v.insert(v.end(), found[p][s].begin(), found[p][s].end());
+
+      std::vector<size_t> ks;
+      for (auto &t : targets)
+        if (t.slot == static_cast<int>(s))
+          ks.push_back(t.rank);
+      std::sort(ks.begin(), ks.end());
+      ks.erase(std::unique(ks.begin(), ks.end()), ks.end());
+      multi_select(v.data(), 0, v.size(), ks.data(), ks.data() + ks.size());
+    }
+  });
+  for (size_t i = 0; i < qs.size(); ++i)
+    out[i] = merged[targets[i].slot][targets[i].rank];
+}
+
+// =============================================================================
+// Exact-quantile index
+// =============================================================================
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::enable_exact_index() {
+  if constexpr (EXACT_MAX_LEVEL < EXACT_MIN_LEVEL)
+    throw std::logic_error("Window too short for the exact-quantile index");
+
+  WriteLock lock(*this);
+  if (exact_)
+    return;
+  exact_ = std::make_unique<std::vector<std::vector<ExactRun>>>(
+      EXACT_MAX_LEVEL + 1);
+  for (int h = EXACT_MIN_LEVEL; h <= EXACT_MAX_LEVEL; ++h)
+    (*exact_)[h].resize(exact_ring(h));
+  if (has_data())
+    exact_seal(window_start_abs_);
+}
+
+template <int64_t B, int N, int H>
+bool BasicMarketDataCache<B, N, H>::exact_index_enabled() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  instrument_.locked();
+  return exact_ != nullptr;
+}
+
+// Run `id` at level h ends at (id + 1) * 2^h - 1, so the runs newly sealed by
+// moving the end from old_end are ids old_end >> h .. (end >> h) - 1; the
+// first ones may still stick out of the window start. Levels go up so both
+// halves of a run exist before it is merged.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::exact_seal(int64_t old_end) {
+  for (int h = EXACT_MIN_LEVEL; h <= EXACT_MAX_LEVEL; ++h) {
+    int64_t len = int64_t{1} << h;
+    int64_t first =
+        std::max(old_end >> h, (window_start_abs_ + len - 1) >> h);
+    int64_t last = (window_end_abs_ >> h) - 1;
+    for (int64_t id = first; id <= last; ++id)
+      exact_build(h, id);
+  }
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::exact_build(int h, int64_t id) {
+  ExactRun &run = exact_slot(h, id);
+  run.id = INT64_MIN;
+  run.sorted.clear();
+
+  int64_t len = int64_t{1} << h;
+  if (h == EXACT_MIN_LEVEL) {
+    for (int64_t ab = id * len; ab < (id + 1) * len; ++ab) {
+      const Bucket *bkt = find_bucket(to_local(ab));
+      if (bkt && bkt->abs_index == ab)
+        spread_slab_.for_each_run(bkt->spreads,
+                                  [&](const double *r, size_t n) {
+                                    run.sorted.insert(run.sorted.end(), r,
+                                                      r + n);
+                                  });
+    }
+    std::sort(run.sorted.begin(), run.sorted.end());
+  } else {
+    const ExactRun *lo = exact_find(h - 1, 2 * id);
+    const ExactRun *hi = exact_find(h - 1, 2 * id + 1);
+    if (!lo || !hi)
+      return;
+    run.sorted.resize(lo->sorted.size() + hi->sorted.size());
+    std::merge(lo->sorted.begin(), lo->sorted.end(), hi->sorted.begin(),
+               hi->sorted.end(), run.sorted.begin());
+  }
+  run.id = id;
+}
+
+// A late tick only touches sealed runs: once the run containing `abs` at
+// some level still reaches the window end, every run above it does too.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::exact_add_late(int64_t abs, double spread) {
+  for (int h = EXACT_MIN_LEVEL; h <= EXACT_MAX_LEVEL; ++h) {
+    int64_t id = abs >> h;
+    if (id >= window_end_abs_ >> h)
+      break;
+    ExactRun &run = exact_slot(h, id);
+    if (run.id != id)
+      continue;
+    run.sorted.insert(
+        std::upper_bound(run.sorted.begin(), run.sorted.end(), spread),
+        spread);
+  }
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::exact_reset() {
+  for (auto &level : *exact_) {
+    for (auto &run : level) {
+      run.id = INT64_MIN;
+      std::vector<double>().swap(run.sorted);
+    }
+  }
+}
+
+// Cover [sa, ea] left to right with the longest sealed run that starts at the
+// cursor and fits; buckets no run covers (the unaligned edges and the
+// unsealed head, under 2^EXACT_MIN_LEVEL each) are copied and sorted.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::indexed_quantiles(
+    int64_t sa, int64_t ea, std::span<const double> qs, double *out) const {
+  if (!has_data())
+    return;
+  sa = std::max(sa, window_start_abs_);
+  ea = std::min(ea, window_end_abs_);
+  if (sa > ea || qs.empty())
+    return;
+
+  std::vector<std::span<const double>> runs;
+  std::vector<double> loose;
+  for (int64_t pos = sa; pos <= ea;) {
+    int h = EXACT_MAX_LEVEL;
+    for (; h >= EXACT_MIN_LEVEL; --h) {
+      int64_t len = int64_t{1} << h;
+      if ((pos & (len - 1)) != 0 || pos + len - 1 > ea)
+        continue;
+      if (const ExactRun *run = exact_find(h, pos >> h)) {
+        if (!run->sorted.empty())
+          runs.emplace_back(run->sorted);
+        break;
+      }
+    }
+    if (h >= EXACT_MIN_LEVEL) {
+      pos += int64_t{1} << h;
+      continue;
+    }
+    const Bucket *bkt = find_bucket(to_local(pos));
+    if (bkt && bkt->abs_index == pos)
+      spread_slab_.for_each_run(bkt->spreads, [&](const double *run,
+                                                  size_t n) {
+        loose.insert(loose.end(), run, run + n);
+      });
+    ++pos;
+  }
+  std::sort(loose.begin(), loose.end());
+  if (!loose.empty())
+    runs.emplace_back(loose);
+
+  int64_t n = 0;
+  for (auto run : runs)
+    n += static_cast<int64_t>(run.size());
+  if (n == 0)
+    return;
+  for (size_t i = 0; i < qs.size(); ++i)
+    out[i] = select_rank(runs, quantile_rank(qs[i], n));
+}
+
+// Each round pivots on the weighted median of the runs' middle elements:
+// at least a quarter of the remaining candidates lie on each side of it, so
+// O(log n) rounds of m binary searches narrow every run down to its part of
+// the answer. The last few dozen candidates are selected directly.
+template <int64_t B, int N, int H>
+double BasicMarketDataCache<B, N, H>::select_rank(
+    std::span<const std::span<const double>> runs, int64_t k) {
+  struct Window {
+    const double *lo, *hi;
+  };
+  std::vector<Window> win;
+  int64_t total = 0;
+  for (auto run : runs) {
+    win.push_back({run.data(), run.data() + run.size()});
+    total += static_cast<int64_t>(run.size());
+  }
+
+  std::vector<std::pair<double, int64_t>> mids;
+  std::vector<const double *> lt(win.size()), le(win.size());
+  while (total > 64) {
+    mids.clear();
+    for (auto &w : win)
+      if (w.lo < w.hi)
+        mids.push_back({w.lo[(w.hi - w.lo) / 2], w.hi - w.lo});
+    std::sort(mids.begin(), mids.end());
+    double pivot = mids.back().first;
+    for (int64_t acc = 0; auto &[v, weight] : mids) {
+      acc += weight;
+      if (2 * acc >= total) {
+        pivot = v;
+        break;
+      }
+    }
+
+    int64_t below = 0, equal = 0;
+    for (size_t r = 0; r < win.size(); ++r) {
+      lt[r] = std::lower_bound(win[r].lo, win[r].hi, pivot);
+      le[r] = std::upper_bound(lt[r], win[r].hi, pivot);
+      below += lt[r] - win[r].lo;
+      equal += le[r] - lt[r];
+    }
+    if (k <= below) {
+      for (size_t r = 0; r < win.size(); ++r)
+        win[r].hi = lt[r];
+      total = below;
+    } else if (k <= below + equal) {
+      return pivot;
+    } else {
+      for (size_t r = 0; r < win.size(); ++r)
+        win[r].lo = le[r];
+      k -= below + equal;
+      total -= below + equal;
+    }
+  }
+
+  std::vector<double> rest;
+  for (auto &w : win)
+    rest.insert(rest.end(), w.lo, w.hi);
+  std::nth_element(rest.begin(), rest.begin() + (k - 1), rest.end());
+  return rest[k - 1];
+}
+
+// =============================================================================
+// Relative-error sketch
+// =============================================================================
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::enable_sketch(double alpha) {
+  SketchMapping mapping(alpha); // validates before anything changes
+
+  WriteLock lock(*this);
+  sketch_.reset(new SketchIndex{
+      mapping, ChunkedArray<SpreadSketch, BUCKET_POOL_CHUNK>(NUM_BUCKETS),
+      std::vector<SpreadSketch>(NUM_BLOCKS + 1)});
+  if (!storage_ready_.load(std::memory_order_relaxed))
+    return;
+  for (int local = 0; local < NUM_BUCKETS; ++local) {
+    const Bucket *b = find_bucket(local);
+    if (!b)
+      continue;
+    spread_slab_.for_each_run(b->spreads, [&](const double *run, size_t n) {
+      for (size_t i = 0; i < n; ++i)
+        sketch_add_tick(local, run[i]);
+    });
+  }
+}
+
+template <int64_t B, int N, int H>
+bool BasicMarketDataCache<B, N, H>::sketch_enabled() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  instrument_.locked();
+  return sketch_ != nullptr;
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::sketch_add_tick(int local, double spread) {
+  const SketchMapping &m = sketch_->mapping;
+  sketch_->buckets.at(local).add(m, spread);
+  for (int i = local / HIST_BLOCK + 1; i <= NUM_BLOCKS; i += i & (-i))
+    sketch_->fenwick[i].add(m, spread);
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::sketch_remove_bucket(int local) {
+  SpreadSketch *sk = sketch_->buckets.find(local);
+  if (!sk || sk->count() == 0)
+    return;
+  for (int i = local / HIST_BLOCK + 1; i <= NUM_BLOCKS; i += i & (-i))
+    sketch_->fenwick[i].merge(*sk, -1);
+  if (compact())
+    sk->release();
+  else
+    sk->clear();
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::sketch_prefix(int pos, SpreadSketch &out,
+                                                  int sign) const {
+  for (int i = pos; i > 0; i -= i & (-i))
+    out.merge(sketch_->fenwick[i], sign);
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::sketch_range_local(int l, int r,
+                                                       SpreadSketch &out,
+                                                       int sign) const {
+  split_blocks(
+      l, r,
+      [&](int lo, int hi) {
+        for (int b = lo; b <= hi; ++b)
+          if (const SpreadSketch *sk = sketch_->buckets.find(b))
+            out.merge(*sk, sign);
+      },
+      [&](int lo, int hi) {
+        sketch_prefix(hi + 1, out, sign);
+        sketch_prefix(lo, out, -sign);
+      });
+}
+
+template <int64_t B, int N, int H>
+std::vector<double> BasicMarketDataCache<B, N, H>::spread_quantiles_sketch(
+    int64_t start_time, int64_t end_time, std::span<const double> qs) const {
+  CacheInstrument::Scope op(instrument_, CacheOp::QuantilesSketch);
+  check_quantiles(qs);
+  std::vector<double> out(qs.size(), std::numeric_limits<double>::quiet_NaN());
+  int64_t sa = to_abs_bucket(start_time);
+  int64_t ea = to_abs_bucket(end_time);
+
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  instrument_.locked();
+  if (!sketch_)
+    throw std::logic_error("Sketch not enabled");
+  // Same shape as query_hist_range.
+  SpreadSketch acc;
+  for_each_live_range(sa, ea, [&](int l, int r) {
+    sketch_range_local(l, r, acc, +1);
+  });
+
+  int64_t n = acc.count();
+  if (n == 0)
+    return out;
+  for (size_t i = 0; i < qs.size(); ++i)
+    out[i] = acc.value_at_rank(sketch_->mapping, quantile_rank(qs[i], n));
+  return out;
+}
+
+// =============================================================================
+// Rollup tiers
+// =============================================================================
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::enable_rollups(
+    std::span<const RollupTier> tiers) {
+  std::vector<Rollup> rings;
+  int64_t prev_ns = BUCKET_NS;
+  for (auto &t : tiers) {
+    if (t.bucket_ns < prev_ns || t.bucket_ns % prev_ns != 0)
+      throw std::invalid_argument(
+          "Rollup tier must be a multiple of the tier before it");
+    rings.emplace_back(t.bucket_ns, t.num_buckets);
+    prev_ns = t.bucket_ns;
+  }
+
+  WriteLock lock(*this);
+  rollups_ = std::move(rings);
+}
+
+template <int64_t B, int N, int H>
+bool BasicMarketDataCache<B, N, H>::rollups_enabled() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  instrument_.locked();
+  return !rollups_.empty();
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::rollup_bucket(int local) {
+  if (rollups_.empty())
+    return;
+  const Bucket *b = find_bucket(local);
+  if (!b || b->entry_count == 0)
+    return;
+  typename Rollup::Cell cell;
+  cell.start = b->abs_index * BUCKET_NS;
+  cell.count = b->entry_count;
+  cell.min_spread = b->min_spread;
+  cell.max_spread = b->max_spread;
+  cell.hist = b->hist;
+  rollup_push(0, cell);
+}
+
+// A cell older than a tier holds skips straight to the next one.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::rollup_push(
+    size_t tier, const typename Rollup::Cell &cell) {
+  for (; tier < rollups_.size(); ++tier) {
+    auto cascade = [this, tier](const typename Rollup::Cell &old) {
+      rollup_push(tier + 1, old);
+    };
+    if (rollups_[tier].absorb(cell, cascade))
+      return;
+  }
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::spread_summary(
+    int64_t start_time, int64_t end_time, std::span<const double> qs) const
+    -> SpreadSummary {
+  CacheInstrument::Scope op(instrument_, CacheOp::Summary);
+  check_quantiles(qs);
+  int64_t sa = to_abs_bucket(start_time);
+  int64_t ea = to_abs_bucket(end_time);
+
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  instrument_.locked();
+  typename Rollup::Cell acc;
+  SegNode seg = query_seg_range(sa, ea);
+  if (seg.count > 0) {
+    acc.count = seg.count;
+    acc.min_spread = seg.min_spread;
+    acc.max_spread = seg.max_spread;
+    if (hist_index_ == HistIndex::BucketMajorFenwick) {
+      query_hist_range(sa, ea, acc.hist);
+    } else {
+      for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+        acc.hist[bin] = query_fw_range(bin, sa, ea);
+    }
+  }
+  for (auto &tier : rollups_)
+    tier.query(start_time, end_time, acc);
+
+  SpreadSummary out;
+  out.count = acc.count;
+  out.quantiles.assign(qs.size(), std::numeric_limits<double>::quiet_NaN());
+  if (acc.count == 0) {
+    out.min_spread = out.max_spread = std::numeric_limits<double>::quiet_NaN();
+    return out;
+  }
+  out.min_spread = acc.min_spread;
+  out.max_spread = acc.max_spread;
+  sweep_quantiles(
+      acc.count, qs, [&](int bin) { return acc.hist[bin]; },
+      out.quantiles.data());
+  return out;
+}
+
+// =============================================================================
+// Rolling subscriptions
+// =============================================================================
+
+template <int64_t B, int N, int H>
+int BasicMarketDataCache<B, N, H>::subscribe(int64_t window_ns,
+                                             std::span<const double> qs) {
+  check_quantiles(qs);
+  if (window_ns <= 0)
+    throw std::invalid_argument("Subscription window must be positive");
+  auto sub = std::make_unique<Subscription>();
+  sub->span = std::min<int64_t>((window_ns - 1) / BUCKET_NS + 1, NUM_BUCKETS);
+  sub->qs.assign(qs.begin(), qs.end());
+
+  WriteLock lock(*this);
+  // Start from what the window already holds: one pass over the span.
+  if (has_data()) {
+    sub->end_abs = window_end_abs_;
+    sub->first_abs = window_end_abs_ - sub->span + 1;
+    for (int64_t a = std::max(sub->first_abs, window_start_abs_);
+         a <= window_end_abs_; ++a) {
+      const Bucket *b = find_bucket(to_local(a));
+      if (!b || b->abs_index != a)
+        continue;
+      sub->count += b->entry_count;
+      for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+        sub->hist[bin] += b->hist[bin];
+      sub->push_extremes(a, b->min_spread, b->max_spread);
+    }
+  }
+  subs_.push_back(std::move(sub));
+  return static_cast<int>(subs_.size() - 1);
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::unsubscribe(int id) {
+  WriteLock lock(*this);
+  if (id >= 0 && static_cast<size_t>(id) < subs_.size())
+    subs_[id].reset();
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::rolling_stats(int id) const
+    -> RollingStats {
+  CacheInstrument::Scope op(instrument_, CacheOp::RollingStats);
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  instrument_.locked();
+  if (id < 0 || static_cast<size_t>(id) >= subs_.size() || !subs_[id])
+    throw std::out_of_range("Unknown subscription");
+  const Subscription &sub = *subs_[id];
+
+  RollingStats out;
+  if (sub.end_abs != INT64_MIN) {
+    out.start_time = sub.first_abs * BUCKET_NS;
+    out.end_time = (sub.end_abs + 1) * BUCKET_NS - 1;
+  }
+  out.count = sub.count;
+  out.quantiles.assign(sub.qs.size(),
+                       std::numeric_limits<double>::quiet_NaN());
+  if (sub.count == 0) {
+    out.min_spread = out.max_spread = std::numeric_limits<double>::quiet_NaN();
+    return out;
+  }
+  if (sub.late_abs >= sub.first_abs) {
+    SegNode seg = query_seg_range(sub.first_abs, sub.end_abs);
+    out.min_spread = seg.min_spread;
+    out.max_spread = seg.max_spread;
+  } else {
+    out.min_spread = sub.mins.front().second;
+    out.max_spread = sub.maxs.front().second;
+  }
+  sweep_quantiles(
+      sub.count, sub.qs, [&](int bin) { return sub.hist[bin]; },
+      out.quantiles.data());
+  return out;
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::Subscription::reset() {
+  first_abs = INT64_MAX;
+  end_abs = INT64_MIN;
+  late_abs = INT64_MIN;
+  count = 0;
+  hist.fill(0);
+  mins.clear();
+  maxs.clear();
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::Subscription::push_extremes(int64_t abs,
+                                                                double lo,
+                                                                double hi) {
+  while (!mins.empty() && mins.back().second >= lo)
+    mins.pop_back();
+  if (mins.empty() || mins.back().first != abs)
+    mins.push_back({abs, lo});
+  while (!maxs.empty() && maxs.back().second <= hi)
+    maxs.pop_back();
+  if (maxs.empty() || maxs.back().first != abs)
+    maxs.push_back({abs, hi});
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::sub_remove_bucket(Subscription &sub,
+                                                      int64_t abs) {
+  const Bucket *b = find_bucket(to_local(abs));
+  if (!b || b->abs_index != abs)
+    return;
+  sub.count -= b->entry_count;
+  for (int bin = 0; bin < NUM_HIST_BINS; ++bin)
+    sub.hist[bin] -= b->hist[bin];
+}
+
+// Each bucket slides out of a subscription once, so the loop below is
+// amortised O(1) per bucket of elapsed time; a jump past the whole span
+// resets instead.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::subs_advance(int64_t abs) {
+  for (auto &p : subs_) {
+    if (!p || abs <= p->end_abs)
+      continue;
+    Subscription &sub = *p;
+    int64_t new_first = abs - sub.span + 1;
+    if (sub.end_abs == INT64_MIN || new_first > sub.end_abs) {
+      sub.reset();
+      sub.first_abs = new_first;
+    } else {
+      for (int64_t a = sub.first_abs; a < new_first; ++a)
+        sub_remove_bucket(sub, a);
+      while (!sub.mins.empty() && sub.mins.front().first < new_first)
+        sub.mins.pop_front();
+      while (!sub.maxs.empty() && sub.maxs.front().first < new_first)
+        sub.maxs.pop_front();
+      sub.first_abs = std::max(sub.first_abs, new_first);
+    }
+    sub.end_abs = abs;
+  }
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::subs_add_tick(int64_t abs, double spread,
+                                                  int bin) {
+  for (auto &p : subs_) {
+    if (!p || abs < p->first_abs || abs > p->end_abs)
+      continue;
+    Subscription &sub = *p;
+    sub.count++;
+    sub.hist[bin]++;
+    if (abs == sub.end_abs)
+      sub.push_extremes(abs, spread, spread);
+    else
+      sub.late_abs = std::max(sub.late_abs, abs);
+  }
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::subs_cut(int64_t new_start) {
+  for (auto &p : subs_) {
+    if (!p)
+      continue;
+    Subscription &sub = *p;
+    if (new_start > sub.end_abs) {
+      sub.reset();
+      continue;
+    }
+    for (int64_t a = sub.first_abs; a < new_start; ++a)
+      sub_remove_bucket(sub, a);
+    while (!sub.mins.empty() && sub.mins.front().first < new_start)
+      sub.mins.pop_front();
+    while (!sub.maxs.empty() && sub.maxs.front().first < new_start)
+      sub.maxs.pop_front();
+    sub.first_abs = std::max(sub.first_abs, new_start);
+  }
+}
+
+// =============================================================================
+// Book metrics
+// =============================================================================
+
+template <int64_t B, int N, int H>
+int BasicMarketDataCache<B, N, H>::add_metric(const MetricSpec &spec) {
+  if (spec.levels < 1 || spec.levels > BookTop::MAX_LEVELS)
+    throw std::invalid_argument("Metric levels outside [1, MAX_LEVELS]");
+  if (spec.kind == BookMetric::Custom && !spec.fn)
+    throw std::invalid_argument("Custom metric without a function");
+
+  WriteLock lock(*this);
+  int id = metric_count_.load(std::memory_order_relaxed);
+  if (id == MAX_METRICS)
+    throw std::length_error("Too many metrics");
+  if (!metrics_) {
+    metrics_ = std::make_unique<std::vector<MetricColumn>>();
+    metrics_->reserve(MAX_METRICS);
+  }
+  MetricColumn col;
+  col.count = ChunkedArray<int64_t, BUCKET_POOL_CHUNK>(NUM_BUCKETS);
+  col.sum = ChunkedArray<double, BUCKET_POOL_CHUNK>(NUM_BUCKETS);
+  col.min = ChunkedArray<double, BUCKET_POOL_CHUNK>(NUM_BUCKETS);
+  col.max = ChunkedArray<double, BUCKET_POOL_CHUNK>(NUM_BUCKETS);
+  col.seg.assign(2 * static_cast<size_t>(SEG_LEAVES), MetricNode{});
+  metrics_->push_back(std::move(col));
+  metric_specs_[id] = spec;
+  // Publishes the spec to the insert paths, which read it unlocked.
+  metric_count_.store(id + 1, std::memory_order_release);
+  return id;
+}
+
+template <int64_t B, int N, int H>
+int BasicMarketDataCache<B, N, H>::num_metrics() const {
+  return metric_count_.load(std::memory_order_acquire);
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::metric_summary(int id, int64_t start_time,
+                                                   int64_t end_time) const
+    -> MetricSummary {
+  CacheInstrument::Scope op(instrument_, CacheOp::MetricSummary);
+  if (id < 0 || id >= metric_count_.load(std::memory_order_acquire))
+    throw std::out_of_range("Unknown metric");
+  int64_t sa = to_abs_bucket(start_time);
+  int64_t ea = to_abs_bucket(end_time);
+
+  const MetricColumn &col = (*metrics_)[id];
+  MetricNode res =
+      read_optimistic([&] { return query_metric_range(col, sa, ea); });
+  MetricSummary out;
+  out.count = res.count;
+  out.sum = res.sum;
+  if (res.count == 0) {
+    out.mean = out.min = out.max = std::numeric_limits<double>::quiet_NaN();
+    return out;
+  }
+  out.mean = res.sum / static_cast<double>(res.count);
+  out.min = res.min;
+  out.max = res.max;
+  return out;
+}
+
+// Specs are read unlocked: the first num_metrics were published by
+// metric_count_ (acquired by the caller) and never change.
+template <int64_t B, int N, int H>
+double BasicMarketDataCache<B, N, H>::eval_metrics(
+    const MarketDataEntryView &entry, LevelOrder order, int num_metrics,
+    double *out) const {
+  int levels = 1;
+  for (int m = 0; m < num_metrics; ++m)
+    levels = std::max(levels, metric_specs_[m].levels);
+  BookTop top;
+  top.build(entry, order, levels);
+  for (int m = 0; m < num_metrics; ++m)
+    out[m] = metric_specs_[m].eval(top);
+  return top.spread();
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::metrics_clear_cells(int32_t slot) {
+  // The four arrays of a column allocate a slot's chunk together.
+  for (auto &col : *metrics_) {
+    if (int64_t *count = col.count.find(static_cast<size_t>(slot))) {
+      *count = 0;
+      *col.sum.find(static_cast<size_t>(slot)) = 0.0;
+    }
+  }
+}
+
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::metric_seg_update(MetricColumn &col,
+                                                      int local) {
+  int node = SEG_LEAVES + local;
+  size_t slot = static_cast<size_t>(bucket_slot_[local]);
+  MetricNode leaf;
+  const int64_t *count = col.count.find(slot);
+  if (count && *count > 0)
+    leaf = {*count, *col.sum.find(slot), *col.min.find(slot),
+            *col.max.find(slot)};
+  leaf.epoch = epoch_;
+  col.seg[node] = leaf;
+  for (node >>= 1; node > 0; node >>= 1) {
+    MetricNode n = metric_at(col, 2 * node);
+    metric_combine(n, metric_at(col, 2 * node + 1));
+    n.epoch = epoch_;
+    col.seg[node] = n;
+  }
+}
+
+// A tick only adds to its path, so a node of the current epoch takes the
+// value as it is; only a stale one is rebuilt from its children.
+template <int64_t B, int N, int H>
+void BasicMarketDataCache<B, N, H>::metric_seg_add(MetricColumn &col,
+                                                   int local, double value) {
+  const MetricNode tick{1, value, value, value};
+  for (int node = SEG_LEAVES + local; node > 0; node >>= 1) {
+    MetricNode &n = col.seg[node];
+    if (n.epoch == epoch_) {
+      metric_combine(n, tick);
+      continue;
+    }
+    MetricNode fresh = tick;
+    if (node < SEG_LEAVES) {
+      // The child on the path is already up to date.
+      fresh = metric_at(col, 2 * node);
+      metric_combine(fresh, metric_at(col, 2 * node + 1));
+    }
+    fresh.epoch = epoch_;
+    n = fresh;
+  }
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::query_metric_range(const MetricColumn &col,
+                                                       int64_t start_abs,
+                                                       int64_t end_abs) const
+    -> MetricNode {
+  MetricNode res;
+  for_each_live_range(start_abs, end_abs, [&](int l, int r) {
+    metric_combine(res, metric_seg_query(col, l, r));
+  });
+  return res;
+}
+
+template <int64_t B, int N, int H>
+auto BasicMarketDataCache<B, N, H>::metric_seg_query(const MetricColumn &col,
+                                                     int l, int r) const
+    -> MetricNode {
+  MetricNode res;
+  for (l += SEG_LEAVES, r += SEG_LEAVES + 1; l < r; l >>= 1, r >>= 1) {
+    if (l & 1)
+      metric_combine(res, metric_at(col, l++));
+    if (r & 1)
+      metric_combine(res, metric_at(col, --r));
+  }
+  return res;
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "market_data_cache.h"
+#include "spsc_ring.h"
+
+// ---- Ingestor ---------------------------------------------------------------
+
+// Front-end for several feed threads writing into one cache. Each producer
+// owns an SPSC staging ring: push() computes the spread on the feed thread
+// (with the cache's level order) and stages {time, spread}. One applier
+// thread drains every ring into a batch and hands it to insert_spreads under
+// a single writer-lock acquisition. Producers never touch the cache's lock,
+// so they never wait on its readers or on each other; they only wait when
+// their own ring is full.
+//
+// Each producer's ticks reach the cache in push order. Ticks of different
+// producers interleave in drain order, which the cache handles like any
+// other out-of-order tick within its window.
+//
+// Producer i must be used by one thread at a time. The applier runs from
+// construction until stop() or destruction, which both apply everything
+// already staged.
+template <typename Cache> class BasicMarketDataIngestor {
+  using SpreadTick = MarketDataCacheBase::SpreadTick;
+
+public:
+  static constexpr size_t DEFAULT_RING_CAPACITY = 1 << 16;
+  // Ticks per insert_spreads call.
+  static constexpr size_t MAX_BATCH = 16384;
+  // Empty polls (each followed by a yield) before the applier sleeps.
+  static constexpr int IDLE_SPINS = 64;
+
+  class Producer {
+  public:
+    // Stage one entry. Entries with no spread (an empty side) are dropped
+    // here. Returns false, staging nothing, if the ring is full.
+    bool try_push(const MarketDataEntryView &entry) {
+      double spread = entry.compute_spread(owner_.cache_.level_order());
+      if (std::isnan(spread))
+        return true;
+      if (!ring_.try_push({entry.time, spread}))
+        return false;
+      owner_.notify();
+      return true;
+    }
+    // Same, yielding until the ring has room.
+    void push(const MarketDataEntryView &entry) {
+      double spread = entry.compute_spread(owner_.cache_.level_order());
+      if (std::isnan(spread))
+        return;
+      while (!ring_.try_push({entry.time, spread}))
+        std::this_thread::yield();
+      owner_.notify();
+    }
+    bool try_push(const MarketDataEntry &entry) {
+      return try_push(entry.view());
+    }
+    void push(const MarketDataEntry &entry) { push(entry.view()); }
+
+  private:
+    friend class BasicMarketDataIngestor;
+    Producer(BasicMarketDataIngestor &owner, size_t ring_capacity)
+        : owner_(owner), ring_(ring_capacity) {}
+
+    BasicMarketDataIngestor &owner_;
+    SpscRing<SpreadTick> ring_;
+  };
+
+  // Throws std::invalid_argument if num_producers is 0.
+  BasicMarketDataIngestor(Cache &cache, size_t num_producers,
+                          size_t ring_capacity = DEFAULT_RING_CAPACITY)
+      : cache_(cache) {
+    if (num_producers == 0)
+      throw std::invalid_argument("Ingestor needs at least one producer");
+    for (size_t i = 0; i < num_producers; ++i)
+      producers_.emplace_back(new Producer(*this, ring_capacity));
+    applier_ = std::thread([this] { run(); });
+  }
+
+  ~BasicMarketDataIngestor() { stop(); }
+
+  BasicMarketDataIngestor(const BasicMarketDataIngestor &) = delete;
+  BasicMarketDataIngestor &operator=(const BasicMarketDataIngestor &) = delete;
+
+  size_t num_producers() const { return producers_.size(); }
+  Producer &producer(size_t i) { return *producers_.at(i); }
+
+  // Block until every tick staged before the call is in the cache.
+  void flush() {
+    std::vector<uint64_t> target(producers_.size());
+    for (size_t i = 0; i < producers_.size(); ++i)
+      target[i] = producers_[i]->ring_.pushed();
+    for (size_t i = 0; i < producers_.size(); ++i)
+      while (producers_[i]->ring_.released() < target[i])
+        std::this_thread::yield();
+  }
+
+  // Apply what is staged and join the applier. Ticks pushed afterwards are
+  // never applied. Idempotent.
+  void stop() {
+    if (!applier_.joinable())
+      return;
+    stop_.store(true, std::memory_order_release);
+    wake();
+    applier_.join();
+  }
+
+  // Ticks inserted so far.
+  uint64_t applied() const { return applied_.load(std::memory_order_relaxed); }
+
+private:
+  Cache &cache_;
+  std::vector<std::unique_ptr<Producer>> producers_;
+  std::thread applier_;
+  std::atomic<bool> stop_{false};
+  std::atomic<uint64_t> applied_{0};
+  // The applier sleeps on wake_ once sleeping_ is set; a producer that sees
+  // sleeping_ after staging bumps wake_. A fence on each side (store, fence,
+  // load) guarantees one of them sees the other's store, so no tick is left
+  // staged while the applier sleeps.
+  alignas(64) std::atomic<bool> sleeping_{false};
+  std::atomic<uint32_t> wake_{0};
+
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed))
+      wake();
+  }
+  void wake() {
+    sleeping_.store(false, std::memory_order_relaxed);
+    wake_.fetch_add(1, std::memory_order_release);
+    wake_.notify_one();
+  }
+
+  bool pending() const {
+    for (auto &p : producers_)
+      if (p->ring_.pushed() != p->ring_.released())
+        return true;
+    return false;
+  }
+
+  void run() {
+    std::vector<SpreadTick> batch;
+    batch.reserve(MAX_BATCH);
+    std::vector<size_t> taken(producers_.size());
+    size_t first = 0;
+    int idle = 0;
+    while (true) {
+      // Read stop_ before draining: once it is seen, one more empty pass
+      // proves everything staged before stop() has been applied.
+      bool stopping = stop_.load(std::memory_order_acquire);
+      batch.clear();
+      // Rotate the starting ring so a busy producer cannot starve the rest
+      // when batches fill up.
+      for (size_t k = 0; k < producers_.size(); ++k) {
+        size_t i = (first + k) % producers_.size();
+        taken[i] = producers_[i]->ring_.peek(batch, MAX_BATCH - batch.size());
+      }
+      first = (first + 1) % producers_.size();
+
+      if (!batch.empty()) {
+        cache_.insert_spreads(batch);
+        for (size_t i = 0; i < producers_.size(); ++i)
+          producers_[i]->ring_.release(taken[i]);
+        applied_.fetch_add(batch.size(), std::memory_order_relaxed);
+        idle = 0;
+        continue;
+      }
+      if (stopping)
+        return;
+      if (++idle < IDLE_SPINS) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      uint32_t seen = wake_.load(std::memory_order_acquire);
+      sleeping_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!pending() && !stop_.load(std::memory_order_acquire))
+        wake_.wait(seen, std::memory_order_acquire);
+      sleeping_.store(false, std::memory_order_relaxed);
+      idle = 0;
+    }
+  }
+};
+
+using MarketDataIngestor = BasicMarketDataIngestor<MarketDataCache>;
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "market_data_cache.h"
+#include "run_arena.h"
+
+// ---- Legacy DOM-style parser ------------------------------------------------
+
+// Parse a whole {"market_data_entries": [...]} document held in memory.
+// Allocates one std::string per key and per number; kept as the reference
+// implementation (and benchmark baseline) for the streaming reader below.
+std::vector<MarketDataEntry> parse_market_data_json(const std::string &json);
+
+// ---- Memory-mapped file -----------------------------------------------------
+
+// Read-only mmap of a whole file. Not copyable; unmapped on destruction.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+  const char *begin() const { return data_; }
+  const char *end() const { return data_ + size_; }
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// ---- Streaming in-place reader ----------------------------------------------
+
+// Pull parser over a market_data_entries document that never copies the input:
+// keys are compared in place and numbers are parsed with std::from_chars.
+// `next` reuses the bid/ask vectors of the entry passed in, so a caller that
+// keeps one MarketDataEntry alive allocates nothing once capacities settle.
+//
+// `null` prices/amounts parse as NaN; an entry whose utc_epoch_ns is null (or
+// missing) is skipped.
+class MarketDataJsonReader {
+public:
+  // Reader over a whole document; positions itself on the first entry.
+  MarketDataJsonReader(const char *begin, const char *end);
+
+  // Reader over one chunk returned by split_entries: [chunk_begin, chunk_end)
+  // must start at an entry. `doc_begin` is only used for error offsets.
+  MarketDataJsonReader(const char *doc_begin, const char *chunk_begin,
+                       const char *chunk_end);
+
+  // Split the market_data_entries array of a whole document into at most
+  // `max_chunks` runs of whole entries. Returns the chunk boundaries: chunk i
+  // is [result[i], result[i + 1]); the last boundary is the closing ']'.
+  // Boundaries are found by locating the next "utc_epoch_ns" key after each
+  // even split point and walking back to its enclosing '{', so only the
+  // document's tail and a few bytes per split are scanned.
+  static std::vector<const char *> split_entries(const char *begin,
+                                                 const char *end,
+                                                 size_t max_chunks);
+
+  // Fill `entry` with the next entry. Returns false once the array is done.
+  bool next(MarketDataEntry &entry);
+  // Same, with the levels appended to `arena`: the view stays valid until
+  // the arena is reset, and nothing is allocated once the arena has grown.
+  bool next(MarketDataEntryView &entry, RunArena<PriceLevel> &arena);
+
+  // Byte offset of the cursor from `begin`.
+  size_t offset() const { return static_cast<size_t>(p_ - begin_); }
+
+private:
+  const char *begin_;
+  const char *p_;
+  const char *end_;
+  const char *chunk_end_ = nullptr; // null when reading a whole document
+  bool done_ = false;
+
+  // Shared body of the next() overloads: read_side(is_bid) parses a level
+  // array at the cursor, clear() empties both sides.
+  template <typename ReadSide, typename Clear>
+  bool next_entry(int64_t &time, ReadSide &&read_side, Clear &&clear);
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "market_data_cache.h"
+#include "worker_pool.h"
+
+// ---- Registry ---------------------------------------------------------------
+
+// Symbol-keyed set of MarketDataCache instances, one per instrument.
+//
+// Symbols are hashed onto a fixed number of shards, each with its own lock and
+// map, so inserts for different instruments never share a lock: an insert
+// takes its shard's lock in shared mode just long enough to find the cache
+// (exclusive only the first time a symbol is seen), then the cache's own
+// writer lock. Caches are heap-allocated and never move, so references stay
+// valid for the registry's lifetime.
+//
+// Cross-symbol queries group the requested symbols by shard and fan the shards
+// out over WorkerPool::shared(); results come back in the order of the input
+// symbols. A symbol that was never inserted answers like an empty cache.
+class MarketDataRegistry {
+public:
+  // num_shards = 0 picks 4 x hardware concurrency. Caches default to compact
+  // storage so that thousands of mostly sparse instruments fit in memory.
+  explicit MarketDataRegistry(
+      size_t num_shards = 0, double hist_min = -5.0, double hist_max = 95.0,
+      MarketDataCache::HistIndex hist_index =
+          MarketDataCache::HistIndex::BucketMajorFenwick,
+      MarketDataCache::Storage storage = MarketDataCache::Storage::Compact);
+
+  MarketDataRegistry(const MarketDataRegistry &) = delete;
+  MarketDataRegistry &operator=(const MarketDataRegistry &) = delete;
+
+  // --- Mutators ---
+  void insert(std::string_view symbol, const MarketDataEntry &data);
+  void insert(std::string_view symbol, const MarketDataEntryView &data);
+  void insert_batch(std::string_view symbol,
+                    std::span<const MarketDataEntry> batch);
+  void insert_batch(std::string_view symbol,
+                    std::span<const MarketDataEntryView> batch);
+
+  // --- Lookup ---
+  // Returns the cache for `symbol`, creating an empty one if needed.
+  MarketDataCache &get_or_create(std::string_view symbol);
+  // Returns nullptr if `symbol` has never been inserted.
+  const MarketDataCache *find(std::string_view symbol) const;
+
+  size_t size() const;
+  size_t num_shards() const { return shards_.size(); }
+
+  // --- Cross-symbol queries (parallel fan-out) ---
+  std::vector<int64_t> count_range(std::span<const std::string> symbols,
+                                   int64_t start_time, int64_t end_time) const;
+  std::vector<double> min_spread(std::span<const std::string> symbols,
+                                 int64_t start_time, int64_t end_time) const;
+  std::vector<double> max_spread(std::span<const std::string> symbols,
+                                 int64_t start_time, int64_t end_time) const;
+  std::vector<std::tuple<double, double, double>>
+  spread_percentiles(std::span<const std::string> symbols, int64_t start_time,
+                     int64_t end_time) const;
+
+  // Generic fan-out: out[i] = fn(cache-or-null for symbols[i]).
+  template <typename R>
+  std::vector<R> query(std::span<const std::string> symbols,
+                       const std::function<R(const MarketDataCache *)> &fn) const;
+
+private:
+  struct StringHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const {
+      return std::hash<std::string_view>{}(s);
+    }
+  };
+
+  // One cache line per shard header so neighbouring shard locks don't
+  // false-share.
+  struct alignas(64) Shard {
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<MarketDataCache>,
+                       StringHash, std::equal_to<>>
+        caches;
+  };
+
+  double hist_min_;
+  double hist_max_;
+  MarketDataCache::HistIndex hist_index_;
+  MarketDataCache::Storage storage_;
+  std::vector<Shard> shards_;
+
+  size_t shard_of(std::string_view symbol) const {
+    return StringHash{}(symbol) % shards_.size();
+  }
+};
+
+template <typename R>
+std::vector<R> MarketDataRegistry::query(
+    std::span<const std::string> symbols,
+    const std::function<R(const MarketDataCache *)> &fn) const {
+  // Tasks write neighbouring results concurrently, which vector<bool>'s
+  // packed bits cannot take; bools are collected as bytes instead.
+  using Slot = std::conditional_t<std::is_same_v<R, bool>, unsigned char, R>;
+  std::vector<Slot> out(symbols.size());
+
+  // Bucket symbol positions by shard; shards are then dealt round-robin to
+  // at most as many tasks as the shared pool runs at once. A single symbol
+  // never leaves the calling thread.
+  std::vector<std::vector<size_t>> by_shard(shards_.size());
+  for (size_t i = 0; i < symbols.size(); ++i)
+    by_shard[shard_of(symbols[i])].push_back(i);
+
+  WorkerPool &pool = WorkerPool::shared();
+  size_t num_tasks = std::min({shards_.size(), symbols.size(),
+                               static_cast<size_t>(pool.concurrency())});
+  pool.run(static_cast<unsigned>(num_tasks), [&](unsigned t) {
+    for (size_t s = t; s < shards_.size(); s += num_tasks) {
+      const Shard &shard = shards_[s];
+      for (size_t i : by_shard[s]) {
+        const MarketDataCache *cache = nullptr;
+        {
+          std::shared_lock<std::shared_mutex> lock(shard.mutex);
+          auto it = shard.caches.find(std::string_view(symbols[i]));
+          if (it != shard.caches.end())
+            cache = it->second.get();
+        }
+        out[i] = fn(cache);
+      }
+    }
+  });
+  if constexpr (std::is_same_v<R, bool>)
+    return std::vector<bool>(out.begin(), out.end());
+  else
+    return out;
+}
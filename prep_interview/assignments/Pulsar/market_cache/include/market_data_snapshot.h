@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// ---- Snapshot file layout ---------------------------------------------------
+
+// A snapshot is a header followed by four sections, each starting on a
+// SNAPSHOT_ALIGN boundary so a read-only mapping of the file can be used in
+// place:
+//
+//   buckets   num_buckets x SnapshotBucket<NumHistBins>, by local index
+//   spreads   num_spreads doubles; bucket i owns
+//             [spreads_begin, spreads_begin + entry_count)
+//   seg       num_seg_nodes x SnapshotSegNode, the segment tree as stored
+//   fenwick   num_fenwick_cells int32 in the cache's HistIndex cell order
+//
+// Offsets are in bytes from the start of the file. Everything is native
+// byte order; byte_order tells a reader on another platform to give up. The
+// geometry fields must match the loading cache type exactly.
+inline constexpr char SNAPSHOT_MAGIC[8] = {'M', 'D', 'C', 'S', 'N', 'A', 'P', 0};
+inline constexpr uint32_t SNAPSHOT_VERSION = 1;
+inline constexpr uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+inline constexpr size_t SNAPSHOT_ALIGN = 64;
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+
+  // Geometry and configuration.
+  int64_t bucket_ns;
+  int32_t num_buckets;
+  int32_t num_hist_bins;
+  int32_t hist_index; // MarketDataCacheBase::HistIndex
+  int32_t storage;    // MarketDataCacheBase::Storage
+  double hist_min;
+  double hist_bin_width;
+
+  // Window bookkeeping.
+  int64_t total_count;
+  int64_t window_start_abs;
+  int64_t window_end_abs;
+
+  // Sections.
+  uint64_t buckets_offset;
+  uint64_t num_buckets_saved;
+  uint64_t spreads_offset;
+  uint64_t num_spreads;
+  uint64_t seg_offset;
+  uint64_t num_seg_nodes;
+  uint64_t fenwick_offset;
+  uint64_t num_fenwick_cells;
+  uint64_t file_size;
+};
+
+template <int NumHistBins> struct SnapshotBucket {
+  int32_t local;
+  int32_t reserved;
+  int64_t abs_index;
+  int64_t entry_count;
+  double min_spread;
+  double max_spread;
+  uint64_t spreads_begin;
+  int32_t hist[NumHistBins];
+};
+
+struct SnapshotSegNode {
+  int64_t count;
+  double min_spread;
+  double max_spread;
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+// ---- Rollup ring ------------------------------------------------------------
+
+// Ring of num_buckets cells of bucket_ns each that holds pre-aggregated spread
+// stats (count, min, max and a NumHistBins-bin histogram) instead of ticks.
+// Cells are absorbed in time order: a cell newer than the ring can hold
+// evicts the oldest cells first, handing each one to a callback so the
+// caller can cascade it into a coarser ring.
+//
+// A segment tree (count / min / max) and a Fenwick tree of histogram rows
+// over the slots answer a range in O(log num_buckets), whatever its length.
+// Not thread-safe: the owner serialises writers against readers.
+template <int NumHistBins> class RollupRing {
+public:
+  using Row = std::array<int32_t, NumHistBins>;
+
+  struct Cell {
+    int64_t start = 0; // ns, first instant covered
+    int64_t count = 0;
+    double min_spread = std::numeric_limits<double>::infinity();
+    double max_spread = -std::numeric_limits<double>::infinity();
+    Row hist{};
+
+    // Fold `other` in, ignoring its start.
+    void merge(const Cell &other) {
+      count += other.count;
+      min_spread = std::min(min_spread, other.min_spread);
+      max_spread = std::max(max_spread, other.max_spread);
+      for (int b = 0; b < NumHistBins; ++b)
+        hist[b] += other.hist[b];
+    }
+  };
+
+  RollupRing(int64_t bucket_ns, int num_buckets)
+      : bucket_ns_(bucket_ns), num_buckets_(num_buckets) {
+    if (bucket_ns <= 0 || num_buckets <= 0)
+      throw std::invalid_argument("Invalid rollup tier");
+    leaves_ = 1;
+    while (leaves_ < num_buckets_)
+      leaves_ <<= 1;
+    cells_.resize(num_buckets_);
+    seg_.resize(2 * static_cast<size_t>(leaves_));
+    fenwick_.resize(static_cast<size_t>(num_buckets_) + 1, Row{});
+  }
+
+  int64_t bucket_ns() const { return bucket_ns_; }
+  int num_buckets() const { return num_buckets_; }
+  bool empty() const { return first_ > newest_; }
+
+  // Fold `in` into the cell containing in.start. Returns false, leaving the
+  // ring untouched, if that cell is older than the ring holds.
+  template <typename OnEvict> bool absorb(const Cell &in, OnEvict &&on_evict) {
+    int64_t c = floor_div(in.start, bucket_ns_);
+    if (empty()) {
+      first_ = c;
+      newest_ = c;
+      open_ = Cell{};
+      open_.start = c * bucket_ns_;
+    } else if (c > newest_) {
+      commit(slot(newest_), open_);
+      int64_t new_first = c - num_buckets_ + 1;
+      for (int64_t k = first_; k < new_first && k <= newest_; ++k) {
+        int s = slot(k);
+        if (cells_[s].count > 0)
+          on_evict(cells_[s]);
+        clear_slot(s);
+      }
+      first_ = std::max(first_, new_first);
+      newest_ = c;
+      open_ = Cell{};
+      open_.start = c * bucket_ns_;
+    } else if (c < first_) {
+      return false;
+    }
+
+    if (c == newest_) {
+      open_.merge(in);
+    } else {
+      Cell late = in;
+      late.start = c * bucket_ns_;
+      commit(slot(c), late);
+    }
+    return true;
+  }
+
+  // Fold every cell that overlaps [t0, t1] into `acc`.
+  void query(int64_t t0, int64_t t1, Cell &acc) const {
+    if (empty())
+      return;
+    int64_t c0 = std::max(floor_div(t0, bucket_ns_), first_);
+    int64_t c1 = std::min(floor_div(t1, bucket_ns_), newest_);
+    if (c0 > c1)
+      return;
+    if (c1 == newest_) {
+      acc.merge(open_);
+      --c1;
+    }
+    if (c0 > c1)
+      return;
+    if (c1 - c0 + 1 >= num_buckets_) {
+      query_slots(0, num_buckets_ - 1, acc);
+      return;
+    }
+    int sl = slot(c0), el = slot(c1);
+    if (sl <= el) {
+      query_slots(sl, el, acc);
+    } else {
+      query_slots(sl, num_buckets_ - 1, acc);
+      query_slots(0, el, acc);
+    }
+  }
+
+  // Drop every cell that ends at or before `time`.
+  void drop_up_to(int64_t time) {
+    if (empty())
+      return;
+    int64_t new_first = floor_div(time, bucket_ns_);
+    if (time - new_first * bucket_ns_ == bucket_ns_ - 1)
+      ++new_first; // `time` is the last instant of its cell
+    for (int64_t k = first_; k < new_first && k < newest_; ++k)
+      clear_slot(slot(k));
+    if (new_first > newest_) {
+      first_ = INT64_MAX;
+      newest_ = INT64_MIN;
+      open_ = Cell{};
+    } else {
+      first_ = std::max(first_, new_first);
+    }
+  }
+
+  size_t memory_usage() const {
+    return cells_.capacity() * sizeof(Cell) + seg_.capacity() * sizeof(Node) +
+           fenwick_.capacity() * sizeof(Row);
+  }
+
+private:
+  struct Node {
+    int64_t count = 0;
+    double min_spread = std::numeric_limits<double>::infinity();
+    double max_spread = -std::numeric_limits<double>::infinity();
+  };
+
+  int64_t bucket_ns_;
+  int num_buckets_;
+  int leaves_;
+  int64_t first_ = INT64_MAX; // cell indices held: [first_, newest_]
+  int64_t newest_ = INT64_MIN;
+  // The newest cell is staged here, outside the trees, so the run of
+  // absorbs into it costs one row add each; it is committed to its slot
+  // once a newer cell arrives.
+  Cell open_;
+  std::vector<Cell> cells_;
+  std::vector<Node> seg_;    // bottom-up, leaves at leaves_
+  std::vector<Row> fenwick_; // 1-based
+
+  static int64_t floor_div(int64_t a, int64_t b) {
+    return a / b - ((a % b != 0) && (a < 0));
+  }
+  int slot(int64_t c) const {
+    int64_t s = c % num_buckets_;
+    return static_cast<int>(s < 0 ? s + num_buckets_ : s);
+  }
+
+  // Fold `in` into slot s and both trees.
+  void commit(int s, const Cell &in) {
+    if (in.count == 0)
+      return;
+    if (cells_[s].count == 0)
+      cells_[s].start = in.start;
+    cells_[s].merge(in);
+    fw_add(s, in.hist, +1);
+    seg_set(s);
+  }
+
+  void clear_slot(int s) {
+    if (cells_[s].count == 0)
+      return;
+    fw_add(s, cells_[s].hist, -1);
+    cells_[s] = Cell{};
+    seg_set(s);
+  }
+
+  void seg_set(int s) {
+    int i = leaves_ + s;
+    seg_[i] = {cells_[s].count, cells_[s].min_spread, cells_[s].max_spread};
+    for (i >>= 1; i >= 1; i >>= 1) {
+      const Node &a = seg_[2 * i], &b = seg_[2 * i + 1];
+      seg_[i] = {a.count + b.count, std::min(a.min_spread, b.min_spread),
+                 std::max(a.max_spread, b.max_spread)};
+    }
+  }
+
+  void fw_add(int s, const Row &row, int sign) {
+    for (int i = s + 1; i <= num_buckets_; i += i & (-i))
+      for (int b = 0; b < NumHistBins; ++b)
+        fenwick_[i][b] += sign * row[b];
+  }
+  // Histogram of slots [0, s) into `out` with `sign`.
+  void fw_prefix(int s, Row &out, int sign) const {
+    for (int i = s; i > 0; i -= i & (-i))
+      for (int b = 0; b < NumHistBins; ++b)
+        out[b] += sign * fenwick_[i][b];
+  }
+
+  void query_slots(int l, int r, Cell &acc) const {
+    for (int lo = l + leaves_, hi = r + leaves_ + 1; lo < hi;
+         lo >>= 1, hi >>= 1) {
+      if (lo & 1)
+        fold(seg_[lo++], acc);
+      if (hi & 1)
+        fold(seg_[--hi], acc);
+    }
+    fw_prefix(r + 1, acc.hist, +1);
+    fw_prefix(l, acc.hist, -1);
+  }
+  static void fold(const Node &n, Cell &acc) {
+    acc.count += n.count;
+    acc.min_spread = std::min(acc.min_spread, n.min_spread);
+    acc.max_spread = std::max(acc.max_spread, n.max_spread);
+  }
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+// ---- Run arena --------------------------------------------------------------
+
+// Bump arena for contiguous runs of T whose length is only known once they
+// end (a level array being parsed): begin_run(), push() each element, then
+// end_run() hands back the run. Runs stay valid until reset(), which rewinds
+// without freeing, so a producer that resets once per batch stops
+// allocating as soon as the arena has grown to its largest batch.
+//
+// A run that outgrows its block moves to the next block big enough for it;
+// runs already handed out never move.
+template <typename T, size_t BLOCK = 4096> class RunArena {
+public:
+  void begin_run() { run_start_ = used_; }
+
+  void push(const T &value) {
+    if (blocks_.empty() || used_ == blocks_[block_].size())
+      next_block(used_ - run_start_ + 1);
+    blocks_[block_][used_++] = value;
+  }
+
+  std::span<const T> end_run() const {
+    if (blocks_.empty())
+      return {};
+    return {blocks_[block_].data() + run_start_, used_ - run_start_};
+  }
+
+  // Forget every run; memory is kept for reuse.
+  void reset() {
+    block_ = 0;
+    used_ = 0;
+    run_start_ = 0;
+  }
+
+  size_t memory_usage() const {
+    size_t bytes = blocks_.capacity() * sizeof(std::vector<T>);
+    for (auto &b : blocks_)
+      bytes += b.capacity() * sizeof(T);
+    return bytes;
+  }
+
+private:
+  std::vector<std::vector<T>> blocks_; // sized once, never resized
+  size_t block_ = 0;
+  size_t used_ = 0; // elements used in blocks_[block_]
+  size_t run_start_ = 0;
+
+  // Continue the open run (need - 1 elements so far) in a block with room
+  // for `need`: the next block if it is big enough, else a new one inserted
+  // after the current block.
+  void next_block(size_t need) {
+    size_t open = need - 1;
+    size_t next = blocks_.empty() ? 0 : block_ + 1;
+    if (next == blocks_.size() || blocks_[next].size() < need)
+      blocks_.insert(blocks_.begin() + static_cast<std::ptrdiff_t>(next),
+                     std::vector<T>(std::max(BLOCK, 2 * need)));
+    if (open > 0)
+      std::copy_n(blocks_[block_].begin() + static_cast<std::ptrdiff_t>(
+                                                run_start_),
+                  open, blocks_[next].begin());
+    block_ = next;
+    used_ = open;
+    run_start_ = 0;
+  }
+};
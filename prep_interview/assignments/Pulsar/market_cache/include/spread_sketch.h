@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+// ---- Log mapping ------------------------------------------------------------
+
+// DDSketch-style mapping with relative accuracy alpha: a magnitude x > 0 goes
+// to key ceil(log_gamma(x)), gamma = (1 + alpha) / (1 - alpha), and key k
+// reads back as 2 gamma^k / (gamma + 1), which is within a factor
+// (1 +- alpha) of every magnitude mapped to k. Keys follow the data, so there
+// is no range to configure.
+class SketchMapping {
+public:
+  // Magnitudes below this are counted as zero.
+  static constexpr double MIN_MAGNITUDE = 1e-12;
+
+  explicit SketchMapping(double alpha) : alpha_(alpha) {
+    if (!(alpha > 0.0 && alpha < 1.0))
+      throw std::invalid_argument("Sketch accuracy must be in (0, 1)");
+    gamma_ = (1.0 + alpha) / (1.0 - alpha);
+    log_gamma_ = std::log(gamma_);
+  }
+
+  double alpha() const { return alpha_; }
+
+  int key(double magnitude) const {
+    // Clamped so that inf cannot overflow the cast.
+    double k = std::ceil(std::log(magnitude) / log_gamma_);
+    return static_cast<int>(std::clamp(k, -1e9, 1e9));
+  }
+  double value(int key) const {
+    return 2.0 * std::exp(key * log_gamma_) / (gamma_ + 1.0);
+  }
+
+private:
+  double alpha_;
+  double gamma_;
+  double log_gamma_;
+};
+
+// ---- Key store --------------------------------------------------------------
+
+// Counts per key, dense over [offset, offset + size). Counts are signed so a
+// store can be subtracted from another (Fenwick range = prefix - prefix);
+// the range only ever grows until clear().
+class SketchStore {
+public:
+  bool empty() const { return counts_.empty(); }
+  int offset() const { return offset_; }
+  size_t size() const { return counts_.size(); }
+  int32_t operator[](size_t i) const { return counts_[i]; }
+  size_t capacity() const { return counts_.capacity(); }
+
+  void add(int key, int32_t delta) {
+    grow(key, key);
+    counts_[key - offset_] += delta;
+  }
+
+  void add(const SketchStore &other, int sign) {
+    if (other.empty())
+      return;
+    grow(other.offset_, other.offset_ + static_cast<int>(other.size()) - 1);
+    int32_t *dst = counts_.data() + (other.offset_ - offset_);
+    for (size_t i = 0; i < other.size(); ++i)
+      dst[i] += sign * other.counts_[i];
+  }
+
+  void clear() { counts_.clear(); }
+  void release() { std::vector<int32_t>().swap(counts_); }
+
+private:
+  int offset_ = 0;
+  std::vector<int32_t> counts_;
+
+  void grow(int lo, int hi) {
+    if (counts_.empty()) {
+      offset_ = lo;
+      counts_.assign(static_cast<size_t>(hi - lo) + 1, 0);
+      return;
+    }
+    int top = offset_ + static_cast<int>(counts_.size()) - 1;
+    if (lo < offset_) {
+      counts_.insert(counts_.begin(), static_cast<size_t>(offset_ - lo), 0);
+      offset_ = lo;
+    }
+    if (hi > top)
+      counts_.resize(counts_.size() + static_cast<size_t>(hi - top), 0);
+  }
+};
+
+// ---- Sketch -----------------------------------------------------------------
+
+// Mergeable relative-error quantile sketch of a multiset of doubles of either
+// sign: one store for positive magnitudes, one for negative ones, and a zero
+// count. Every rank reads back within a factor (1 +- alpha) of the exact
+// value at that rank. The mapping is passed in rather than stored so that
+// thousands of sketches can share one.
+class SpreadSketch {
+public:
+  int64_t count() const { return count_; }
+
+  void add(const SketchMapping &m, double x, int32_t delta = 1) {
+    if (x > SketchMapping::MIN_MAGNITUDE)
+      pos_.add(m.key(x), delta);
+    else if (x < -SketchMapping::MIN_MAGNITUDE)
+      neg_.add(m.key(-x), delta);
+    else
+      zero_ += delta;
+    count_ += delta;
+  }
+
+  // this += sign * other.
+  void merge(const SpreadSketch &other, int sign = 1) {
+    pos_.add(other.pos_, sign);
+    neg_.add(other.neg_, sign);
+    zero_ += sign * other.zero_;
+    count_ += sign * other.count_;
+  }
+
+  void clear() {
+    pos_.clear();
+    neg_.clear();
+    zero_ = 0;
+    count_ = 0;
+  }
+  // clear() and give the stores' memory back.
+  void release() {
+    clear();
+    pos_.release();
+    neg_.release();
+  }
+
+  // Value at 1-based rank in [1, count()], NaN outside. Ranks run through the
+  // negatives (largest magnitude first), then zeros, then the positives.
+  double value_at_rank(const SketchMapping &m, int64_t rank) const {
+    int64_t acc = 0;
+    for (size_t i = neg_.size(); i-- > 0;) {
+      acc += neg_[i];
+      if (acc >= rank)
+        return -m.value(neg_.offset() + static_cast<int>(i));
+    }
+    acc += zero_;
+    if (acc >= rank)
+      return 0.0;
+    for (size_t i = 0; i < pos_.size(); ++i) {
+      acc += pos_[i];
+      if (acc >= rank)
+        return m.value(pos_.offset() + static_cast<int>(i));
+    }
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+
+  // Heap bytes held by the stores.
+  size_t memory_usage() const {
+    return (pos_.capacity() + neg_.capacity()) * sizeof(int32_t);
+  }
+
+private:
+  SketchStore pos_;
+  SketchStore neg_;
+  int64_t zero_ = 0;
+  int64_t count_ = 0;
+};
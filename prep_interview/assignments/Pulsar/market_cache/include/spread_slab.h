@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// ---- Spread slab ------------------------------------------------------------
+
+// Backing store for many append-only lists of doubles (one per bucket).
+// Memory comes in PAGE_DOUBLES pages (4 KB) that are carved into segments of
+// one size class each: 8, 16, ... 512 doubles. A list is a chain of
+// segments of 8, 8, 16, 32, ... doubles, up to a page each: capacity
+// doubles like a vector's, a bucket with one tick costs a cache line, and a
+// busy one mostly reads whole pages. Cleared lists hand
+// their segments back to per-class free lists; pages are kept until
+// reset(true), so once the window has filled, appends do not allocate.
+//
+// reset() drops every list at once: lists remember the generation they were
+// built in, and a list from an older generation reads as empty and clears
+// in O(1). Not thread-safe: the owner serialises writers against readers.
+class SpreadSlab {
+public:
+  static constexpr uint32_t PAGE_DOUBLES = 512;
+  static constexpr uint32_t MIN_SEGMENT = 8;
+  static constexpr int NUM_CLASSES = 7; // MIN_SEGMENT << 6 == PAGE_DOUBLES
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  struct List {
+    uint32_t head = NONE;
+    uint32_t tail = NONE;
+    uint32_t size = 0;
+    uint32_t segments = 0;
+    uint32_t tail_free = 0; // unused slots in the tail segment
+    double *cursor = nullptr; // next slot in the tail segment
+    uint64_t generation = 0;
+  };
+
+  SpreadSlab() = default;
+  SpreadSlab(SpreadSlab &&) noexcept = default;
+  SpreadSlab &operator=(SpreadSlab &&) noexcept = default;
+
+  size_t size(const List &list) const { return live(list) ? list.size : 0; }
+
+  // `list` must be empty or from the current generation (a list is
+  // cleared before its bucket is reused, so this always holds).
+  void push_back(List &list, double value) {
+    if (list.tail_free == 0)
+      grow(list);
+    *list.cursor++ = value;
+    --list.tail_free;
+    ++list.size;
+  }
+
+  // Replace the contents of `list` with [values, values + n).
+  void assign(List &list, const double *values, size_t n) {
+    clear(list);
+    while (n > 0) {
+      grow(list);
+      uint32_t k = static_cast<uint32_t>(
+          std::min<size_t>(n, segment_size(list.segments - 1)));
+      list.cursor = std::copy_n(values, k, list.cursor);
+      list.tail_free -= k;
+      list.size += k;
+      values += k;
+      n -= k;
+    }
+  }
+
+  void clear(List &list) {
+    if (live(list)) {
+      uint32_t seg = list.head;
+      for (uint32_t i = 0; i < list.segments; ++i) {
+        uint32_t next = next_[seg];
+        free_[size_class(i)].push_back(seg);
+        seg = next;
+      }
+    }
+    list = List{};
+  }
+
+  // Visit the list as f(const double *run, size_t n), oldest run first.
+  template <typename F> void for_each_run(const List &list, F &&f) const {
+    if (!live(list))
+      return;
+    uint32_t seg = list.head;
+    size_t left = list.size;
+    for (uint32_t i = 0; left > 0; ++i) {
+      size_t n = std::min<size_t>(left, segment_size(i));
+      f(data(seg), n);
+      left -= n;
+      seg = next_[seg];
+    }
+  }
+
+  // Drop every list. Pages are kept for reuse unless `release_pages`.
+  void reset(bool release_pages) {
+    ++generation_;
+    for (auto &f : free_)
+      f.clear();
+    pages_carved_ = 0;
+    if (release_pages) {
+      std::vector<std::unique_ptr<Page>>().swap(pages_);
+      std::vector<uint32_t>().swap(next_);
+      for (auto &f : free_)
+        std::vector<uint32_t>().swap(f);
+    }
+  }
+
+  size_t memory_usage() const {
+    size_t bytes = pages_.capacity() * sizeof(std::unique_ptr<Page>) +
+                   pages_.size() * sizeof(Page) +
+                   next_.capacity() * sizeof(uint32_t);
+    for (auto &f : free_)
+      bytes += f.capacity() * sizeof(uint32_t);
+    return bytes;
+  }
+
+private:
+  struct alignas(64) Page {
+    double values[PAGE_DOUBLES];
+  };
+  static constexpr uint32_t SEGMENTS_PER_PAGE = PAGE_DOUBLES / MIN_SEGMENT;
+
+  // Segments are addressed in MIN_SEGMENT units: page * SEGMENTS_PER_PAGE +
+  // offset / MIN_SEGMENT.
+  std::vector<std::unique_ptr<Page>> pages_;
+  std::vector<uint32_t> next_; // next segment of the same list, by address
+  std::array<std::vector<uint32_t>, NUM_CLASSES> free_;
+  size_t pages_carved_ = 0; // pages_[0, pages_carved_) belong to a class
+  uint64_t generation_ = 0;
+
+  bool live(const List &list) const {
+    return list.segments > 0 && list.generation == generation_;
+  }
+  static int size_class(uint32_t segment_index) {
+    return segment_index == 0 ? 0
+                              : static_cast<int>(std::min<uint32_t>(
+                                    segment_index - 1, NUM_CLASSES - 1));
+  }
+  static uint32_t segment_size(uint32_t segment_index) {
+    return MIN_SEGMENT << size_class(segment_index);
+  }
+  double *data(uint32_t seg) {
+    return pages_[seg / SEGMENTS_PER_PAGE]->values +
+           (seg % SEGMENTS_PER_PAGE) * MIN_SEGMENT;
+  }
+  const double *data(uint32_t seg) const {
+    return pages_[seg / SEGMENTS_PER_PAGE]->values +
+           (seg % SEGMENTS_PER_PAGE) * MIN_SEGMENT;
+  }
+
+  // Append an empty segment of the next size class; tail_free is its size.
+  void grow(List &list) {
+    if (list.segments == 0)
+      list.generation = generation_;
+    int k = size_class(list.segments);
+    if (free_[k].empty())
+      carve(k);
+    uint32_t seg = free_[k].back();
+    free_[k].pop_back();
+    next_[seg] = NONE;
+    if (list.tail == NONE)
+      list.head = seg;
+    else
+      next_[list.tail] = seg;
+    list.tail = seg;
+    list.cursor = data(seg);
+    ++list.segments;
+    list.tail_free = MIN_SEGMENT << k;
+  }
+
+  // Split a fresh page (or one released by reset) into class-k segments.
+  void carve(int k) {
+    if (pages_carved_ == pages_.size()) {
+      pages_.push_back(std::make_unique<Page>());
+      next_.resize(pages_.size() * SEGMENTS_PER_PAGE, NONE);
+    }
+    uint32_t base = static_cast<uint32_t>(pages_carved_++) * SEGMENTS_PER_PAGE;
+    uint32_t step = 1u << k;
+    for (uint32_t s = SEGMENTS_PER_PAGE; s >= step; s -= step)
+      free_[k].push_back(base + s - step);
+  }
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ---- SPSC ring --------------------------------------------------------------
+
+// Bounded single-producer single-consumer queue of trivially copyable T.
+// Capacity is rounded up to a power of two. The two indices sit on their own
+// cache lines and the producer caches the consumer's, so a push touches
+// shared state only when the ring looks full.
+//
+// The consumer copies elements out with peek() and frees their slots with
+// release() once it is done with them, so a producer that watches
+// released() knows its elements have been fully handled.
+template <typename T> class SpscRing {
+public:
+  explicit SpscRing(size_t capacity)
+      : mask_(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1),
+        slots_(mask_ + 1) {}
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // Producer only. Returns false if the ring is full.
+  bool try_push(const T &value) {
+    uint64_t t = tail_.load(std::memory_order_relaxed);
+    if (t - head_cache_ > mask_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (t - head_cache_ > mask_)
+        return false;
+    }
+    slots_[t & mask_] = value;
+    tail_.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only: append up to `max` of the oldest unreleased elements to
+  // `out` and return how many.
+  size_t peek(std::vector<T> &out, size_t max) const {
+    uint64_t h = head_.load(std::memory_order_relaxed);
+    uint64_t t = tail_.load(std::memory_order_acquire);
+    size_t n = static_cast<size_t>(std::min<uint64_t>(t - h, max));
+    size_t at = static_cast<size_t>(h & mask_);
+    size_t first = std::min(n, slots_.size() - at);
+    out.insert(out.end(), slots_.data() + at, slots_.data() + at + first);
+    out.insert(out.end(), slots_.data(), slots_.data() + (n - first));
+    return n;
+  }
+
+  // Consumer only: free the `n` oldest elements.
+  void release(size_t n) {
+    head_.store(head_.load(std::memory_order_relaxed) + n,
+                std::memory_order_release);
+  }
+
+  // Elements ever pushed / released; their difference is the fill.
+  uint64_t pushed() const { return tail_.load(std::memory_order_acquire); }
+  uint64_t released() const { return head_.load(std::memory_order_acquire); }
+
+private:
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  uint64_t head_cache_ = 0; // producer's last view of head_
+  alignas(64) std::atomic<uint64_t> head_{0};
+  alignas(64) const uint64_t mask_;
+  std::vector<T> slots_;
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ---- Worker pool ------------------------------------------------------------
+
+// Fixed set of threads that run fork-join jobs: run(count, f) calls f(0) ..
+// f(count - 1) and returns once all of them have. Threads are started once,
+// so a fan-out costs a queue push and a wake-up instead of a thread launch.
+//
+// The calling thread claims indices of its own job alongside the workers and
+// only ever waits for indices that another thread is already running. A job
+// therefore always completes, even when every worker is busy or f itself
+// calls run() on the same pool. The first exception thrown by f is rethrown
+// from run() after the whole job has finished.
+class WorkerPool {
+public:
+  explicit WorkerPool(unsigned num_threads) {
+    threads_.reserve(num_threads);
+    for (unsigned i = 0; i < num_threads; ++i)
+      threads_.emplace_back([this] { work(); });
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &t : threads_)
+      t.join();
+  }
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  // Process-wide pool sized so that its workers plus a caller fill the
+  // hardware threads. Started on first use.
+  static WorkerPool &shared() {
+    static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()) -
+                           1);
+    return pool;
+  }
+
+  // Threads that can run a job at once: the workers plus the caller.
+  unsigned concurrency() const {
+    return static_cast<unsigned>(threads_.size()) + 1;
+  }
+
+  template <typename F> void run(unsigned count, const F &f) {
+    if (count <= 1 || threads_.empty()) {
+      for (unsigned i = 0; i < count; ++i)
+        f(i);
+      return;
+    }
+    Job job;
+    job.call = [](const void *fn, unsigned i) {
+      (*static_cast<const F *>(fn))(i);
+    };
+    job.fn = &f;
+    job.count = count;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back(&job);
+    }
+    if (count == 2)
+      wake_.notify_one();
+    else
+      wake_.notify_all();
+
+    unsigned ran = drain(job);
+    std::unique_lock<std::mutex> lock(mutex_);
+    job.done += ran;
+    retire(job);
+    done_.wait(lock, [&] { return job.done == count && job.active == 0; });
+    if (job.error)
+      std::rethrow_exception(job.error);
+  }
+
+private:
+  struct Job {
+    void (*call)(const void *, unsigned) = nullptr;
+    const void *fn = nullptr;
+    unsigned count = 0;
+    std::atomic<unsigned> next{0};
+    // Guarded by mutex_.
+    unsigned done = 0;
+    unsigned active = 0;
+    std::exception_ptr error;
+  };
+
+  // Run unclaimed indices of `job` until none are left; returns how many.
+  unsigned drain(Job &job) {
+    unsigned ran = 0;
+    for (unsigned i; (i = job.next.fetch_add(1)) < job.count; ++ran) {
+      try {
+        job.call(job.fn, i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!job.error)
+          job.error = std::current_exception();
+      }
+    }
+    return ran;
+  }
+
+  // Caller holds mutex_. Drops a job with nothing left to claim.
+  void retire(Job &job) {
+    auto it = std::find(jobs_.begin(), jobs_.end(), &job);
+    if (it != jobs_.end())
+      jobs_.erase(it);
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      wake_.wait(lock, [&] { return stop_ || !jobs_.empty(); });
+      if (stop_)
+        return;
+      Job &job = *jobs_.front();
+      if (job.next.load(std::memory_order_relaxed) >= job.count) {
+        jobs_.pop_front();
+        continue;
+      }
+      ++job.active;
+      lock.unlock();
+      unsigned ran = drain(job);
+      lock.lock();
+      job.done += ran;
+      --job.active;
+      retire(job);
+      if (job.done == job.count && job.active == 0)
+        done_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  std::deque<Job *> jobs_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
@@ -13,7 +13,7 @@ int main(int argc, char *argv[]) {
     path = argv[1];
 
   std::printf("Loading %s ...\n", path.c_str());
-  auto cache = MarketDataCache::with_file(path, -5.0, 20.0);
+  auto cache = MarketDataCache::with_file_mmap(path, -5.0, 20.0);
 
   std::printf("Entries loaded: %lld\n", (long long)cache.count());
 
@@ -0,0 +1,523 @@
+// =============================================================================
+// market_data_json.cpp — JSON loaders for market_data.json
+// =============================================================================
+#include "market_data_json.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// =============================================================================
+// Legacy parser  (handles the specific market_data.json format)
+// =============================================================================
+namespace {
+
+void skip_ws(const std::string &s, size_t &i) {
+  while (i < s.size() &&
+         (s[i] == ' ' || s[i] == '\n' || s[i] == '\r' || s[i] == '\t'))
+    ++i;
+}
+
+void expect(const std::string &s, size_t &i, char c) {
+  skip_ws(s, i);
+  if (i >= s.size() || s[i] != c)
+    throw std::runtime_error(std::string("JSON parse: expected '") + c +
+                             "' at pos " + std::to_string(i));
+  ++i;
+}
+
+std::string parse_string(const std::string &s, size_t &i) {
+  skip_ws(s, i);
+  if (i >= s.size() || s[i] != '"')
+    throw std::runtime_error("JSON parse: expected '\"'");
+  ++i;
+  std::string result;
+  while (i < s.size() && s[i] != '"') {
+    if (s[i] == '\\') {
+      ++i;
+      if (i < s.size())
+        result += s[i++];
+    } else
+      result += s[i++];
+  }
+  if (i < s.size())
+    ++i;
+  return result;
+}
+
+double parse_number(const std::string &s, size_t &i) {
+  skip_ws(s, i);
+  size_t start = i;
+  if (i < s.size() && s[i] == '-')
+    ++i;
+  while (i < s.size() && (s[i] >= '0' && s[i] <= '9'))
+    ++i;
+  if (i < s.size() && s[i] == '.') {
+    ++i;
+    while (i < s.size() && (s[i] >= '0' && s[i] <= '9'))
+      ++i;
+  }
+  if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+    ++i;
+    if (i < s.size() && (s[i] == '+' || s[i] == '-'))
+      ++i;
+    while (i < s.size() && (s[i] >= '0' && s[i] <= '9'))
+      ++i;
+  }
+  return std::stod(s.substr(start, i - start));
+}
+
+int64_t parse_int64(const std::string &s, size_t &i) {
+  skip_ws(s, i);
+  size_t start = i;
+  if (i < s.size() && s[i] == '-')
+    ++i;
+  while (i < s.size() && (s[i] >= '0' && s[i] <= '9'))
+    ++i;
+  // Use strtoull to handle large unsigned values that fit in int64_t bits
+  return static_cast<int64_t>(
+      std::strtoull(s.substr(start, i - start).c_str(), nullptr, 10));
+}
+
+PriceLevel parse_price_level(const std::string &s, size_t &i) {
+  PriceLevel pl{};
+  expect(s, i, '{');
+  for (int field = 0; field < 2; ++field) {
+    if (field > 0)
+      expect(s, i, ',');
+    std::string key = parse_string(s, i);
+    expect(s, i, ':');
+    double val = parse_number(s, i);
+    if (key == "price")
+      pl.price = val;
+    else if (key == "amount")
+      pl.amount = val;
+  }
+  expect(s, i, '}');
+  return pl;
+}
+
+std::vector<PriceLevel> parse_price_level_array(const std::string &s,
+                                                size_t &i) {
+  std::vector<PriceLevel> result;
+  expect(s, i, '[');
+  skip_ws(s, i);
+  if (i < s.size() && s[i] == ']') {
+    ++i;
+    return result;
+  }
+  result.push_back(parse_price_level(s, i));
+  while (true) {
+    skip_ws(s, i);
+    if (i >= s.size() || s[i] != ',')
+      break;
+    ++i;
+    result.push_back(parse_price_level(s, i));
+  }
+  expect(s, i, ']');
+  return result;
+}
+
+MarketDataEntry parse_entry(const std::string &s, size_t &i) {
+  MarketDataEntry entry{};
+  expect(s, i, '{');
+  bool first = true;
+  while (true) {
+    skip_ws(s, i);
+    if (i >= s.size() || s[i] == '}')
+      break;
+    if (!first)
+      expect(s, i, ',');
+    first = false;
+    std::string key = parse_string(s, i);
+    expect(s, i, ':');
+    if (key == "utc_epoch_ns") {
+      entry.time = parse_int64(s, i);
+    } else if (key == "bids") {
+      entry.bids = parse_price_level_array(s, i);
+    } else if (key == "asks") {
+      entry.asks = parse_price_level_array(s, i);
+    }
+  }
+  expect(s, i, '}');
+  return entry;
+}
+
+} // anonymous namespace
+
+std::vector<MarketDataEntry> parse_market_data_json(const std::string &json) {
+  std::vector<MarketDataEntry> entries;
+  size_t i = 0;
+  expect(json, i, '{');
+  parse_string(json, i);
+  expect(json, i, ':');
+  expect(json, i, '[');
+  skip_ws(json, i);
+  if (i < json.size() && json[i] == ']') {
+    i++;
+    expect(json, i, '}');
+    return entries;
+  }
+  entries.push_back(parse_entry(json, i));
+  while (true) {
+    skip_ws(json, i);
+    if (i >= json.size() || json[i] != ',')
+      break;
+    ++i;
+    entries.push_back(parse_entry(json, i));
+  }
+  expect(json, i, ']');
+  return entries;
+}
+
+// =============================================================================
+// MappedFile
+// =============================================================================
+
+MappedFile::MappedFile(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Cannot open file: " + path);
+
+  struct stat st {};
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Cannot stat file: " + path);
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_ == 0) {
+    ::close(fd);
+    return;
+  }
+
+  void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); // the mapping keeps its own reference
+  if (p == MAP_FAILED)
+    throw std::runtime_error("Cannot mmap file: " + path);
+  ::madvise(p, size_, MADV_SEQUENTIAL);
+  data_ = static_cast<const char *>(p);
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    ::munmap(const_cast<char *>(data_), size_);
+}
+
+// =============================================================================
+// MarketDataJsonReader  (in place, std::from_chars, no temporaries)
+// =============================================================================
+namespace {
+
+[[noreturn]] void fail(const std::string &what, const char *begin,
+                       const char *p) {
+  throw std::runtime_error("JSON parse: " + what + " at pos " +
+                           std::to_string(p - begin));
+}
+
+inline void skip_ws(const char *&p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+    ++p;
+}
+
+inline void expect(const char *begin, const char *&p, const char *end, char c) {
+  skip_ws(p, end);
+  if (p >= end || *p != c)
+    fail(std::string("expected '") + c + "'", begin, p);
+  ++p;
+}
+
+inline bool consume_null(const char *&p, const char *end) {
+  if (end - p >= 4 && std::memcmp(p, "null", 4) == 0) {
+    p += 4;
+    return true;
+  }
+  return false;
+}
+
+// Keys in this format never contain escapes, so the common case is a single
+// memchr; escaped keys are still skipped correctly, just compared raw.
+std::string_view read_key(const char *begin, const char *&p, const char *end) {
+  expect(begin, p, end, '"');
+  const char *start = p;
+  while (true) {
+    auto *q = static_cast<const char *>(std::memchr(p, '"', end - p));
+    if (!q)
+      fail("unterminated string", begin, start);
+    p = q + 1;
+    // An odd run of backslashes before the quote means it is escaped.
+    size_t slashes = 0;
+    while (q - slashes > start && q[-1 - static_cast<long>(slashes)] == '\\')
+      ++slashes;
+    if (slashes % 2 == 0)
+      return {start, static_cast<size_t>(q - start)};
+  }
+}
+
+double read_double(const char *begin, const char *&p, const char *end) {
+  skip_ws(p, end);
+  if (consume_null(p, end))
+    return std::numeric_limits<double>::quiet_NaN();
+  double v = 0;
+  auto [ptr, ec] = std::from_chars(p, end, v);
+  if (ec != std::errc())
+    fail("bad number", begin, p);
+  p = ptr;
+  return v;
+}
+
+// Returns false for `null`.
+bool read_int64(const char *begin, const char *&p, const char *end,
+                int64_t &out) {
+  skip_ws(p, end);
+  if (consume_null(p, end))
+    return false;
+  std::from_chars_result r;
+  if (p < end && *p == '-') {
+    r = std::from_chars(p, end, out);
+  } else {
+    // Same wrap-around semantics as the strtoull-based legacy parser.
+    uint64_t u = 0;
+    r = std::from_chars(p, end, u);
+    out = static_cast<int64_t>(u);
+  }
+  if (r.ec != std::errc())
+    fail("bad integer", begin, p);
+  p = r.ptr;
+  return true;
+}
+
+// Skip any JSON value (used for unknown keys).
+void skip_value(const char *begin, const char *&p, const char *end) {
+  skip_ws(p, end);
+  if (p >= end)
+    fail("unexpected end", begin, p);
+  if (*p == '"') {
+    read_key(begin, p, end);
+    return;
+  }
+  if (*p != '{' && *p != '[') {
+    while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' &&
+           *p != '\n' && *p != '\r' && *p != '\t')
+      ++p;
+    return;
+  }
+  int depth = 0;
+  while (p < end) {
+    char c = *p;
+    if (c == '"') {
+      read_key(begin, p, end);
+      continue;
+    }
+    ++p;
+    if (c == '{' || c == '[')
+      ++depth;
+    else if ((c == '}' || c == ']') && --depth == 0)
+      return;
+  }
+  fail("unterminated value", begin, p);
+}
+
+// Parse a level array, handing each level to `emit`.
+template <typename Emit>
+void read_levels(const char *begin, const char *&p, const char *end,
+                 Emit &&emit) {
+  expect(begin, p, end, '[');
+  skip_ws(p, end);
+  if (p < end && *p == ']') {
+    ++p;
+    return;
+  }
+  while (true) {
+    PriceLevel pl{std::numeric_limits<double>::quiet_NaN(),
+                  std::numeric_limits<double>::quiet_NaN()};
+    expect(begin, p, end, '{');
+    skip_ws(p, end);
+    if (p < end && *p == '}') {
+      ++p;
+    } else {
+      while (true) {
+        std::string_view key = read_key(begin, p, end);
+        expect(begin, p, end, ':');
+        if (key == "price")
+          pl.price = read_double(begin, p, end);
+        else if (key == "amount")
+          pl.amount = read_double(begin, p, end);
+        else
+          skip_value(begin, p, end);
+        skip_ws(p, end);
+        if (p < end && *p == ',') {
+          ++p;
+          continue;
+        }
+        expect(begin, p, end, '}');
+        break;
+      }
+    }
+    emit(pl);
+    skip_ws(p, end);
+    if (p < end && *p == ',') {
+      ++p;
+      continue;
+    }
+    expect(begin, p, end, ']');
+    return;
+  }
+}
+
+} // anonymous namespace
+
+MarketDataJsonReader::MarketDataJsonReader(const char *begin, const char *end)
+    : begin_(begin), p_(begin), end_(end) {
+  expect(begin_, p_, end_, '{');
+  read_key(begin_, p_, end_);
+  expect(begin_, p_, end_, ':');
+  expect(begin_, p_, end_, '[');
+  skip_ws(p_, end_);
+  if (p_ < end_ && *p_ == ']') {
+    ++p_;
+    done_ = true;
+  }
+}
+
+MarketDataJsonReader::MarketDataJsonReader(const char *doc_begin,
+                                           const char *chunk_begin,
+                                           const char *chunk_end)
+    : begin_(doc_begin), p_(chunk_begin), end_(chunk_end),
+      chunk_end_(chunk_end), done_(chunk_begin >= chunk_end) {}
+
+std::vector<const char *>
+MarketDataJsonReader::split_entries(const char *begin, const char *end,
+                                    size_t max_chunks) {
+  // Locate the array body: first entry (or ']') and the closing ']'.
+  MarketDataJsonReader head(begin, end);
+  const char *first = head.p_;
+  const char *close = end;
+  while (close > first && *(close - 1) != '}')
+    --close;
+  if (close > first)
+    --close; // the document's closing '}'
+  while (close > first && *(close - 1) != ']')
+    --close;
+  if (head.done_ || close <= first)
+    return {first, first};
+  --close; // the array's closing ']'
+
+  constexpr std::string_view key = "\"utc_epoch_ns\"";
+  std::string_view body(first, static_cast<size_t>(close - first));
+
+  std::vector<const char *> bounds{first};
+  if (max_chunks == 0)
+    max_chunks = 1;
+  for (size_t c = 1; c < max_chunks; ++c) {
+    size_t target = body.size() * c / max_chunks;
+    size_t at = body.find(key, target);
+    if (at == std::string_view::npos)
+      break;
+    // Walk back to the '{' that opens the entry owning this key.
+    const char *q = first + at;
+    int depth = 0;
+    while (q > first) {
+      char ch = *--q;
+      if (ch == '}' || ch == ']')
+        ++depth;
+      else if (ch == '[')
+        --depth;
+      else if (ch == '{' && depth-- == 0)
+        break;
+    }
+    if (q > bounds.back())
+      bounds.push_back(q);
+  }
+  bounds.push_back(close);
+  return bounds;
+}
+
+template <typename ReadSide, typename Clear>
+bool MarketDataJsonReader::next_entry(int64_t &time, ReadSide &&read_side,
+                                      Clear &&clear) {
+  while (!done_) {
+    bool has_time = false;
+    clear();
+
+    expect(begin_, p_, end_, '{');
+    skip_ws(p_, end_);
+    if (p_ < end_ && *p_ == '}') {
+      ++p_;
+    } else {
+      while (true) {
+        std::string_view key = read_key(begin_, p_, end_);
+        expect(begin_, p_, end_, ':');
+        if (key == "utc_epoch_ns")
+          has_time = read_int64(begin_, p_, end_, time);
+        else if (key == "bids")
+          read_side(true);
+        else if (key == "asks")
+          read_side(false);
+        else
+          skip_value(begin_, p_, end_);
+        skip_ws(p_, end_);
+        if (p_ < end_ && *p_ == ',') {
+          ++p_;
+          continue;
+        }
+        expect(begin_, p_, end_, '}');
+        break;
+      }
+    }
+
+    skip_ws(p_, end_);
+    if (chunk_end_) {
+      if (p_ < end_ && *p_ == ',')
+        ++p_;
+      skip_ws(p_, end_);
+      done_ = p_ >= chunk_end_;
+    } else if (p_ < end_ && *p_ == ',') {
+      ++p_;
+    } else {
+      expect(begin_, p_, end_, ']');
+      done_ = true;
+    }
+
+    if (has_time)
+      return true;
+  }
+  return false;
+}
+
+bool MarketDataJsonReader::next(MarketDataEntry &entry) {
+  auto read_side = [&](bool bid) {
+    auto &out = bid ? entry.bids : entry.asks;
+    out.clear();
+    read_levels(begin_, p_, end_,
+                [&](const PriceLevel &pl) { out.push_back(pl); });
+  };
+  auto clear = [&] {
+    entry.bids.clear();
+    entry.asks.clear();
+  };
+  return next_entry(entry.time, read_side, clear);
+}
+
+bool MarketDataJsonReader::next(MarketDataEntryView &entry,
+                                RunArena<PriceLevel> &arena) {
+  auto read_side = [&](bool bid) {
+    arena.begin_run();
+    read_levels(begin_, p_, end_,
+                [&](const PriceLevel &pl) { arena.push(pl); });
+    (bid ? entry.bids : entry.asks) = arena.end_run();
+  };
+  auto clear = [&] {
+    entry.bids = {};
+    entry.asks = {};
+  };
+  return next_entry(entry.time, read_side, clear);
+}
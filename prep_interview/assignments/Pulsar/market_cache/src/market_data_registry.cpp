@@ -0,0 +1,125 @@
+// =============================================================================
+// market_data_registry.cpp — sharded symbol -> MarketDataCache registry
+// =============================================================================
+#include "market_data_registry.h"
+
+#include <limits>
+#include <mutex>
+
+MarketDataRegistry::MarketDataRegistry(size_t num_shards, double hist_min,
+                                       double hist_max,
+                                       MarketDataCache::HistIndex hist_index,
+                                       MarketDataCache::Storage storage)
+    : hist_min_(hist_min), hist_max_(hist_max), hist_index_(hist_index),
+      storage_(storage),
+      shards_(num_shards
+                  ? num_shards
+                  : 4 * std::max(1u, std::thread::hardware_concurrency())) {
+  // Validate the histogram range once up front rather than on first insert.
+  MarketDataCache probe(hist_min_, hist_max_, hist_index_, storage_);
+}
+
+// =============================================================================
+// Lookup
+// =============================================================================
+
+MarketDataCache &MarketDataRegistry::get_or_create(std::string_view symbol) {
+  Shard &shard = shards_[shard_of(symbol)];
+  {
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.caches.find(symbol);
+    if (it != shard.caches.end())
+      return *it->second;
+  }
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  auto &slot = shard.caches[std::string(symbol)];
+  if (!slot)
+    slot = std::make_unique<MarketDataCache>(hist_min_, hist_max_,
+                                             hist_index_, storage_);
+  return *slot;
+}
+
+const MarketDataCache *
+MarketDataRegistry::find(std::string_view symbol) const {
+  const Shard &shard = shards_[shard_of(symbol)];
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.caches.find(symbol);
+  return it == shard.caches.end() ? nullptr : it->second.get();
+}
+
+size_t MarketDataRegistry::size() const {
+  size_t n = 0;
+  for (auto &shard : shards_) {
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    n += shard.caches.size();
+  }
+  return n;
+}
+
+// =============================================================================
+// Mutators
+// =============================================================================
+
+void MarketDataRegistry::insert(std::string_view symbol,
+                                const MarketDataEntry &data) {
+  get_or_create(symbol).insert(data);
+}
+
+void MarketDataRegistry::insert(std::string_view symbol,
+                                const MarketDataEntryView &data) {
+  get_or_create(symbol).insert(data);
+}
+
+void MarketDataRegistry::insert_batch(std::string_view symbol,
+                                      std::span<const MarketDataEntry> batch) {
+  get_or_create(symbol).insert_batch(batch);
+}
+
+void MarketDataRegistry::insert_batch(
+    std::string_view symbol, std::span<const MarketDataEntryView> batch) {
+  get_or_create(symbol).insert_batch(batch);
+}
+
+// =============================================================================
+// Cross-symbol queries
+// =============================================================================
+
+std::vector<int64_t>
+MarketDataRegistry::count_range(std::span<const std::string> symbols,
+                                int64_t start_time, int64_t end_time) const {
+  return query<int64_t>(symbols, [&](const MarketDataCache *c) -> int64_t {
+    return c ? c->count_range(start_time, end_time) : 0;
+  });
+}
+
+std::vector<double>
+MarketDataRegistry::min_spread(std::span<const std::string> symbols,
+                               int64_t start_time, int64_t end_time) const {
+  return query<double>(symbols, [&](const MarketDataCache *c) {
+    return c ? c->min_spread(start_time, end_time)
+             : std::numeric_limits<double>::quiet_NaN();
+  });
+}
+
+std::vector<double>
+MarketDataRegistry::max_spread(std::span<const std::string> symbols,
+                               int64_t start_time, int64_t end_time) const {
+  return query<double>(symbols, [&](const MarketDataCache *c) {
+    return c ? c->max_spread(start_time, end_time)
+             : std::numeric_limits<double>::quiet_NaN();
+  });
+}
+
+std::vector<std::tuple<double, double, double>>
+MarketDataRegistry::spread_percentiles(std::span<const std::string> symbols,
+                                       int64_t start_time,
+                                       int64_t end_time) const {
+  using Pctls = std::tuple<double, double, double>;
+  return query<Pctls>(symbols, [&](const MarketDataCache *c) -> Pctls {
+    if (!c) {
+      double nan = std::numeric_limits<double>::quiet_NaN();
+      return {nan, nan, nan};
+    }
+    return c->spread_percentiles(start_time, end_time);
+  });
+}
@@ -2,18 +2,34 @@
 // test_cache.cpp — correctness and performance tests
 // =============================================================================
 #include "market_data_cache.h"
-
+#include "market_data_cache_impl.h"
+#include "market_data_ingestor.h"
+#include "market_data_json.h"
+#include "market_data_registry.h"
+#include "market_data_snapshot.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <climits>
 #include <cmath>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <new>
 #include <numeric>
 #include <random>
+#include <span>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 // ---------------------------------------------------------------------------
@@ -29,6 +45,101 @@ MarketDataEntry make_entry(int64_t time_ns, double bid, double ask) {
   return e;
 }
 
+// Heap allocations made through operator new, for asserting that a path
+// allocates nothing. Every throwing form of new and delete is replaced
+// (plain, array, sized and over-aligned), so each pair meets in
+// count_alloc / release_alloc. Those stay out of line so the compiler never
+// sees a new-expression's pointer reach free().
+std::atomic<int64_t> g_allocations{0};
+
+[[gnu::noinline]] void *count_alloc(size_t size, size_t align) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  size = size ? size : 1;
+  void *p = align <= alignof(std::max_align_t)
+                ? std::malloc(size)
+                : std::aligned_alloc(align, (size + align - 1) / align * align);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+[[gnu::noinline]] void release_alloc(void *p) noexcept { std::free(p); }
+
+void *operator new(size_t size) { return count_alloc(size, 0); }
+void *operator new[](size_t size) { return count_alloc(size, 0); }
+void *operator new(size_t size, std::align_val_t al) {
+  return count_alloc(size, static_cast<size_t>(al));
+}
+void *operator new[](size_t size, std::align_val_t al) {
+  return count_alloc(size, static_cast<size_t>(al));
+}
+void operator delete(void *p) noexcept { release_alloc(p); }
+void operator delete[](void *p) noexcept { release_alloc(p); }
+void operator delete(void *p, size_t) noexcept { release_alloc(p); }
+void operator delete[](void *p, size_t) noexcept { release_alloc(p); }
+void operator delete(void *p, std::align_val_t) noexcept { release_alloc(p); }
+void operator delete[](void *p, std::align_val_t) noexcept {
+  release_alloc(p);
+}
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  release_alloc(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  release_alloc(p);
+}
+
+// Write a synthetic {"market_data_entries": [...]} file with `levels` bids and
+// asks per entry, laid out like market_data.json. Returns the file size.
+size_t write_synthetic_json(const std::string &path, int n_entries,
+                            int levels, uint64_t seed = 7) {
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<double> spread_dist(0.5, 8.0);
+  std::uniform_real_distribution<double> amt_dist(1.0, 1e5);
+  int64_t t = 1'731'496'040'000'000'000LL;
+
+  FILE *f = std::fopen(path.c_str(), "w");
+  if (!f)
+    return 0;
+  std::fprintf(f, "{\n    \"market_data_entries\": [\n");
+  for (int i = 0; i < n_entries; ++i) {
+    t += 50'000'000LL + static_cast<int64_t>(rng() % 100'000'000ULL);
+    double mid = 64'900.0 + (rng() % 1000) * 0.01;
+    double half = spread_dist(rng) / 2;
+    std::fprintf(f, "        {\n            \"utc_epoch_ns\": %lld,\n",
+                 (long long)t);
+    for (int side = 0; side < 2; ++side) {
+      std::fprintf(f, "            \"%s\": [\n", side == 0 ? "bids" : "asks");
+      for (int l = 0; l < levels; ++l) {
+        double px = side == 0 ? mid - half - l * 0.1 : mid + half + l * 0.1;
+        std::fprintf(f,
+                     "                {\n                    \"price\": %.17g,"
+                     "\n                    \"amount\": %.17g\n"
+                     "                }%s\n",
+                     px, amt_dist(rng), l + 1 < levels ? "," : "");
+      }
+      std::fprintf(f, "            ]%s\n", side == 0 ? "," : "");
+    }
+    std::fprintf(f, "        }%s\n", i + 1 < n_entries ? "," : "");
+  }
+  std::fprintf(f, "    ]\n}\n");
+  std::fclose(f);
+  return std::filesystem::file_size(path);
+}
+
+// Element-wise equality that treats NaN == NaN (empty-range results).
+bool same_pctls(const std::tuple<double, double, double> &a,
+                const std::tuple<double, double, double> &b) {
+  auto eq = [](double x, double y) {
+    return x == y || (std::isnan(x) && std::isnan(y));
+  };
+  return eq(std::get<0>(a), std::get<0>(b)) &&
+         eq(std::get<1>(a), std::get<1>(b)) &&
+         eq(std::get<2>(a), std::get<2>(b));
+}
+
+std::string temp_path(const char *name) {
+  return (std::filesystem::temp_directory_path() / name).string();
+}
+
 template <typename F> double bench_us(F &&f, int iterations = 1) {
   auto t0 = std::chrono::high_resolution_clock::now();
   for (int i = 0; i < iterations; ++i)
@@ -38,6 +149,19 @@ template <typename F> double bench_us(F &&f, int iterations = 1) {
   return total / iterations;
 }
 
+// Time `f(i)` individually for i in [0, n) and return {p50, p99} in ns.
+template <typename F> std::pair<double, double> latency_p50_p99(F &&f, int n) {
+  std::vector<double> ns(n);
+  for (int i = 0; i < n; ++i) {
+    auto t0 = std::chrono::steady_clock::now();
+    f(i);
+    auto t1 = std::chrono::steady_clock::now();
+    ns[i] = std::chrono::duration<double, std::nano>(t1 - t0).count();
+  }
+  std::sort(ns.begin(), ns.end());
+  return {ns[n / 2], ns[std::min(n - 1, n * 99 / 100)]};
+}
+
 #define CHECK(expr)                                                            \
   do {                                                                         \
     if (!(expr)) {                                                             \
@@ -237,7 +361,7 @@ void test_json_load(const std::string &path) {
   std::printf("  test_json_load(%s) ... ", path.c_str());
 
   try {
-    auto cache = MarketDataCache::with_file(path, -5.0, 20.0);
+    auto cache = MarketDataCache::with_file_mmap(path, -5.0, 20.0);
     int64_t c = cache.count();
     std::printf("loaded %lld entries. ", (long long)c);
     if (c > 0) {
@@ -257,130 +381,3256 @@ void test_json_load(const std::string &path) {
 }
 
 // ---------------------------------------------------------------------------
-// Performance benchmark
+// Test 10: mmap loader matches the legacy loader
 // ---------------------------------------------------------------------------
-void benchmark_performance() {
-  std::printf("\n=== Performance Benchmark ===\n");
+void test_mmap_loader() {
+  std::printf("  test_mmap_loader ... ");
+
+  std::string path = temp_path("market_cache_mmap_test.json");
+  write_synthetic_json(path, 5'000, 5);
+
+  auto legacy = MarketDataCache::with_file(path, 0.0, 10.0);
+  auto mapped = MarketDataCache::with_file_mmap(path, 0.0, 10.0);
+  std::filesystem::remove(path);
+
+  int64_t huge = INT64_MAX;
+  CHECK(mapped.count() == 5'000);
+  CHECK(mapped.count() == legacy.count());
+  CHECK(mapped.min_spread(0, huge) == legacy.min_spread(0, huge));
+  CHECK(mapped.max_spread(0, huge) == legacy.max_spread(0, huge));
+  CHECK(mapped.spread_percentiles(0, huge) ==
+        legacy.spread_percentiles(0, huge));
+  CHECK(mapped.spread_percentiles_exact(0, huge) ==
+        legacy.spread_percentiles_exact(0, huge));
+
+  // nulls: a null amount is kept (NaN), a null timestamp drops the entry.
+  const char doc[] = R"({"market_data_entries": [
+    {"utc_epoch_ns": 5, "bids": [{"price": 1.0, "amount": null}],
+     "asks": [{"amount": 2, "price": 1.5}]},
+    {"utc_epoch_ns": null, "bids": [], "asks": []},
+    {"bids": [{"price": 1e1, "amount": 1}], "extra": {"a": [1, "]"]},
+     "asks": [{"price": 11.25, "amount": 1}], "utc_epoch_ns": 7}
+  ]})";
+  MarketDataJsonReader reader(doc, doc + sizeof(doc) - 1);
+  MarketDataEntry e{};
+  CHECK(reader.next(e));
+  CHECK(e.time == 5 && e.bids.size() == 1 && std::isnan(e.bids[0].amount));
+  CHECK_NEAR(e.compute_spread(), 0.5, 1e-12);
+  CHECK(reader.next(e));
+  CHECK(e.time == 7);
+  CHECK_NEAR(e.compute_spread(), 1.25, 1e-12);
+  CHECK(!reader.next(e));
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 11: parallel chunked load matches the sequential loader
+// ---------------------------------------------------------------------------
+void test_parallel_loader(const std::string &json_path) {
+  std::printf("  test_parallel_loader ... ");
+
+  std::string path = temp_path("market_cache_parallel_test.json");
+  write_synthetic_json(path, 3'000, 4);
+
+  int64_t huge = INT64_MAX;
+  auto check_same = [&](const std::string &file) {
+    auto seq = MarketDataCache::with_file_mmap(file, 0.0, 10.0);
+    for (unsigned threads : {1u, 2u, 3u, 7u, 64u, 5000u}) {
+      auto par = MarketDataCache::with_file_parallel(file, 0.0, 10.0, threads);
+      CHECK(par.count() == seq.count());
+      CHECK(par.count_range(0, huge) == seq.count_range(0, huge));
+      CHECK(par.spread_percentiles(0, huge) == seq.spread_percentiles(0, huge));
+      if (seq.count() > 0) {
+        CHECK(par.min_spread(0, huge) == seq.min_spread(0, huge));
+        CHECK(par.spread_percentiles_exact(0, huge) ==
+              seq.spread_percentiles_exact(0, huge));
+      }
+    }
+  };
+  check_same(path);
+  std::filesystem::remove(path);
+  if (std::filesystem::exists(json_path))
+    check_same(json_path);
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 12: insert_batch is equivalent to per-entry insert
+// ---------------------------------------------------------------------------
+void test_insert_batch() {
+  std::printf("  test_insert_batch ... ");
 
-  const int N = 1'000'000;
-  const int Q = 100'000;
   int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::mt19937_64 rng(11);
+  std::uniform_real_distribution<double> spread_dist(-1.0, 12.0);
+  std::uniform_int_distribution<int64_t> jitter(-30 * SEC, 2 * SEC);
+
+  // Mostly increasing times with late ticks, same-bucket runs, a gap that
+  // evicts part of the window and one that evicts all of it.
+  std::vector<MarketDataEntry> entries;
+  int64_t t = t0;
+  for (int i = 0; i < 20'000; ++i) {
+    if (i == 8'000)
+      t += 1'800LL * SEC;
+    if (i == 14'000)
+      t += 4'000LL * SEC;
+    t += 50'000'000LL;
+    entries.push_back(make_entry(t + jitter(rng), 100.0,
+                                 100.0 + spread_dist(rng)));
+  }
+  entries.push_back(MarketDataEntry{t, {}, {}}); // NaN spread: ignored
+
+  MarketDataCache one(0.0, 10.0), batched(0.0, 10.0);
+  size_t pos = 0;
+  for (size_t n : {1, 7, 1000, 3, 5000, 64, 20'000}) {
+    size_t end = std::min(entries.size(), pos + n);
+    for (size_t i = pos; i < end; ++i)
+      one.insert(entries[i]);
+    batched.insert_batch(std::span(entries).subspan(pos, end - pos));
+    pos = end;
+
+    CHECK(one.count() == batched.count());
+    for (int64_t w : {10LL, 300LL, 3600LL}) {
+      int64_t hi = t + 10 * SEC, lo = hi - w * SEC;
+      CHECK(one.count_range(lo, hi) == batched.count_range(lo, hi));
+      CHECK(same_pctls(one.spread_percentiles(lo, hi),
+                       batched.spread_percentiles(lo, hi)));
+      if (one.count_range(lo, hi) > 0) {
+        CHECK(one.min_spread(lo, hi) == batched.min_spread(lo, hi));
+        CHECK(one.max_spread(lo, hi) == batched.max_spread(lo, hi));
+      }
+    }
+  }
+  CHECK(pos == entries.size());
 
-  std::mt19937_64 rng(42);
-  std::uniform_real_distribution<double> spread_dist(0.5, 8.0);
-  std::uniform_int_distribution<int64_t> time_dist(0, 3500LL * SEC);
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 13: count/min/max against brute force across the ring wrap-around
+// ---------------------------------------------------------------------------
+void test_range_queries_brute_force() {
+  std::printf("  test_range_queries_brute_force ... ");
 
   MarketDataCache cache(0.0, 10.0);
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::mt19937_64 rng(5);
+  std::uniform_real_distribution<double> spread_dist(0.0, 9.0);
+  std::uniform_int_distribution<int64_t> step(0, 700'000'000LL);
+
+  // Run well past one window so the live range wraps around the ring.
+  std::vector<std::pair<int64_t, double>> ticks;
+  int64_t t = t0;
+  while (t < t0 + 5'400LL * SEC) {
+    t += step(rng);
+    double sp = spread_dist(rng);
+    cache.insert(make_entry(t, 100.0, 100.0 + sp));
+    ticks.push_back({t, sp});
+  }
+  int64_t bucket_ns = MarketDataCache::BUCKET_NS;
+  int64_t first_live =
+      (t / bucket_ns - MarketDataCache::NUM_BUCKETS + 1) * bucket_ns;
+
+  std::uniform_int_distribution<int64_t> pick(t - 3'700LL * SEC, t + SEC);
+  for (int q = 0; q < 2'000; ++q) {
+    int64_t a = pick(rng), b = pick(rng);
+    if (a > b)
+      std::swap(a, b);
+    // Queries work at bucket granularity.
+    int64_t lo = std::max(a / bucket_ns * bucket_ns, first_live);
+    int64_t hi = b / bucket_ns * bucket_ns + bucket_ns - 1;
+    int64_t n = 0;
+    double mn = INFINITY, mx = -INFINITY;
+    for (auto &[tt, sp] : ticks)
+      if (tt >= lo && tt <= hi) {
+        ++n;
+        mn = std::min(mn, sp);
+        mx = std::max(mx, sp);
+      }
+    CHECK(cache.count_range(a, b) == n);
+    if (n > 0) {
+      CHECK_NEAR(cache.min_spread(a, b), mn, 1e-9);
+      CHECK_NEAR(cache.max_spread(a, b), mx, 1e-9);
+    }
+  }
 
-  // --- Insertion benchmark ---
-  std::vector<MarketDataEntry> entries(N);
-  for (int i = 0; i < N; ++i) {
-    double spread = spread_dist(rng);
-    double bid = 100.0;
-    entries[i] = make_entry(t0 + time_dist(rng), bid, bid + spread);
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 14: both histogram index layouts give identical percentiles
+// ---------------------------------------------------------------------------
+void test_hist_index_layouts() {
+  std::printf("  test_hist_index_layouts ... ");
+
+  using HI = MarketDataCache::HistIndex;
+  MarketDataCache bin_major(0.0, 10.0, HI::BinMajorFenwick);
+  MarketDataCache bucket_major(0.0, 10.0, HI::BucketMajorFenwick);
+  CHECK(bucket_major.hist_index() == HI::BucketMajorFenwick);
+
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::mt19937_64 rng(3);
+  std::uniform_real_distribution<double> spread_dist(-1.0, 11.0);
+  std::vector<MarketDataEntry> entries;
+  for (int64_t t = t0; t < t0 + 5'000LL * SEC; t += 37'000'000LL)
+    entries.push_back(make_entry(t, 100.0, 100.0 + spread_dist(rng)));
+  for (size_t i = 0; i < entries.size(); ++i) {
+    bin_major.insert(entries[i]);
+    if (i % 2 == 0)
+      bucket_major.insert(entries[i]);
+    else
+      bucket_major.insert_batch(std::span(&entries[i], 1));
+  }
+  bin_major.remove_up_to(t0 + 2'000LL * SEC);
+  bucket_major.remove_up_to(t0 + 2'000LL * SEC);
+
+  int64_t t_end = entries.back().time;
+  std::uniform_int_distribution<int64_t> pick(t_end - 3'700LL * SEC, t_end);
+  for (int q = 0; q < 2'000; ++q) {
+    int64_t a = pick(rng), b = pick(rng);
+    if (a > b)
+      std::swap(a, b);
+    CHECK(same_pctls(bin_major.spread_percentiles(a, b),
+                     bucket_major.spread_percentiles(a, b)));
   }
-  std::sort(entries.begin(), entries.end(),
-            [](auto &a, auto &b) { return a.time < b.time; });
 
-  double ins_us = bench_us(
-      [&] {
-        MarketDataCache c(0.0, 10.0);
-        for (auto &e : entries)
-          c.insert(e);
-      },
-      1);
-  std::printf("  Insert %d entries:          %.1f ms  (%.0f ns/insert)\n", N,
-              ins_us / 1000.0, ins_us * 1000.0 / N);
+  std::printf("PASS\n");
+}
 
-  for (auto &e : entries)
-    cache.insert(e);
-  std::printf("  Cache count: %lld\n", (long long)cache.count());
+// ---------------------------------------------------------------------------
+// Concurrent reader/writer driver (used by test 15 and the stress benchmark)
+// ---------------------------------------------------------------------------
+struct StressResult {
+  int64_t reads = 0;
+  int64_t writes = 0;
+  bool consistent = true;
+};
+
+// One writer inserts spreads in [1, 2] with advancing timestamps (so buckets
+// are evicted continuously) while `readers` threads query random windows for
+// `ms` milliseconds. Readers check invariants that a torn read would break.
+StressResult run_reader_stress(
+    int readers, int ms,
+    MarketDataCache::Storage storage = MarketDataCache::Storage::Dense) {
+  MarketDataCache cache(0.0, 10.0, MarketDataCache::HistIndex::BucketMajorFenwick,
+                        storage);
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::atomic<bool> stop{false};
+  std::atomic<int64_t> now{t0};
+  StressResult res;
+
+  std::thread writer([&] {
+    std::mt19937_64 rng(1);
+    std::uniform_real_distribution<double> spread_dist(1.0, 2.0);
+    int64_t t = t0;
+    int64_t n = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      t += 5'000'000LL; // 5 ms: the 1 h window rolls over every 720k ticks
+      cache.insert(make_entry(t, 100.0, 100.0 + spread_dist(rng)));
+      now.store(t, std::memory_order_relaxed);
+      ++n;
+    }
+    res.writes = n;
+  });
+
+  std::vector<std::thread> pool;
+  std::vector<int64_t> reads(readers, 0);
+  std::atomic<bool> ok{true};
+  for (int r = 0; r < readers; ++r) {
+    pool.emplace_back([&, r] {
+      std::mt19937_64 rng(100 + r);
+      std::uniform_int_distribution<int64_t> wdist(1LL * SEC, 3600LL * SEC);
+      int64_t n = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        int64_t hi = now.load(std::memory_order_relaxed);
+        int64_t lo = hi - wdist(rng);
+        int64_t c = cache.count_range(lo, hi);
+        double mn = cache.min_spread(lo, hi);
+        double mx = cache.max_spread(lo, hi);
+        auto [p10, p50, p90] = cache.spread_percentiles(lo, hi);
+        if (c < 0 || cache.count() < 0 ||
+            (!std::isnan(mn) && (mn < 1.0 || mx > 2.0 || mn > mx)) ||
+            (!std::isnan(p10) && (p10 > p50 || p50 > p90 || p10 < 0.9 ||
+                                  p90 > 2.1)))
+          ok = false;
+        n += 5;
+      }
+      reads[r] = n;
+    });
+  }
 
-  // --- Generate random query ranges ---
-  struct QueryRange {
-    int64_t s, e;
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  stop = true;
+  writer.join();
+  for (auto &th : pool)
+    th.join();
+  res.reads = std::accumulate(reads.begin(), reads.end(), int64_t{0});
+  res.consistent = ok;
+  return res;
+}
+
+// ---------------------------------------------------------------------------
+// Test 15: optimistic readers stay consistent while the writer inserts
+// ---------------------------------------------------------------------------
+void test_concurrent_readers() {
+  std::printf("  test_concurrent_readers ... ");
+
+  auto res = run_reader_stress(3, 300);
+  CHECK(res.consistent);
+  CHECK(res.writes > 0);
+
+  res = run_reader_stress(3, 300, MarketDataCache::Storage::Compact);
+  CHECK(res.consistent);
+  CHECK(res.writes > 0);
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 16: sharded registry routes per symbol and fans queries out
+// ---------------------------------------------------------------------------
+void test_registry() {
+  std::printf("  test_registry ... ");
+
+  // Idle caches allocate nothing until their first insert.
+  MarketDataCache idle;
+  CHECK(idle.memory_usage() == 0);
+  CHECK(idle.count_range(0, INT64_MAX) == 0);
+  CHECK(std::isnan(idle.min_spread(0, INT64_MAX)));
+
+  MarketDataRegistry reg(8, 0.0, 10.0);
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  const int active = 12;
+  std::vector<std::string> symbols;
+  for (int i = 0; i < 200; ++i)
+    symbols.push_back("SYM" + std::to_string(i));
+
+  // Concurrent writers, each owning a few symbols.
+  std::vector<std::thread> writers;
+  for (int w = 0; w < 4; ++w) {
+    writers.emplace_back([&, w] {
+      for (int i = w; i < active; i += 4)
+        for (int k = 0; k < 500; ++k)
+          reg.insert(symbols[i], make_entry(t0 + k * SEC, 100.0,
+                                            100.0 + 0.5 + (i % 7) + k % 3));
+    });
+  }
+  for (auto &th : writers)
+    th.join();
+  reg.get_or_create("IDLE");
+  CHECK(reg.size() == active + 1);
+  CHECK(reg.find("IDLE")->memory_usage() == 0);
+  CHECK(reg.find("SYM199") == nullptr);
+
+  int64_t lo = t0 + 100 * SEC, hi = t0 + 400 * SEC;
+  auto counts = reg.count_range(symbols, lo, hi);
+  auto pctls = reg.spread_percentiles(symbols, lo, hi);
+  auto mins = reg.min_spread(symbols, lo, hi);
+  CHECK(counts.size() == symbols.size() && pctls.size() == symbols.size());
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    const MarketDataCache *c = reg.find(symbols[i]);
+    if (static_cast<int>(i) < active) {
+      CHECK(c != nullptr);
+      CHECK(counts[i] == 301);
+      CHECK(same_pctls(pctls[i], c->spread_percentiles(lo, hi)));
+      CHECK_NEAR(mins[i], 0.5 + (i % 7), 1e-9);
+    } else {
+      CHECK(c == nullptr && counts[i] == 0 && std::isnan(mins[i]));
+    }
+  }
+
+  // Generic fan-out: bool results land in distinct elements, and a throwing
+  // callback surfaces on the caller once the fan-out has finished.
+  for (int rep = 0; rep < 50; ++rep) {
+    auto known = reg.query<bool>(
+        symbols, [](const MarketDataCache *c) { return c != nullptr; });
+    CHECK(known.size() == symbols.size());
+    for (size_t i = 0; i < symbols.size(); ++i)
+      CHECK(known[i] == (static_cast<int>(i) < active));
+  }
+  bool threw = false;
+  try {
+    reg.query<int>(symbols, [](const MarketDataCache *c) -> int {
+      if (!c)
+        throw std::runtime_error("unknown symbol");
+      return 1;
+    });
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  CHECK(threw);
+  auto one = reg.count_range(std::span(symbols.data(), 1), lo, hi);
+  CHECK(one.size() == 1 && one[0] == 301);
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 17: compact storage answers exactly like dense storage
+// ---------------------------------------------------------------------------
+void test_compact_storage() {
+  std::printf("  test_compact_storage ... ");
+
+  using HI = MarketDataCache::HistIndex;
+  using ST = MarketDataCache::Storage;
+  MarketDataCache dense(0.0, 10.0, HI::BucketMajorFenwick, ST::Dense);
+  MarketDataCache compact(0.0, 10.0, HI::BinMajorFenwick, ST::Compact);
+  CHECK(compact.storage() == ST::Compact);
+  CHECK(compact.hist_index() == HI::BucketMajorFenwick);
+
+  // Bursts separated by gaps, long enough to wrap the ring twice.
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::mt19937_64 rng(11);
+  std::uniform_real_distribution<double> spread_dist(-1.0, 11.0);
+  std::uniform_int_distribution<int64_t> step(1'000'000LL, 900'000'000LL);
+  std::vector<MarketDataEntry> entries;
+  for (int64_t t = t0; t < t0 + 9'000LL * SEC;) {
+    for (int k = 0; k < 40; ++k, t += step(rng))
+      entries.push_back(make_entry(t, 100.0, 100.0 + spread_dist(rng)));
+    t += 60LL * SEC;
+  }
+  for (size_t i = 0; i < entries.size(); i += 7) {
+    size_t n = std::min<size_t>(7, entries.size() - i);
+    dense.insert_batch(std::span(&entries[i], n));
+    if (i % 2)
+      compact.insert_batch(std::span(&entries[i], n));
+    else
+      for (size_t k = i; k < i + n; ++k)
+        compact.insert(entries[k]);
+  }
+  int64_t t_end = entries.back().time;
+  dense.remove_up_to(t_end - 3'000LL * SEC);
+  compact.remove_up_to(t_end - 3'000LL * SEC);
+
+  auto same = [](double a, double b) {
+    return (std::isnan(a) && std::isnan(b)) || a == b;
   };
-  std::vector<QueryRange> queries(Q);
-  std::uniform_int_distribution<int64_t> qdist(0, 3000LL * SEC);
-  std::uniform_int_distribution<int64_t> wdist(1LL * SEC, 600LL * SEC);
-  for (int i = 0; i < Q; ++i) {
-    int64_t qs = t0 + qdist(rng);
-    int64_t qe = qs + wdist(rng);
-    queries[i] = {qs, qe};
+  CHECK(dense.count() == compact.count());
+  std::uniform_int_distribution<int64_t> pick(t_end - 3'700LL * SEC, t_end);
+  for (int q = 0; q < 2'000; ++q) {
+    int64_t a = pick(rng), b = pick(rng);
+    if (a > b)
+      std::swap(a, b);
+    CHECK(dense.count_range(a, b) == compact.count_range(a, b));
+    CHECK(same(dense.min_spread(a, b), compact.min_spread(a, b)));
+    CHECK(same(dense.max_spread(a, b), compact.max_spread(a, b)));
+    CHECK(same_pctls(dense.spread_percentiles(a, b),
+                     compact.spread_percentiles(a, b)));
+    if (q % 20 == 0)
+      CHECK(same_pctls(dense.spread_percentiles_exact(a, b),
+                       compact.spread_percentiles_exact(a, b)));
   }
+  CHECK(dense.count_range(INT64_MIN, INT64_MAX) ==
+        compact.count_range(INT64_MIN, INT64_MAX));
+
+  // A feed with one tick every 10 s occupies 1 bucket in 100.
+  MarketDataCache sparse_dense(0.0, 10.0, HI::BucketMajorFenwick, ST::Dense);
+  MarketDataCache sparse_compact(0.0, 10.0, HI::BucketMajorFenwick,
+                                 ST::Compact);
+  for (int k = 0; k < 360; ++k) {
+    auto e = make_entry(t0 + k * 10LL * SEC, 100.0, 101.0);
+    sparse_dense.insert(e);
+    sparse_compact.insert(e);
+  }
+  CHECK(sparse_compact.memory_usage() * 20 < sparse_dense.memory_usage());
 
-  // --- count_range ---
-  {
-    volatile int64_t sink = 0;
-    double us = bench_us(
-        [&] {
-          for (auto &q : queries)
-            sink = cache.count_range(q.s, q.e);
-        },
-        3);
-    std::printf("  count_range  (%d queries):  %.1f ms  (%.0f ns/query)\n", Q,
-                us / 1000.0, us * 1000.0 / Q);
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 18: other window geometries, including power-of-two shift/mask paths
+// ---------------------------------------------------------------------------
+
+// ~134 ms x 1024 buckets: both sizes are powers of two.
+using Pow2MarketDataCache = BasicMarketDataCache<1LL << 27, 1 << 10, 64>;
+template class BasicMarketDataCache<1LL << 27, 1 << 10, 64>;
+
+// Insert random ticks over [t_begin, t_end) and compare count/min/max against
+// brute force at the cache's own bucket granularity.
+template <typename Cache>
+void check_geometry(Cache &cache, int64_t t_begin, int64_t t_end,
+                    int64_t max_step, uint64_t seed) {
+  const int64_t bucket_ns = Cache::BUCKET_NS;
+  auto floor_div = [](int64_t a, int64_t b) {
+    return a / b - ((a % b != 0) && (a < 0));
+  };
+
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<double> spread_dist(0.0, 9.0);
+  std::uniform_int_distribution<int64_t> step(1, max_step);
+  std::vector<std::pair<int64_t, double>> ticks;
+  for (int64_t t = t_begin; t < t_end; t += step(rng)) {
+    double sp = spread_dist(rng);
+    cache.insert(make_entry(t, 100.0, 100.0 + sp));
+    ticks.push_back({t, sp});
+  }
+  int64_t last_abs = floor_div(ticks.back().first, bucket_ns);
+  int64_t first_live = (last_abs - Cache::NUM_BUCKETS + 1) * bucket_ns;
+  int64_t window_ns = Cache::NUM_BUCKETS * bucket_ns;
+
+  std::uniform_int_distribution<int64_t> pick(
+      ticks.back().first - window_ns - window_ns / 10, ticks.back().first);
+  for (int q = 0; q < 500; ++q) {
+    int64_t a = pick(rng), b = pick(rng);
+    if (a > b)
+      std::swap(a, b);
+    int64_t lo = std::max(floor_div(a, bucket_ns) * bucket_ns, first_live);
+    int64_t hi = floor_div(b, bucket_ns) * bucket_ns + bucket_ns - 1;
+    int64_t n = 0;
+    double mn = INFINITY, mx = -INFINITY;
+    for (auto &[tt, sp] : ticks)
+      if (tt >= lo && tt <= hi) {
+        ++n;
+        mn = std::min(mn, sp);
+        mx = std::max(mx, sp);
+      }
+    CHECK(cache.count_range(a, b) == n);
+    if (n > 0) {
+      CHECK_NEAR(cache.min_spread(a, b), mn, 1e-9);
+      CHECK_NEAR(cache.max_spread(a, b), mx, 1e-9);
+    }
   }
+}
 
-  // --- min_spread ---
-  {
-    volatile double sink = 0;
-    double us = bench_us(
-        [&] {
-          for (auto &q : queries)
-            sink = cache.min_spread(q.s, q.e);
-        },
-        3);
-    std::printf("  min_spread   (%d queries):  %.1f ms  (%.0f ns/query)\n", Q,
-                us / 1000.0, us * 1000.0 / Q);
+void test_geometries() {
+  std::printf("  test_geometries ... ");
+
+  static_assert(HftMarketDataCache::BUCKET_NS == 10'000'000LL &&
+                HftMarketDataCache::NUM_BUCKETS == 6'000);
+  static_assert(DailyMarketDataCache::NUM_BUCKETS == 86'400);
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+
+  HftMarketDataCache hft(0.0, 10.0);
+  check_geometry(hft, t0, t0 + 150LL * SEC, 30'000'000LL, 1);
+  // Only the last minute survives.
+  CHECK(hft.count_range(t0, t0 + 85LL * SEC) == 0);
+
+  DailyMarketDataCache daily(0.0, 10.0,
+                             MarketDataCache::HistIndex::BinMajorFenwick,
+                             MarketDataCache::Storage::Compact);
+  check_geometry(daily, t0, t0 + 130'000LL * SEC, 20LL * SEC, 2);
+
+  // Straddle zero so the shift/mask paths see negative times.
+  for (auto storage : {MarketDataCache::Storage::Dense,
+                       MarketDataCache::Storage::Compact}) {
+    Pow2MarketDataCache pow2(0.0, 10.0,
+                             MarketDataCache::HistIndex::BucketMajorFenwick,
+                             storage);
+    check_geometry(pow2, -300LL * SEC, 40LL * SEC, 90'000'000LL, 3);
   }
 
-  // --- max_spread ---
-  {
-    volatile double sink = 0;
-    double us = bench_us(
-        [&] {
-          for (auto &q : queries)
-            sink = cache.max_spread(q.s, q.e);
-        },
-        3);
-    std::printf("  max_spread   (%d queries):  %.1f ms  (%.0f ns/query)\n", Q,
-                us / 1000.0, us * 1000.0 / Q);
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 19: multi-quantile queries
+// ---------------------------------------------------------------------------
+void test_spread_quantiles() {
+  std::printf("  test_spread_quantiles ... ");
+
+  MarketDataCache cache(0.0, 10.0);
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::mt19937_64 rng(19);
+  std::uniform_real_distribution<double> spread_dist(0.0, 10.0);
+  std::vector<double> all;
+  for (int i = 0; i < 5'000; ++i) {
+    auto e =
+        make_entry(t0 + i * 50'000'000LL, 100.0, 100.0 + spread_dist(rng));
+    cache.insert(e);
+    all.push_back(e.compute_spread());
+  }
+  std::sort(all.begin(), all.end());
+  int64_t t_end = t0 + 5'000LL * 50'000'000LL;
+
+  // Unsorted, duplicated and extreme quantiles.
+  const double qs[] = {0.999, 0.25, 0.0, 0.5, 1.0, 0.01, 0.5, 0.75, 0.1, 0.9};
+  auto exact = cache.spread_quantiles_exact(t0, t_end, qs);
+  auto approx = cache.spread_quantiles(t0, t_end, qs);
+  CHECK(exact.size() == std::size(qs) && approx.size() == std::size(qs));
+  double width = cache.hist_bin_width();
+  for (size_t i = 0; i < std::size(qs); ++i) {
+    size_t rank = std::max<size_t>(
+        1, static_cast<size_t>(std::ceil(qs[i] * all.size())));
+    CHECK(exact[i] == all[rank - 1]);
+    CHECK(std::abs(approx[i] - exact[i]) <= width);
   }
 
-  // --- spread_percentiles (approximate) ---
-  {
-    volatile double sink = 0;
-    double us = bench_us(
-        [&] {
-          for (auto &q : queries) {
-            auto [a, b, c] = cache.spread_percentiles(q.s, q.e);
-            sink = a + b + c;
-          }
-        },
-        3);
-    std::printf(
-        "  spread_pctls (%d queries):  %.1f ms  (%.0f ns/query)  [approx]\n", Q,
-        us / 1000.0, us * 1000.0 / Q);
+  // The fixed percentile tuples are the {0.1, 0.5, 0.9} special case.
+  const double p[] = {0.10, 0.50, 0.90};
+  auto [a10, a50, a90] = cache.spread_percentiles(t0, t_end);
+  auto [e10, e50, e90] = cache.spread_percentiles_exact(t0, t_end);
+  auto aq = cache.spread_quantiles(t0, t_end, p);
+  auto eq = cache.spread_quantiles_exact(t0, t_end, p);
+  CHECK(aq[0] == a10 && aq[1] == a50 && aq[2] == a90);
+  CHECK(eq[0] == e10 && eq[1] == e50 && eq[2] == e90);
+
+  // Empty range / no quantiles / invalid quantiles.
+  auto none = cache.spread_quantiles_exact(0, 1, qs);
+  CHECK(none.size() == std::size(qs) && std::isnan(none[0]));
+  CHECK(std::isnan(cache.spread_quantiles(0, 1, qs)[3]));
+  CHECK(cache.spread_quantiles(t0, t_end, {}).empty());
+  bool threw = false;
+  try {
+    const double bad[] = {0.5, 1.5};
+    cache.spread_quantiles(t0, t_end, bad);
+  } catch (const std::invalid_argument &) {
+    threw = true;
   }
+  CHECK(threw);
 
-  // --- spread_percentiles (exact, fewer queries since it's slower) ---
-  {
-    int Qe = std::min(Q, 1000);
-    volatile double sink = 0;
-    double us = bench_us(
-        [&] {
-          for (int i = 0; i < Qe; ++i) {
-            auto &q = queries[i];
-            auto [a, b, c] = cache.spread_percentiles_exact(q.s, q.e);
-            sink = a + b + c;
-          }
-        },
-        1);
-    std::printf(
-        "  spread_pctls (%d queries):  %.1f ms  (%.0f ns/query)  [exact]\n", Qe,
-        us / 1000.0, us * 1000.0 / Qe);
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 20: exact-quantile index
+// ---------------------------------------------------------------------------
+
+// Feed the same ticks (some late, some after gaps, interleaved with
+// remove_up_to) to a plain and an indexed cache, and compare every exact
+// quantile over random ranges.
+template <typename Cache>
+void check_exact_index(Cache &plain, Cache &indexed, int64_t t_begin,
+                       int64_t max_step, int rounds, uint64_t seed) {
+  const int64_t window_ns = Cache::NUM_BUCKETS * Cache::BUCKET_NS;
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<double> spread_dist(0.0, 9.0);
+  std::uniform_int_distribution<int64_t> step(1, max_step);
+  std::uniform_int_distribution<int> coin(0, 99);
+  const double qs[] = {0.0, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 1.0};
+
+  int64_t t = t_begin;
+  for (int round = 0; round < rounds; ++round) {
+    std::vector<MarketDataEntry> burst;
+    for (int i = 0; i < 2'000; ++i) {
+      t += step(rng);
+      int64_t tt = t;
+      if (coin(rng) < 10) // late tick, somewhere in the window
+        tt -= std::uniform_int_distribution<int64_t>(0, window_ns - 1)(rng);
+      burst.push_back(make_entry(tt, 100.0, 100.0 + spread_dist(rng)));
+    }
+    if (round % 2 == 0) {
+      for (auto &e : burst) {
+        plain.insert(e);
+        indexed.insert(e);
+      }
+    } else {
+      plain.insert_batch(burst);
+      indexed.insert_batch(burst);
+    }
+    if (round % 3 == 2) {
+      plain.remove_up_to(t - window_ns / 2);
+      indexed.remove_up_to(t - window_ns / 2);
+    }
+    if (round == rounds / 2) { // gap longer than the window
+      t += 2 * window_ns;
+    }
+    if (round == rounds - 2) { // empty the window
+      plain.remove_up_to(t);
+      indexed.remove_up_to(t);
+    }
+
+    std::uniform_int_distribution<int64_t> pick(t - window_ns - window_ns / 10,
+                                                t);
+    for (int q = 0; q < 40; ++q) {
+      int64_t a = pick(rng), b = pick(rng);
+      if (a > b)
+        std::swap(a, b);
+      auto want = plain.spread_quantiles_exact(a, b, qs);
+      auto got = indexed.spread_quantiles_exact(a, b, qs);
+      for (size_t i = 0; i < std::size(qs); ++i)
+        CHECK(got[i] == want[i] || (std::isnan(got[i]) && std::isnan(want[i])));
+    }
+  }
+}
+
+void test_exact_index() {
+  std::printf("  test_exact_index ... ");
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+
+  MarketDataCache plain(0.0, 10.0), indexed(0.0, 10.0);
+  CHECK(!indexed.exact_index_enabled());
+  indexed.enable_exact_index();
+  CHECK(indexed.exact_index_enabled());
+  check_exact_index(plain, indexed, t0, 400'000'000LL, 24, 1);
+
+  // Enabling on a populated cache indexes what is already there.
+  HftMarketDataCache hft_plain(0.0, 10.0,
+                               MarketDataCache::HistIndex::BucketMajorFenwick,
+                               MarketDataCache::Storage::Compact);
+  HftMarketDataCache hft_indexed(
+      0.0, 10.0, MarketDataCache::HistIndex::BucketMajorFenwick,
+      MarketDataCache::Storage::Compact);
+  check_exact_index(hft_plain, hft_indexed, t0, 20'000'000LL, 2, 2);
+  hft_indexed.enable_exact_index();
+  check_exact_index(hft_plain, hft_indexed, t0 + 120LL * SEC, 20'000'000LL, 12,
+                    3);
+
+  // Negative times.
+  Pow2MarketDataCache pow2_plain(0.0, 10.0), pow2_indexed(0.0, 10.0);
+  pow2_indexed.enable_exact_index();
+  check_exact_index(pow2_plain, pow2_indexed, -300LL * SEC, 90'000'000LL, 12,
+                    4);
+
+  // The percentile tuple goes through the index too.
+  int64_t t_end = t0 + 10'000LL * SEC;
+  CHECK(same_pctls(indexed.spread_percentiles_exact(t0, t_end),
+                   plain.spread_percentiles_exact(t0, t_end)));
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 21: relative-error sketch
+// ---------------------------------------------------------------------------
+void test_spread_sketch() {
+  std::printf("  test_spread_sketch ... ");
+
+  const double alpha = 0.01;
+  const double qs[] = {0.0, 0.001, 0.01, 0.1, 0.5, 0.9, 0.99, 0.999, 1.0};
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+
+  // Quiet spreads in [0.5, 3) with rare spikes far outside the histogram
+  // range, both ways (crossed books give negative spreads), plus zeros.
+  std::mt19937_64 rng(21);
+  std::uniform_real_distribution<double> quiet(0.5, 3.0);
+  std::lognormal_distribution<double> spike(5.0, 2.0);
+  std::uniform_int_distribution<int> coin(0, 999);
+  std::vector<MarketDataEntry> entries;
+  for (int i = 0; i < 60'000; ++i) {
+    int c = coin(rng);
+    double sp = c < 5 ? spike(rng) : c < 8 ? -spike(rng) : c < 10 ? 0.0
+                                                                  : quiet(rng);
+    entries.push_back(make_entry(t0 + i * 80'000'000LL, 100.0, 100.0 + sp));
+  }
+  int64_t t_end = entries.back().time;
+
+  for (auto storage : {MarketDataCache::Storage::Dense,
+                       MarketDataCache::Storage::Compact}) {
+    MarketDataCache cache(0.0, 10.0,
+                          MarketDataCache::HistIndex::BucketMajorFenwick,
+                          storage);
+    CHECK(!cache.sketch_enabled());
+    bool threw = false;
+    try {
+      cache.spread_quantiles_sketch(t0, t_end, qs);
+    } catch (const std::logic_error &) {
+      threw = true;
+    }
+    CHECK(threw);
+
+    // Half before enabling, half after; the window has wrapped by the end.
+    size_t half = entries.size() / 2;
+    cache.insert_batch(std::span(entries).first(half));
+    cache.enable_sketch(alpha);
+    CHECK(cache.sketch_enabled());
+    for (size_t i = half; i < entries.size(); ++i)
+      cache.insert(entries[i]);
+    cache.remove_up_to(t_end - 3000LL * SEC);
+
+    std::uniform_int_distribution<int64_t> pick(t_end - 4000LL * SEC, t_end);
+    for (int q = 0; q < 300; ++q) {
+      int64_t a = pick(rng), b = pick(rng);
+      if (a > b)
+        std::swap(a, b);
+      auto exact = cache.spread_quantiles_exact(a, b, qs);
+      auto sk = cache.spread_quantiles_sketch(a, b, qs);
+      for (size_t i = 0; i < std::size(qs); ++i) {
+        if (std::isnan(exact[i])) {
+          CHECK(std::isnan(sk[i]));
+          continue;
+        }
+        CHECK(std::abs(sk[i] - exact[i]) <= alpha * std::abs(exact[i]) + 1e-9);
+      }
+    }
+
+    // The tail the histogram clamps into its top bin.
+    const double tail[] = {0.999};
+    double exact = cache.spread_quantiles_exact(t0, t_end, tail)[0];
+    double sk = cache.spread_quantiles_sketch(t0, t_end, tail)[0];
+    double hist = cache.spread_quantiles(t0, t_end, tail)[0];
+    CHECK(exact > cache.hist_max());
+    CHECK(std::abs(sk - exact) <= alpha * exact);
+    CHECK(hist < cache.hist_max());
+  }
+
+  bool threw = false;
+  try {
+    MarketDataCache cache;
+    cache.enable_sketch(1.0);
+  } catch (const std::invalid_argument &) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 22: rollup tiers behind the window
+// ---------------------------------------------------------------------------
+void test_rollups() {
+  std::printf("  test_rollups ... ");
+
+  const int64_t HOUR = 3600LL * SEC;
+  const int64_t t0 = 277'000LL * HOUR; // hour-aligned
+  const double qs[] = {0.1, 0.5, 0.9};
+
+  // 30 hours, one tick every 1.5 s: all but the last hour lives in tiers.
+  MarketDataCache cache(0.0, 10.0);
+  CHECK(!cache.rollups_enabled());
+  cache.enable_rollups();
+  CHECK(cache.rollups_enabled());
+  std::mt19937_64 rng(22);
+  std::uniform_real_distribution<double> spread_dist(0.5, 9.5);
+  std::vector<std::pair<int64_t, double>> ticks;
+  std::vector<MarketDataEntry> batch;
+  for (int64_t t = t0; t < t0 + 30 * HOUR; t += 1'500'000'000LL) {
+    double sp = spread_dist(rng);
+    auto e = make_entry(t, 100.0, 100.0 + sp);
+    ticks.push_back({t, e.compute_spread()});
+    batch.push_back(std::move(e));
+    if (batch.size() == 1000 || t + 1'500'000'000LL >= t0 + 30 * HOUR) {
+      cache.insert_batch(batch);
+      batch.clear();
+    }
+  }
+  CHECK(cache.count() < static_cast<int64_t>(ticks.size()) / 20);
+
+  // Hour-aligned ranges line up with every tier, so count / min / max are
+  // exact and quantiles land in the right histogram bin.
+  std::uniform_int_distribution<int> hour(0, 30);
+  for (int q = 0; q < 200; ++q) {
+    int h0 = hour(rng), h1 = hour(rng);
+    if (h0 > h1)
+      std::swap(h0, h1);
+    if (h0 == h1)
+      ++h1;
+    int64_t a = t0 + h0 * HOUR, b = t0 + h1 * HOUR - 1;
+    std::vector<double> want;
+    for (auto &[t, sp] : ticks)
+      if (t >= a && t <= b)
+        want.push_back(sp);
+    auto got = cache.spread_summary(a, b, qs);
+    CHECK(got.count == static_cast<int64_t>(want.size()));
+    if (want.empty())
+      continue;
+    std::sort(want.begin(), want.end());
+    CHECK(got.min_spread == want.front() && got.max_spread == want.back());
+    for (size_t i = 0; i < std::size(qs); ++i) {
+      size_t rank = std::max<size_t>(
+          1, static_cast<size_t>(std::ceil(qs[i] * want.size())));
+      CHECK(std::abs(got.quantiles[i] - want[rank - 1]) <=
+            cache.hist_bin_width());
+    }
+  }
+
+  // Without tiers the summary is the window alone.
+  MarketDataCache plain(0.0, 10.0);
+  for (auto &[t, sp] : ticks)
+    plain.insert(make_entry(t, 100.0, 100.0 + sp));
+  auto whole = plain.spread_summary(t0, t0 + 30 * HOUR, qs);
+  CHECK(whole.count == plain.count());
+  CHECK(whole.min_spread == plain.min_spread(t0, t0 + 30 * HOUR));
+  auto [p10, p50, p90] = plain.spread_percentiles(t0, t0 + 30 * HOUR);
+  CHECK(whole.quantiles[0] == p10 && whole.quantiles[1] == p50 &&
+        whole.quantiles[2] == p90);
+
+  // remove_up_to drops whole tier cells up to its time.
+  cache.remove_up_to(t0 + 10 * HOUR - 1);
+  CHECK(cache.spread_summary(t0, t0 + 10 * HOUR - 1).count == 0);
+  int64_t kept = 0;
+  for (auto &[t, sp] : ticks)
+    kept += t >= t0 + 10 * HOUR;
+  CHECK(cache.spread_summary(t0, t0 + 30 * HOUR).count == kept);
+
+  // Short tiers drop what falls off the last one, and memory stays put.
+  HftMarketDataCache hft(0.0, 10.0);
+  const MarketDataCache::RollupTier tiers[] = {{SEC, 60}, {10 * SEC, 30}};
+  hft.enable_rollups(tiers);
+  size_t mem = 0;
+  for (int64_t t = t0; t < t0 + 20 * 60 * SEC; t += 5'000'000LL) {
+    hft.insert(make_entry(t, 100.0, 101.0));
+    if (t == t0 + 10 * 60 * SEC)
+      mem = hft.memory_usage();
+  }
+  CHECK(hft.memory_usage() == mem);
+  CHECK(hft.spread_summary(t0, t0 + 10 * 60 * SEC).count == 0);
+  // 1 min window + 1 min of 1 s cells + 5 min of 10 s cells, give or take
+  // the cells straddling tier boundaries.
+  int64_t retained = hft.spread_summary(t0, t0 + 20 * 60 * SEC).count;
+  CHECK(retained >= 6 * 60 * 200 && retained <= 7 * 60 * 200);
+
+  bool threw = false;
+  try {
+    const MarketDataCache::RollupTier bad[] = {{60 * SEC, 10}, {90 * SEC, 10}};
+    cache.enable_rollups(bad);
+  } catch (const std::invalid_argument &) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 23: evictions across feed gaps and remove_up_to
+// ---------------------------------------------------------------------------
+void test_gap_eviction() {
+  std::printf("  test_gap_eviction ... ");
+
+  using HI = MarketDataCache::HistIndex;
+  using ST = MarketDataCache::Storage;
+  const int64_t BUCKET = MarketDataCache::BUCKET_NS;
+  const int64_t MIN = 60LL * SEC;
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const double qs[] = {0.5};
+  std::string path = temp_path("market_cache_gap_test.bin");
+
+  struct Config {
+    HI hist_index;
+    ST storage;
+    bool extras; // sketch + rollups
+  };
+  for (auto cfg : {Config{HI::BinMajorFenwick, ST::Dense, false},
+                   Config{HI::BucketMajorFenwick, ST::Dense, true},
+                   Config{HI::BucketMajorFenwick, ST::Compact, false}}) {
+    MarketDataCache cache(0.0, 10.0, cfg.hist_index, cfg.storage);
+    if (cfg.extras) {
+      cache.enable_sketch();
+      cache.enable_rollups();
+    }
+    cache.add_metric({BookMetric::Mid});
+    std::mt19937_64 rng(23);
+    std::uniform_real_distribution<double> spread_dist(-1.0, 11.0);
+    std::uniform_int_distribution<int64_t> step(20'000'000LL, 250'000'000LL);
+    std::vector<std::pair<int64_t, double>> live; // brute-force window
+    int64_t fed = 0, last = t0;
+
+    // Ticks from `from` for `len`, in alternating batches and single inserts.
+    auto feed = [&](int64_t from, int64_t len) {
+      std::vector<MarketDataEntry> batch;
+      for (int64_t t = from; t < from + len; t += step(rng)) {
+        auto e = make_entry(t, 100.0, 100.0 + spread_dist(rng));
+        live.push_back({t, e.compute_spread()});
+        batch.push_back(std::move(e));
+        last = t;
+      }
+      fed += static_cast<int64_t>(batch.size());
+      for (size_t i = 0; i < batch.size(); i += 64) {
+        size_t n = std::min<size_t>(64, batch.size() - i);
+        if ((i / 64) % 2)
+          cache.insert_batch(std::span(&batch[i], n));
+        else
+          for (size_t k = i; k < i + n; ++k)
+            cache.insert(batch[k]);
+      }
+      int64_t first_bucket = last / BUCKET - MarketDataCache::NUM_BUCKETS + 1;
+      std::erase_if(live,
+                    [&](auto &tick) { return tick.first / BUCKET < first_bucket; });
+    };
+    // `n` ticks from `from`, older than the newest one.
+    auto late = [&](int64_t from, int n) {
+      for (int i = 0; i < n; ++i) {
+        int64_t t = from + i * 7 * SEC;
+        auto e = make_entry(t, 100.0, 100.0 + spread_dist(rng));
+        live.push_back({t, e.compute_spread()});
+        cache.insert(e);
+        ++fed;
+      }
+    };
+    auto remove_up_to = [&](int64_t time) {
+      cache.remove_up_to(time);
+      std::erase_if(live, [&](auto &tick) {
+        return tick.first / BUCKET <= time / BUCKET;
+      });
+    };
+    // Against brute force for counts and exact percentiles, and against a
+    // cache rebuilt from the survivors for everything the indexes answer.
+    auto verify = [&](bool snapshot = false) {
+      MarketDataCache ref(0.0, 10.0, cfg.hist_index, cfg.storage);
+      ref.add_metric({BookMetric::Mid});
+      for (auto &[t, sp] : live)
+        ref.insert(make_entry(t, 100.0, 100.0 + sp));
+      CHECK(cache.count() == static_cast<int64_t>(live.size()));
+      std::vector<std::pair<int64_t, int64_t>> ranges;
+      std::uniform_int_distribution<int64_t> pick(last - 70 * MIN, last);
+      for (int q = 0; q < 200; ++q) {
+        int64_t a = pick(rng), b = pick(rng);
+        if (a > b)
+          std::swap(a, b);
+        if (q == 0)
+          a = t0, b = last; // everything
+        ranges.push_back({a, b});
+        auto m = cache.metric_summary(0, a, b);
+        auto mr = ref.metric_summary(0, a, b);
+        CHECK(m.count == mr.count);
+        CHECK_NEAR(m.sum, mr.sum, 1e-6 * std::abs(mr.sum));
+        // Queries resolve to whole buckets.
+        std::vector<double> want;
+        for (auto &[t, sp] : live)
+          if (t / BUCKET >= a / BUCKET && t / BUCKET <= b / BUCKET)
+            want.push_back(sp);
+        CHECK(cache.count_range(a, b) == static_cast<int64_t>(want.size()));
+        CHECK(cache.count_range(a, b) == ref.count_range(a, b));
+        if (want.empty())
+          continue;
+        std::sort(want.begin(), want.end());
+        CHECK(cache.min_spread(a, b) == want.front());
+        CHECK(cache.max_spread(a, b) == want.back());
+        CHECK(same_pctls(cache.spread_percentiles(a, b),
+                         ref.spread_percentiles(a, b)));
+        if (q % 20 == 0)
+          CHECK(same_pctls(cache.spread_percentiles_exact(a, b),
+                           ref.spread_percentiles_exact(a, b)));
+        if (cfg.extras && q % 20 == 0) {
+          double exact = cache.spread_quantiles_exact(a, b, qs)[0];
+          double approx = cache.spread_quantiles_sketch(a, b, qs)[0];
+          CHECK(std::abs(approx - exact) <= 0.011 * std::abs(exact) + 1e-9);
+        }
+      }
+      if (snapshot) {
+        cache.save_snapshot(path);
+        MarketDataCache loaded = MarketDataCache::load_snapshot(path);
+        std::remove(path.c_str());
+        CHECK(loaded.count() == cache.count());
+        for (auto &[a, b] : ranges) {
+          CHECK(loaded.count_range(a, b) == ref.count_range(a, b));
+          CHECK(same_pctls(loaded.spread_percentiles(a, b),
+                           ref.spread_percentiles(a, b)));
+        }
+      }
+    };
+
+    feed(t0, 60 * MIN); // full window
+    verify();
+    // Partial gaps leave most evicted buckets to the sweep; these check
+    // while it is under way.
+    feed(last + 30 * MIN, 5 * SEC);
+    verify(true);
+    late(last - 20 * MIN, 5); // into the gap, splitting its range
+    verify();
+    feed(last + 12 * MIN, 5 * SEC); // a second gap right behind
+    verify(true);
+    feed(last + 55 * MIN, 2 * MIN); // most of the window goes
+    verify();
+    feed(last + BUCKET, 30 * MIN); // ordinary rolling eviction
+    verify();
+    feed(last + 120 * MIN, MIN); // the whole window goes
+    verify();
+    if (cfg.extras)
+      CHECK(cache.spread_summary(t0, last).count == fed);
+    feed(last + BUCKET, 40 * MIN);
+    remove_up_to(last - 5 * MIN);
+    verify();
+    feed(last + BUCKET, MIN);
+    verify();
+    remove_up_to(last + SEC);
+    CHECK(cache.count() == 0 && live.empty());
+    feed(last + 10 * SEC, MIN);
+    verify();
+  }
+
+  // Eight evicted ranges (a half-window gap split by late ticks), then a cut
+  // shorter than all of them, which is swept on the spot: its ticks must
+  // leave count() once, through insert_batch, insert and remove_up_to.
+  for (int op = 0; op < 3; ++op) {
+    MarketDataCache cache(0.0, 10.0);
+    std::vector<int64_t> times;
+    std::vector<MarketDataEntry> batch;
+    for (int64_t t = t0; t < t0 + 60 * MIN; t += BUCKET)
+      batch.push_back(make_entry(t, 100.0, 101.0));
+    cache.insert_batch(batch);
+    int64_t t_end = t0 + 60 * MIN - BUCKET;
+    for (auto &e : batch)
+      times.push_back(e.time);
+    auto add = [&](int64_t t) {
+      cache.insert(make_entry(t, 100.0, 101.0));
+      times.push_back(t);
+    };
+    add(t_end + 30 * MIN);
+    for (int k = 1; k <= 7; ++k)
+      add(t_end + k * 210 * SEC);
+
+    int64_t cut = t_end + 30 * MIN + 10 * SEC;
+    if (op == 2) {
+      cache.remove_up_to(t_end - 30 * MIN + 10 * SEC);
+      std::erase_if(times, [&](int64_t t) {
+        return t / BUCKET <= (t_end - 30 * MIN + 10 * SEC) / BUCKET;
+      });
+    } else {
+      std::vector<MarketDataEntry> one{make_entry(cut, 100.0, 101.0)};
+      if (op == 0)
+        cache.insert_batch(one);
+      else
+        cache.insert(one[0]);
+      times.push_back(cut);
+      int64_t first_bucket = cut / BUCKET - MarketDataCache::NUM_BUCKETS + 1;
+      std::erase_if(times,
+                    [&](int64_t t) { return t / BUCKET < first_bucket; });
+    }
+    CHECK(cache.count() == static_cast<int64_t>(times.size()));
+    CHECK(cache.count_range(t0, cut) == cache.count());
+  }
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 24: snapshots round-trip and restart where the writer left off
+// ---------------------------------------------------------------------------
+void test_snapshot() {
+  std::printf("  test_snapshot ... ");
+
+  using HI = MarketDataCache::HistIndex;
+  using ST = MarketDataCache::Storage;
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::string path = temp_path("market_cache_snapshot_test.bin");
+
+  auto same = [](double a, double b) {
+    return (std::isnan(a) && std::isnan(b)) || a == b;
+  };
+  auto check_same = [&](const MarketDataCache &a, const MarketDataCache &b,
+                        int64_t lo, int64_t hi, std::mt19937_64 &rng) {
+    CHECK(a.count() == b.count());
+    std::uniform_int_distribution<int64_t> pick(lo, hi);
+    for (int q = 0; q < 300; ++q) {
+      int64_t x = pick(rng), y = pick(rng);
+      if (x > y)
+        std::swap(x, y);
+      CHECK(a.count_range(x, y) == b.count_range(x, y));
+      CHECK(same(a.min_spread(x, y), b.min_spread(x, y)));
+      CHECK(same(a.max_spread(x, y), b.max_spread(x, y)));
+      CHECK(same_pctls(a.spread_percentiles(x, y), b.spread_percentiles(x, y)));
+      if (q % 30 == 0)
+        CHECK(same_pctls(a.spread_percentiles_exact(x, y),
+                         b.spread_percentiles_exact(x, y)));
+    }
+  };
+
+  struct Config {
+    HI hist_index;
+    ST storage;
+  };
+  for (auto cfg : {Config{HI::BinMajorFenwick, ST::Dense},
+                   Config{HI::BucketMajorFenwick, ST::Dense},
+                   Config{HI::BucketMajorFenwick, ST::Compact}}) {
+    std::mt19937_64 rng(24);
+    std::uniform_real_distribution<double> spread_dist(-1.0, 11.0);
+    std::uniform_int_distribution<int64_t> step(10'000'000LL, 400'000'000LL);
+    auto ticks = [&](int64_t from, int64_t len) {
+      std::vector<MarketDataEntry> out;
+      for (int64_t t = from; t < from + len; t += step(rng))
+        out.push_back(make_entry(t, 100.0, 100.0 + spread_dist(rng)));
+      return out;
+    };
+
+    MarketDataCache live(0.0, 10.0, cfg.hist_index, cfg.storage);
+    // Nothing inserted yet: the snapshot restores an empty cache.
+    live.save_snapshot(path);
+    auto empty = MarketDataCache::load_snapshot(path);
+    CHECK(empty.count() == 0 && empty.memory_usage() == 0);
+    CHECK(empty.hist_index() == live.hist_index() &&
+          empty.storage() == live.storage());
+
+    // A gap of more than a window leaves stale index entries behind, which
+    // the snapshot must not carry over.
+    live.insert_batch(ticks(t0, 3'600LL * SEC));
+    int64_t t1 = t0 + 7'500LL * SEC;
+    live.insert_batch(ticks(t1, 2'000LL * SEC));
+    live.remove_up_to(t1 + 200LL * SEC);
+    live.save_snapshot(path);
+
+    // Loads from a file this process cannot write.
+    std::filesystem::permissions(path, std::filesystem::perms::owner_read,
+                                 std::filesystem::perm_options::replace);
+    auto restored = MarketDataCache::load_snapshot(path);
+    std::filesystem::permissions(path, std::filesystem::perms::owner_all,
+                                 std::filesystem::perm_options::replace);
+    CHECK(restored.hist_min() == live.hist_min() &&
+          restored.hist_bin_width() == live.hist_bin_width());
+    CHECK(restored.hist_index() == live.hist_index() &&
+          restored.storage() == live.storage());
+    int64_t t_end = t1 + 2'000LL * SEC;
+    check_same(live, restored, t1 - 100LL * SEC, t_end, rng);
+
+    // Both keep going identically: late ticks, a partial and a full
+    // eviction.
+    auto more = ticks(t_end, 1'800LL * SEC);
+    auto late = ticks(t_end - 600LL * SEC, 30LL * SEC);
+    for (auto *c : {&live, &restored}) {
+      c->insert_batch(more);
+      c->insert_batch(late);
+    }
+    check_same(live, restored, t_end - 3'700LL * SEC, t_end + 1'800LL * SEC,
+               rng);
+    auto after_gap = ticks(t_end + 9'000LL * SEC, 60LL * SEC);
+    for (auto *c : {&live, &restored})
+      c->insert_batch(after_gap);
+    check_same(live, restored, t_end + 8'900LL * SEC, t_end + 9'100LL * SEC,
+               rng);
+  }
+
+  // Another geometry, a corrupt header or a truncated file is refused.
+  auto refused = [&](auto load) {
+    try {
+      load();
+    } catch (const std::runtime_error &) {
+      return true;
+    }
+    return false;
+  };
+  MarketDataCache cache(0.0, 10.0);
+  cache.insert(make_entry(t0, 100.0, 101.0));
+  cache.save_snapshot(path);
+  CHECK(refused([&] { HftMarketDataCache::load_snapshot(path); }));
+  {
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(offsetof(SnapshotHeader, version));
+    uint32_t version = SNAPSHOT_VERSION + 1;
+    f.write(reinterpret_cast<const char *>(&version), sizeof(version));
+  }
+  CHECK(refused([&] { MarketDataCache::load_snapshot(path); }));
+  cache.save_snapshot(path);
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 4);
+  CHECK(refused([&] { MarketDataCache::load_snapshot(path); }));
+  CHECK(refused([&] { MarketDataCache::load_snapshot(path + ".missing"); }));
+  std::filesystem::remove(path);
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 25: rolling subscriptions track spread_summary of their window
+// ---------------------------------------------------------------------------
+void test_subscriptions() {
+  std::printf("  test_subscriptions ... ");
+
+  const int64_t BUCKET = MarketDataCache::BUCKET_NS;
+  const int64_t MIN = 60LL * SEC;
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const double qs[] = {0.1, 0.5, 0.9};
+
+  MarketDataCache cache(0.0, 10.0);
+  bool threw = false;
+  try {
+    cache.subscribe(0);
+  } catch (const std::invalid_argument &) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  // 5 min, 1 min, a window that is not a whole number of buckets, one longer
+  // than the cache holds, and one with no quantiles.
+  std::vector<std::pair<int, int64_t>> subs = {
+      {cache.subscribe(5 * MIN, qs), 5 * MIN},
+      {cache.subscribe(MIN, qs), MIN},
+      {cache.subscribe(90 * SEC + 1, qs), 90 * SEC + BUCKET},
+      {cache.subscribe(120 * MIN, qs), 60 * MIN},
+      {cache.subscribe(10 * SEC), 10 * SEC},
+  };
+  CHECK(cache.rolling_stats(subs[0].first).count == 0);
+  CHECK(cache.rolling_stats(subs[0].first).end_time <
+        cache.rolling_stats(subs[0].first).start_time);
+
+  auto same = [](double a, double b) {
+    return (std::isnan(a) && std::isnan(b)) || a == b;
+  };
+  int64_t newest = INT64_MIN;
+  auto verify = [&] {
+    for (auto &[id, len] : subs) {
+      auto got = cache.rolling_stats(id);
+      if (got.count == 0 && cache.count() == 0)
+        continue;
+      CHECK(got.end_time == (newest / BUCKET + 1) * BUCKET - 1);
+      CHECK(got.end_time - got.start_time + 1 <= len);
+      std::span<const double> want_qs(qs, got.quantiles.size());
+      auto want = cache.spread_summary(got.start_time, got.end_time, want_qs);
+      CHECK(got.count == want.count);
+      CHECK(same(got.min_spread, want.min_spread));
+      CHECK(same(got.max_spread, want.max_spread));
+      for (size_t i = 0; i < want.quantiles.size(); ++i)
+        CHECK(same(got.quantiles[i], want.quantiles[i]));
+    }
+  };
+
+  std::mt19937_64 rng(25);
+  std::uniform_real_distribution<double> spread_dist(-1.0, 11.0);
+  std::uniform_int_distribution<int64_t> step(5'000'000LL, 300'000'000LL);
+  std::uniform_int_distribution<int64_t> lateness(0, 4 * MIN);
+  std::uniform_int_distribution<int> coin(0, 99);
+  int64_t t = t0;
+  std::vector<MarketDataEntry> batch;
+  for (int round = 0; round < 60; ++round) {
+    for (int k = 0; k < 400; ++k) {
+      t += step(rng);
+      int64_t when = coin(rng) < 5 ? t - lateness(rng) : t;
+      batch.push_back(make_entry(when, 100.0, 100.0 + spread_dist(rng)));
+      newest = std::max(newest, when);
+    }
+    if (round % 2)
+      cache.insert_batch(batch);
+    else
+      for (auto &e : batch)
+        cache.insert(e);
+    batch.clear();
+    verify();
+
+    if (round == 10)
+      t += 3 * MIN; // shorter than some spans, longer than others
+    if (round == 20)
+      t += 120 * MIN; // longer than the window
+    if (round == 30) {
+      cache.remove_up_to(newest - 30 * SEC);
+      verify();
+    }
+    if (round == 40) {
+      // Late subscribers start from the window's contents.
+      subs.push_back({cache.subscribe(2 * MIN, qs), 2 * MIN});
+      verify();
+    }
+    if (round == 50) {
+      cache.remove_up_to(newest);
+      CHECK(cache.rolling_stats(subs[0].first).count == 0);
+      t += MIN;
+      newest = INT64_MIN;
+    }
+  }
+
+  cache.unsubscribe(subs[1].first);
+  threw = false;
+  try {
+    cache.rolling_stats(subs[1].first);
+  } catch (const std::out_of_range &) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 26: compute_spread kernels and per-feed level order
+// ---------------------------------------------------------------------------
+// The original scan, kept as the reference for the vector kernels.
+double reference_spread(const MarketDataEntry &e) {
+  if (e.bids.empty() || e.asks.empty())
+    return std::numeric_limits<double>::quiet_NaN();
+  double hi = -std::numeric_limits<double>::infinity();
+  for (auto &b : e.bids)
+    if (b.price > hi)
+      hi = b.price;
+  double lo = std::numeric_limits<double>::infinity();
+  for (auto &a : e.asks)
+    if (a.price < lo)
+      lo = a.price;
+  return lo - hi;
+}
+
+// n levels per side, shuffled; spread in [0.01, 5).
+MarketDataEntry make_book(std::mt19937_64 &rng, int64_t time, int n) {
+  std::uniform_real_distribution<double> gap(0.01, 5.0);
+  std::uniform_real_distribution<double> step(0.0, 0.5);
+  MarketDataEntry e{time, {}, {}};
+  double mid = 100.0, half = gap(rng) / 2;
+  double bid = mid - half, ask = mid + half;
+  for (int l = 0; l < n; ++l) {
+    e.bids.push_back({bid, 1.0 + l});
+    e.asks.push_back({ask, 1.0 + l});
+    bid -= step(rng);
+    ask += step(rng);
+  }
+  std::shuffle(e.bids.begin(), e.bids.end(), rng);
+  std::shuffle(e.asks.begin(), e.asks.end(), rng);
+  return e;
+}
+
+void test_level_order() {
+  std::printf("  test_level_order ... ");
+
+  auto same = [](double a, double b) {
+    return (std::isnan(a) && std::isnan(b)) || a == b;
+  };
+  auto best_first = [](MarketDataEntry e) {
+    std::sort(e.bids.begin(), e.bids.end(),
+              [](auto &x, auto &y) { return x.price > y.price; });
+    std::sort(e.asks.begin(), e.asks.end(),
+              [](auto &x, auto &y) { return x.price < y.price; });
+    return e;
+  };
+
+  // Every length around the vector widths, with the best level anywhere and
+  // NaN prices mixed in.
+  std::mt19937_64 rng(26);
+  std::uniform_int_distribution<int> pct(0, 99);
+  for (int n = 0; n <= 70; ++n) {
+    for (int rep = 0; rep < 20; ++rep) {
+      MarketDataEntry e = make_book(rng, 0, n);
+      if (rep % 4 == 3) {
+        for (auto &l : e.bids)
+          if (pct(rng) < 20)
+            l.price = std::numeric_limits<double>::quiet_NaN();
+        for (auto &l : e.asks)
+          if (pct(rng) < 20)
+            l.price = std::numeric_limits<double>::quiet_NaN();
+      }
+      CHECK(same(e.compute_spread(), reference_spread(e)));
+      if (rep % 4 != 3 && n > 0) {
+        MarketDataEntry sorted = best_first(e);
+        CHECK(sorted.compute_spread(LevelOrder::BestFirst) ==
+              reference_spread(e));
+      }
+    }
+  }
+  MarketDataEntry one_sided{0, {{1.0, 1.0}}, {}};
+  CHECK(std::isnan(one_sided.compute_spread(LevelOrder::BestFirst)));
+
+  // The cache applies its feed's order: asks[0] - bids[0] once BestFirst is
+  // declared, even if the levels say otherwise.
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  MarketDataEntry front{t0, {{99.0, 1}, {99.5, 1}}, {{101.0, 1}, {100.0, 1}}};
+  MarketDataCache cache(0.0, 10.0);
+  CHECK(cache.level_order() == LevelOrder::Unsorted);
+  cache.insert(front);
+  CHECK(cache.max_spread(t0, t0) == 0.5);
+  cache.set_level_order(LevelOrder::BestFirst);
+  CHECK(cache.level_order() == LevelOrder::BestFirst);
+  front.time += SEC;
+  cache.insert(front);
+  CHECK(cache.max_spread(t0 + SEC, t0 + SEC) == 2.0);
+  front.time += SEC;
+  cache.insert_batch(std::span(&front, 1));
+  CHECK(cache.max_spread(t0 + 2 * SEC, t0 + 2 * SEC) == 2.0);
+
+  // Sorted books give the same cache either way.
+  MarketDataCache unsorted(0.0, 10.0), sorted(0.0, 10.0);
+  sorted.set_level_order(LevelOrder::BestFirst);
+  for (int i = 0; i < 2000; ++i) {
+    MarketDataEntry e = best_first(make_book(rng, t0 + i * 10'000'000LL, 30));
+    unsorted.insert(e);
+    sorted.insert(e);
+  }
+  int64_t end = t0 + 2000 * 10'000'000LL;
+  CHECK(unsorted.count() == sorted.count());
+  CHECK(same_pctls(unsorted.spread_percentiles_exact(t0, end),
+                   sorted.spread_percentiles_exact(t0, end)));
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 27: arena-backed entry views and the allocation-free ingest path
+// ---------------------------------------------------------------------------
+void test_entry_views() {
+  std::printf("  test_entry_views ... ");
+
+  // Runs longer than a block move whole; earlier runs stay put.
+  RunArena<int, 8> arena;
+  std::vector<std::span<const int>> runs;
+  for (int round = 0; round < 3; ++round) {
+    runs.clear();
+    for (int len = 0; len < 40; ++len) {
+      arena.begin_run();
+      for (int k = 0; k < len; ++k)
+        arena.push(len * 100 + k);
+      runs.push_back(arena.end_run());
+    }
+    for (int len = 0; len < 40; ++len) {
+      CHECK(runs[len].size() == static_cast<size_t>(len));
+      for (int k = 0; k < len; ++k)
+        CHECK(runs[len][k] == len * 100 + k);
+    }
+    size_t held = arena.memory_usage();
+    arena.reset();
+    if (round > 0)
+      CHECK(arena.memory_usage() == held);
+  }
+
+  // Both reader overloads see the same entries, and the cache answers the
+  // same whichever it is fed.
+  std::string path = temp_path("market_cache_views.json");
+  write_synthetic_json(path, 3000, 7, 27);
+  {
+    MappedFile file(path);
+    MarketDataJsonReader owning(file.begin(), file.end());
+    MarketDataJsonReader viewing(file.begin(), file.end());
+    RunArena<PriceLevel> levels;
+    MarketDataEntry e{};
+    MarketDataEntryView v{};
+    MarketDataCache by_entry(0.0, 10.0), by_view(0.0, 10.0);
+    std::vector<MarketDataEntryView> batch;
+    int64_t first = 0, last = 0;
+    while (owning.next(e)) {
+      CHECK(viewing.next(v, levels));
+      CHECK(v.time == e.time);
+      CHECK(v.bids.size() == e.bids.size() && v.asks.size() == e.asks.size());
+      for (size_t i = 0; i < e.bids.size(); ++i)
+        CHECK(v.bids[i].price == e.bids[i].price &&
+              v.bids[i].amount == e.bids[i].amount);
+      for (size_t i = 0; i < e.asks.size(); ++i)
+        CHECK(v.asks[i].price == e.asks[i].price &&
+              v.asks[i].amount == e.asks[i].amount);
+      by_entry.insert(e);
+      if (e.time % 2)
+        by_view.insert(v);
+      else
+        batch.push_back(v);
+      if (batch.size() == 100) {
+        by_view.insert_batch(batch);
+        batch.clear();
+        levels.reset();
+      }
+      first = first ? first : e.time;
+      last = e.time;
+    }
+    by_view.insert_batch(batch);
+    CHECK(!viewing.next(v, levels));
+    CHECK(by_entry.count() == by_view.count());
+    CHECK(same_pctls(by_entry.spread_percentiles_exact(first, last),
+                     by_view.spread_percentiles_exact(first, last)));
+    CHECK(by_entry.min_spread(first, last) == by_view.min_spread(first, last));
+
+    auto mapped = MarketDataCache::with_file_mmap(path, 0.0, 10.0);
+    CHECK(mapped.count() == by_entry.count());
+    CHECK(same_pctls(mapped.spread_percentiles_exact(first, last),
+                     by_entry.spread_percentiles_exact(first, last)));
+  }
+  std::filesystem::remove(path);
+
+  // Steady state: one tick per bucket, parsed into an arena and inserted in
+  // batches. Once the window has turned over twice nothing allocates.
+  const int64_t bucket = Pow2MarketDataCache::BUCKET_NS;
+  const int warm = 2 * Pow2MarketDataCache::NUM_BUCKETS;
+  const int total = warm + 4096;
+  std::string doc = "{\"market_data_entries\": [";
+  char buf[256];
+  for (int i = 0; i < total; ++i) {
+    std::snprintf(buf, sizeof buf,
+                  "%s{\"utc_epoch_ns\": %lld, \"bids\": [{\"price\": %.3f, "
+                  "\"amount\": 1}, {\"price\": 99, \"amount\": 2}], "
+                  "\"asks\": [{\"price\": 101, \"amount\": 1}]}",
+                  i ? ", " : "", static_cast<long long>(i * bucket + 5),
+                  100.0 + (i % 7) * 0.1);
+    doc += buf;
+  }
+  doc += "]}";
+
+  for (bool batched : {false, true}) {
+    Pow2MarketDataCache cache(0.0, 5.0);
+    MarketDataJsonReader reader(doc.data(), doc.data() + doc.size());
+    RunArena<PriceLevel> levels;
+    std::vector<MarketDataEntryView> batch;
+    batch.reserve(64);
+    MarketDataEntryView v{};
+    int parsed = 0;
+    int64_t before = 0;
+    while (reader.next(v, levels)) {
+      if (++parsed == warm)
+        before = g_allocations.load();
+      if (batched) {
+        batch.push_back(v);
+        if (batch.size() == 64) {
+          cache.insert_batch(batch);
+          batch.clear();
+          levels.reset();
+        }
+      } else {
+        cache.insert(v);
+        levels.reset();
+      }
+    }
+    CHECK(before > 0); // warm-up did allocate, so the counter is live
+    CHECK(g_allocations.load() == before);
+    CHECK(cache.count() == Pow2MarketDataCache::NUM_BUCKETS);
+  }
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 28: spread slab lists against vectors
+// ---------------------------------------------------------------------------
+void test_spread_slab() {
+  std::printf("  test_spread_slab ... ");
+
+  SpreadSlab slab;
+  std::vector<SpreadSlab::List> lists(64);
+  std::vector<std::vector<double>> model(64);
+  auto contents = [&](const SpreadSlab::List &l) {
+    std::vector<double> out;
+    slab.for_each_run(l, [&](const double *run, size_t n) {
+      out.insert(out.end(), run, run + n);
+    });
+    return out;
+  };
+
+  std::mt19937_64 rng(28);
+  std::uniform_int_distribution<int> pick(0, 63), op(0, 999);
+  double next = 0;
+  size_t pages_after_first_round = 0;
+  for (int round = 0; round < 4; ++round) {
+    for (int i = 0; i < 200'000; ++i) {
+      int k = pick(rng), o = op(rng);
+      if (o < 2) {
+        slab.clear(lists[k]);
+        model[k].clear();
+      } else if (o < 3) {
+        std::vector<double> vals(rng() % 1500);
+        for (double &v : vals)
+          v = next++;
+        slab.assign(lists[k], vals.data(), vals.size());
+        model[k] = vals;
+      } else {
+        slab.push_back(lists[k], next);
+        model[k].push_back(next++);
+      }
+    }
+    for (int k = 0; k < 64; ++k) {
+      CHECK(slab.size(lists[k]) == model[k].size());
+      CHECK(contents(lists[k]) == model[k]);
+    }
+
+    // reset drops every list at once; the old handles read as empty and
+    // clear harmlessly, and the pages are reused.
+    slab.reset(false);
+    for (int k = 0; k < 64; ++k) {
+      CHECK(slab.size(lists[k]) == 0 && contents(lists[k]).empty());
+      slab.clear(lists[k]);
+      model[k].clear();
+    }
+    if (round == 0)
+      pages_after_first_round = slab.memory_usage();
+    else
+      CHECK(slab.memory_usage() <= pages_after_first_round * 2);
+  }
+  slab.reset(true);
+  CHECK(slab.memory_usage() == 0);
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 29: multi-producer ingestor matches sequential inserts
+// ---------------------------------------------------------------------------
+void test_ingestor() {
+  std::printf("  test_ingestor ... ");
+
+  bool threw = false;
+  try {
+    MarketDataCache c;
+    MarketDataIngestor none(c, 0);
+  } catch (const std::invalid_argument &) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  // Four feeds interleaved in time over ten minutes (well inside the
+  // window, so the result does not depend on the order ticks land in).
+  // Every 97th entry has no asks and must be dropped. A tiny ring forces
+  // producers through the full-ring path.
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const int feeds = 4, per_feed = 50'000;
+  std::vector<std::vector<MarketDataEntry>> feed(feeds);
+  for (int p = 0; p < feeds; ++p)
+    for (int i = 0; i < per_feed; ++i) {
+      int64_t t = t0 + (static_cast<int64_t>(i) * feeds + p) * 3'000'000LL;
+      MarketDataEntry e = make_entry(t, 100.0, 100.0 + ((i * 7 + p) % 97) * 0.1);
+      if (i % 97 == 0)
+        e.asks.clear();
+      feed[p].push_back(std::move(e));
+    }
+
+  MarketDataCache reference(0.0, 10.0);
+  for (auto &f : feed)
+    for (auto &e : f)
+      reference.insert(e);
+
+  for (size_t ring : {size_t{16}, MarketDataIngestor::DEFAULT_RING_CAPACITY}) {
+    MarketDataCache cache(0.0, 10.0);
+    {
+      MarketDataIngestor ingest(cache, feeds, ring);
+      std::vector<std::thread> threads;
+      for (int p = 0; p < feeds; ++p)
+        threads.emplace_back([&, p] {
+          for (auto &e : feed[p])
+            ingest.producer(p).push(e);
+        });
+      for (auto &t : threads)
+        t.join();
+      ingest.flush();
+      CHECK(cache.count() == reference.count());
+      CHECK(ingest.applied() == static_cast<uint64_t>(reference.count()));
+
+      // Staged but not flushed: the destructor applies it.
+      ingest.producer(0).push(make_entry(t0 + 700 * SEC, 100.0, 101.0));
+    }
+    CHECK(cache.count() == reference.count() + 1);
+    int64_t end = t0 + 600 * SEC;
+    CHECK(same_pctls(cache.spread_percentiles_exact(t0, end),
+                     reference.spread_percentiles_exact(t0, end)));
+    CHECK(cache.min_spread(t0, end) == reference.min_spread(t0, end));
+    CHECK(cache.max_spread(t0, end) == reference.max_spread(t0, end));
+    CHECK(cache.count_range(t0, end) == reference.count_range(t0, end));
+  }
+
+  // An idle applier goes to sleep and is woken by the next push.
+  MarketDataCache cache(0.0, 10.0);
+  MarketDataIngestor ingest(cache, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ingest.producer(0).push(make_entry(t0, 100.0, 101.0));
+  ingest.flush();
+  CHECK(cache.count() == 1);
+  ingest.stop();
+  ingest.stop();
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 30: parallel exact quantiles match the sequential path
+// ---------------------------------------------------------------------------
+void test_exact_parallel() {
+  std::printf("  test_exact_parallel ... ");
+
+  // 300k ticks over 20 minutes. Spreads repeat on a 0.25 grid and a few
+  // fall outside the histogram, so target bins include the clamped edge
+  // bins and ranks land inside runs of equal values.
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const int64_t span = 1200 * SEC;
+  std::mt19937_64 rng(21);
+  std::uniform_int_distribution<int64_t> time_dist(0, span - 1);
+  std::uniform_int_distribution<int> grid(2, 32);
+  std::uniform_int_distribution<int> tail(0, 99);
+  std::vector<MarketDataCache::SpreadTick> ticks(300'000);
+  for (auto &t : ticks) {
+    int r = tail(rng);
+    double spread = r == 0   ? -3.0
+                    : r == 1 ? 15.0 + grid(rng)
+                             : grid(rng) * 0.25;
+    t = {t0 + time_dist(rng), spread};
+  }
+  std::sort(ticks.begin(), ticks.end(),
+            [](auto &a, auto &b) { return a.time < b.time; });
+
+  const std::vector<double> qs = {0.0, 0.01, 0.1, 0.5, 0.5, 0.9, 0.999, 1.0};
+  auto same = [](const std::vector<double> &a, const std::vector<double> &b) {
+    if (a.size() != b.size())
+      return false;
+    for (size_t i = 0; i < a.size(); ++i)
+      if (!(a[i] == b[i] || (std::isnan(a[i]) && std::isnan(b[i]))))
+        return false;
+    return true;
+  };
+
+  std::vector<std::pair<int64_t, int64_t>> ranges = {
+      {t0, t0 + span - 1},               // everything
+      {t0 + 100 * SEC, t0 + 900 * SEC},  // parallel path
+      {t0 + 600 * SEC, t0 + 601 * SEC},  // below the threshold
+      {t0 - 600 * SEC, t0 - 1},          // before the data
+      {t0 - 600 * SEC, t0 + 1000 * SEC}}; // clipped to the window
+  std::uniform_int_distribution<int64_t> start_dist(0, span / 2);
+  for (int i = 0; i < 6; ++i) {
+    int64_t a = t0 + start_dist(rng);
+    ranges.push_back({a, a + span / 2});
+  }
+
+  for (auto [layout, storage] :
+       {std::pair{MarketDataCache::HistIndex::BinMajorFenwick,
+                  MarketDataCache::Storage::Dense},
+        std::pair{MarketDataCache::HistIndex::BucketMajorFenwick,
+                  MarketDataCache::Storage::Compact}}) {
+    MarketDataCache cache(0.0, 10.0, layout, storage);
+    cache.insert_spreads(ticks);
+    for (auto [a, b] : ranges) {
+      auto expected = cache.spread_quantiles_exact(a, b, qs);
+      for (unsigned threads : {1u, 2u, 3u, 8u, 0u})
+        CHECK(same(cache.spread_quantiles_exact_parallel(a, b, qs, threads),
+                   expected));
+      CHECK(same_pctls(cache.spread_percentiles_exact_parallel(a, b, 4),
+                       cache.spread_percentiles_exact(a, b)));
+    }
+    CHECK(cache.spread_quantiles_exact_parallel(t0, t0 + span, {}).empty());
+  }
+
+  // A writer runs between lock slices. Appends past the range and a cut
+  // before it leave the answer alone; a cut into the range yields the state
+  // before or after it, never a mix of the two. Spreads drift upwards over
+  // time, so the cut moves every quantile.
+  {
+    std::vector<MarketDataCache::SpreadTick> drift = ticks;
+    for (auto &t : drift)
+      t.spread = 10.0 * static_cast<double>(t.time - t0) / span;
+    MarketDataCache cache(0.0, 10.0);
+    cache.insert_spreads(drift);
+    int64_t a = t0 + 600 * SEC, b = t0 + span - 1;
+    auto before = cache.spread_quantiles_exact(a, b, qs);
+    MarketDataCache cut(0.0, 10.0);
+    cut.insert_spreads(drift);
+    cut.remove_up_to(t0 + 700 * SEC);
+    auto after = cut.spread_quantiles_exact(a, b, qs);
+    CHECK(!same(before, after));
+
+    std::atomic<bool> done{false};
+    std::thread writer([&] {
+      std::vector<MarketDataCache::SpreadTick> more(50);
+      for (int i = 0; i < 300; ++i) {
+        for (int k = 0; k < 50; ++k)
+          more[k] = {t0 + span + (i * 50 + k) * 1'000'000LL, 1.0 + k % 8};
+        cache.insert_spreads(more);
+        if (i == 100)
+          cache.remove_up_to(t0 + 300 * SEC);
+        if (i == 200)
+          cache.remove_up_to(t0 + 700 * SEC);
+        std::this_thread::yield();
+      }
+      done = true;
+    });
+    int queries = 0;
+    while (!done || queries < 4) {
+      auto got = cache.spread_quantiles_exact_parallel(a, b, qs, 4);
+      CHECK(same(got, before) || same(got, after));
+      ++queries;
+    }
+    writer.join();
+    CHECK(same(cache.spread_quantiles_exact_parallel(a, b, qs, 4), after));
+  }
+
+  // With the exact index on, the parallel call defers to it.
+  MarketDataCache indexed(0.0, 10.0);
+  indexed.insert_spreads(ticks);
+  indexed.enable_exact_index();
+  CHECK(same(indexed.spread_quantiles_exact_parallel(t0, t0 + span, qs, 4),
+             indexed.spread_quantiles_exact(t0, t0 + span, qs)));
+
+  bool threw = false;
+  try {
+    std::vector<double> bad = {1.5};
+    indexed.spread_quantiles_exact_parallel(t0, t0 + span, bad);
+  } catch (const std::invalid_argument &) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 31: instrumentation counts calls, lock phases and events
+// ---------------------------------------------------------------------------
+void test_instrumentation() {
+  std::printf("  test_instrumentation ... ");
+
+  MarketDataCache cache(0.0, 10.0);
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  for (int i = 0; i < 1000; ++i)
+    cache.insert(make_entry(t0 + i * SEC, 100.0, 101.0 + (i % 7) * 0.1));
+  for (int i = 0; i < 10; ++i)
+    cache.count_range(t0, t0 + 500 * SEC);
+  cache.spread_percentiles_exact(t0, t0 + 500 * SEC);
+  cache.min_spread(t0, t0 + 10 * SEC);
+
+  CacheStats s = cache.stats();
+  CHECK(s.enabled == CacheInstrument::ENABLED);
+  if (!CacheInstrument::ENABLED) {
+    CHECK(s.op(CacheOp::Insert).total.count == 0);
+    CHECK(s.to_string().find("compiled out") != std::string::npos);
+    std::printf("PASS (compiled out)\n");
+    return;
+  }
+
+  // insert(MarketDataEntry) forwards to insert(view): counted once.
+  const auto &ins = s.op(CacheOp::Insert);
+  CHECK(ins.total.count == 1000);
+  CHECK(ins.lock_wait.count == 1000 && ins.locked.count == 1000);
+  CHECK(ins.total.p50_ns > 0 && ins.total.p50_ns <= ins.total.max_ns);
+  CHECK(ins.total.p99_ns <= ins.total.max_ns);
+  CHECK(s.op(CacheOp::CountRange).total.count == 10);
+  // Optimistic reads take no lock unless they collide with a writer.
+  CHECK(s.op(CacheOp::CountRange).lock_wait.count == 0);
+  CHECK(s.op(CacheOp::QuantilesExact).total.count == 1);
+  CHECK(s.op(CacheOp::QuantilesExact).lock_wait.count == 1);
+  CHECK(s.op(CacheOp::MinMax).total.count == 1);
+  CHECK(s.op(CacheOp::Summary).total.count == 0);
+  CHECK(s.counter(CacheCounter::FenwickUpdates) == 1000);
+  CHECK(s.counter(CacheCounter::BucketsEvicted) == 0);
+  CHECK(s.to_string().find("insert") != std::string::npos);
+
+  // Sliding an hour past drops every bucket; remove_up_to is timed too.
+  cache.insert(make_entry(t0 + 5000 * SEC, 100.0, 101.0));
+  cache.remove_up_to(t0 + 6000 * SEC);
+  s = cache.stats();
+  CHECK(s.counter(CacheCounter::BucketsEvicted) == 1001);
+  CHECK(s.op(CacheOp::RemoveUpTo).total.count == 1);
+
+  // Other threads record into their own shards; the snapshot sums them.
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+    threads.emplace_back([&] {
+      for (int i = 0; i < 500; ++i)
+        cache.count_range(t0, t0 + 6000 * SEC);
+    });
+  for (auto &t : threads)
+    t.join();
+  CHECK(cache.stats().op(CacheOp::CountRange).total.count == 10 + 2000);
+
+  // Stats move with the cache; reset_stats starts over.
+  MarketDataCache moved(std::move(cache));
+  CHECK(moved.stats().op(CacheOp::Insert).total.count == 1001);
+  moved.reset_stats();
+  s = moved.stats();
+  CHECK(s.op(CacheOp::Insert).total.count == 0);
+  CHECK(s.counter(CacheCounter::BucketsEvicted) == 0);
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 32: book metrics match a brute-force reference
+// ---------------------------------------------------------------------------
+void test_book_metrics() {
+  std::printf("  test_book_metrics ... ");
+
+  // BookTop keeps the best levels of unsorted sides, and reads a sorted
+  // book the same way with BestFirst.
+  {
+    std::vector<PriceLevel> bids = {{99.0, 1}, {99.5, 2}, {98.0, 3},
+                                    {std::nan(""), 9}, {99.2, 4}};
+    std::vector<PriceLevel> asks = {{101.0, 5}, {100.2, 6}, {100.7, 7}};
+    MarketDataEntryView view{0, bids, asks};
+    BookTop top;
+    top.build(view, LevelOrder::Unsorted, 3);
+    CHECK(top.two_sided && top.num_bids == 3 && top.num_asks == 3);
+    CHECK(top.bids[0].price == 99.5 && top.bids[1].price == 99.2 &&
+          top.bids[2].price == 99.0);
+    CHECK(top.asks[0].price == 100.2 && top.asks[2].price == 101.0);
+    CHECK(top.spread() == view.compute_spread());
+    CHECK(top.bid_depth(2) == 6.0 && top.ask_depth(10) == 18.0);
+
+    std::vector<PriceLevel> sorted_bids(top.bids, top.bids + 3);
+    std::vector<PriceLevel> sorted_asks(top.asks, top.asks + 3);
+    BookTop first;
+    first.build({0, sorted_bids, sorted_asks}, LevelOrder::BestFirst, 2);
+    CHECK(first.num_bids == 2 && first.bids[1].price == 99.2);
+    CHECK(first.spread() == top.spread());
+
+    MetricSpec micro{BookMetric::Microprice};
+    CHECK_NEAR(micro.eval(top), (99.5 * 6 + 100.2 * 2) / 8.0, 1e-12);
+    MetricSpec imb{BookMetric::Imbalance, 2};
+    CHECK_NEAR(imb.eval(top), (6.0 - 13.0) / 19.0, 1e-12);
+  }
+
+  // Books of 1-5 unsorted levels a side; some have no amount at all, so
+  // their imbalance and microprice are NaN and left out.
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const int64_t span = 5400 * SEC;
+  std::mt19937_64 rng(33);
+  std::uniform_int_distribution<int64_t> time_dist(0, span - 1);
+  std::uniform_int_distribution<int> level_dist(1, 5);
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  std::vector<int64_t> times;
+  for (int i = 0; i < 30'000; ++i) {
+    int64_t t = time_dist(rng);
+    if (t < 3000 * SEC || t > 3100 * SEC)
+      times.push_back(t0 + t);
+  }
+  std::sort(times.begin(), times.end());
+  std::vector<MarketDataEntry> entries;
+  for (int64_t t : times) {
+    MarketDataEntry e;
+    e.time = t;
+    bool empty = u(rng) < 0.05;
+    for (int k = level_dist(rng); k-- > 0;)
+      e.bids.push_back({100.0 - 2.0 * u(rng), empty ? 0.0 : 5.0 * u(rng)});
+    for (int k = level_dist(rng); k-- > 0;)
+      e.asks.push_back({100.5 + 2.0 * u(rng), empty ? 0.0 : 5.0 * u(rng)});
+    entries.push_back(std::move(e));
+  }
+  // Replayed after remove_up_to below: minutes 33-43 again, 57 minutes
+  // later, so they land in ring slots the cut emptied.
+  const size_t n_main = entries.size();
+  for (size_t i = 0; i < n_main; ++i) {
+    if (entries[i].time >= t0 + 2000 * SEC &&
+        entries[i].time < t0 + 2600 * SEC) {
+      entries.push_back(entries[i]);
+      entries.back().time += 3400 * SEC;
+    }
+  }
+
+  // Amount-weighted price of the best three levels of both sides.
+  auto vwap3 = +[](const BookTop &top) {
+    double pq = 0.0, q = 0.0;
+    for (int i = 0; i < std::min(top.num_bids, 3); ++i) {
+      pq += top.bids[i].price * top.bids[i].amount;
+      q += top.bids[i].amount;
+    }
+    for (int i = 0; i < std::min(top.num_asks, 3); ++i) {
+      pq += top.asks[i].price * top.asks[i].amount;
+      q += top.asks[i].amount;
+    }
+    return q > 0.0 ? pq / q : std::nan("");
+  };
+  const std::vector<MetricSpec> specs = {
+      {BookMetric::Mid},
+      {BookMetric::Microprice},
+      {BookMetric::Depth, 2},
+      {BookMetric::Imbalance, 3},
+      {BookMetric::Custom, 3, vwap3},
+  };
+
+  // Reference values from sorted copies of each book.
+  const size_t M = specs.size();
+  std::vector<double> ref(entries.size() * M);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    auto bids = entries[i].bids, asks = entries[i].asks;
+    std::sort(bids.begin(), bids.end(),
+              [](auto &a, auto &b) { return a.price > b.price; });
+    std::sort(asks.begin(), asks.end(),
+              [](auto &a, auto &b) { return a.price < b.price; });
+    auto depth = [](auto &side, size_t n) {
+      double s = 0.0;
+      for (size_t k = 0; k < std::min(n, side.size()); ++k)
+        s += side[k].amount;
+      return s;
+    };
+    double *r = &ref[i * M];
+    r[0] = 0.5 * (bids[0].price + asks[0].price);
+    double qb = bids[0].amount, qa = asks[0].amount;
+    r[1] = qb + qa > 0 ? (bids[0].price * qa + asks[0].price * qb) / (qb + qa)
+                       : std::nan("");
+    r[2] = depth(bids, 2) + depth(asks, 2);
+    double b3 = depth(bids, 3), a3 = depth(asks, 3);
+    r[3] = b3 + a3 > 0 ? (b3 - a3) / (b3 + a3) : std::nan("");
+    double pq = 0.0, q = 0.0;
+    for (size_t k = 0; k < std::min<size_t>(3, bids.size()); ++k)
+      pq += bids[k].price * bids[k].amount, q += bids[k].amount;
+    for (size_t k = 0; k < std::min<size_t>(3, asks.size()); ++k)
+      pq += asks[k].price * asks[k].amount, q += asks[k].amount;
+    r[4] = q > 0 ? pq / q : std::nan("");
+  }
+
+  // Random ranges, some empty or inverted, plus one covering everything.
+  std::vector<std::pair<int64_t, int64_t>> ranges = {{t0 - SEC, t0 + 2 * span}};
+  std::uniform_int_distribution<int64_t> at(0, span + 60 * SEC);
+  for (int i = 0; i < 150; ++i) {
+    int64_t a = t0 + at(rng), b = t0 + at(rng);
+    int64_t lo = std::min(a, b), hi = std::max(a, b);
+    ranges.push_back({lo, i % 17 == 0 ? lo - 1 : hi});
+  }
+
+  const int64_t bucket = MarketDataCache::BUCKET_NS;
+  // Brute force over entries[0, last_entry), whole buckets in
+  // [max(sa, first_abs), ea].
+  auto check_all = [&](const MarketDataCache &cache, size_t last_entry,
+                       int64_t first_abs) {
+    for (auto [a, b] : ranges) {
+      int64_t sa = std::max(a / bucket, first_abs), ea = b / bucket;
+      for (size_t m = 0; m < M; ++m) {
+        int64_t n = 0;
+        double sum = 0.0, lo = INFINITY, hi = -INFINITY;
+        for (size_t i = 0; i < last_entry; ++i) {
+          int64_t abs = entries[i].time / bucket;
+          double v = ref[i * M + m];
+          if (abs < sa || abs > ea || std::isnan(v))
+            continue;
+          ++n, sum += v, lo = std::min(lo, v), hi = std::max(hi, v);
+        }
+        auto s = cache.metric_summary(static_cast<int>(m), a, b);
+        CHECK(s.count == n);
+        CHECK_NEAR(s.sum, sum, 1e-9 * (1.0 + std::abs(sum)));
+        if (n == 0) {
+          CHECK(std::isnan(s.mean) && std::isnan(s.min) && std::isnan(s.max));
+          continue;
+        }
+        CHECK_NEAR(s.mean, sum / n, 1e-9 * (1.0 + std::abs(sum / n)));
+        CHECK(s.min == lo && s.max == hi);
+      }
+    }
+  };
+  const int64_t first_abs =
+      entries[n_main - 1].time / bucket - MarketDataCache::NUM_BUCKETS + 1;
+
+  MarketDataCache plain(0.0, 10.0);
+  plain.insert_batch(std::span<const MarketDataEntry>(entries.data(), n_main));
+  for (auto storage :
+       {MarketDataCache::Storage::Dense, MarketDataCache::Storage::Compact}) {
+    // Half one by one, half in batches.
+    MarketDataCache cache(0.0, 10.0,
+                          MarketDataCache::HistIndex::BinMajorFenwick, storage);
+    for (auto &spec : specs)
+      cache.add_metric(spec);
+    CHECK(cache.num_metrics() == static_cast<int>(M));
+    size_t half = n_main / 2;
+    for (size_t i = 0; i < half; ++i)
+      cache.insert(entries[i]);
+    for (size_t i = half; i < n_main; i += 1000)
+      cache.insert_batch(std::span<const MarketDataEntry>(
+          entries.data() + i, std::min<size_t>(1000, n_main - i)));
+    check_all(cache, n_main, first_abs);
+
+    // The spread path sees exactly what a cache without metrics does.
+    for (auto [a, b] : ranges) {
+      CHECK(cache.count_range(a, b) == plain.count_range(a, b));
+      CHECK(same_pctls(cache.spread_percentiles(a, b),
+                       plain.spread_percentiles(a, b)));
+    }
+
+    // remove_up_to cuts every column (dropping most of the window, so the
+    // cut buckets are left to the sweep); the replayed tail then reuses
+    // the emptied slots, and batches rebuild leaves from their cells. A
+    // jump past the window empties everything.
+    int64_t cut = t0 + 4000 * SEC;
+    cache.remove_up_to(cut);
+    check_all(cache, n_main, cut / bucket + 1);
+    cache.insert_batch(std::span<const MarketDataEntry>(
+        entries.data() + n_main, entries.size() - n_main));
+    check_all(cache, entries.size(), cut / bucket + 1);
+    int64_t late = entries.back().time + 2 * 3600 * SEC;
+    cache.insert(make_entry(late, 100.0, 101.0));
+    auto s = cache.metric_summary(0, t0, late);
+    CHECK(s.count == 1 && s.mean == 100.5);
+    CHECK(cache.metric_summary(2, t0, late).sum == 2.0);
+  }
+
+  // A metric covers only entries inserted after it was added.
+  {
+    MarketDataCache cache(0.0, 10.0);
+    for (size_t i = 0; i < 1000; ++i)
+      cache.insert(entries[i]);
+    int id = cache.add_metric({BookMetric::Mid});
+    for (size_t i = 1000; i < 2000; ++i)
+      cache.insert(entries[i]);
+    CHECK(cache.count() == 2000);
+    CHECK(cache.metric_summary(id, t0, t0 + span).count == 1000);
+  }
+
+  // Cells are allocated as buckets take data: against a cache without the
+  // metric, filling 640 new buckets costs exactly their cells.
+  for (auto storage :
+       {MarketDataCache::Storage::Dense, MarketDataCache::Storage::Compact}) {
+    MarketDataCache with(0.0, 10.0, MarketDataCache::HistIndex::BinMajorFenwick,
+                         storage),
+        without(0.0, 10.0, MarketDataCache::HistIndex::BinMajorFenwick,
+                storage);
+    with.add_metric({BookMetric::Mid});
+    with.insert(make_entry(t0, 100.0, 101.0));
+    without.insert(make_entry(t0, 100.0, 101.0));
+    size_t with_before = with.memory_usage();
+    size_t without_before = without.memory_usage();
+    for (int64_t i = 1; i <= 640; ++i) {
+      with.insert(make_entry(t0 + i * bucket, 100.0, 101.0));
+      without.insert(make_entry(t0 + i * bucket, 100.0, 101.0));
+    }
+    size_t cells = (with.memory_usage() - with_before) -
+                   (without.memory_usage() - without_before);
+    CHECK(cells >= 640 * 4 * sizeof(double) &&
+          cells <= 2 * 640 * 4 * sizeof(double));
+    CHECK(with.metric_summary(0, t0, t0 + 641 * bucket).count == 641);
+  }
+
+  // Bad specs, too many metrics, unknown ids.
+  {
+    MarketDataCache cache;
+    int thrown = 0;
+    for (MetricSpec bad : {MetricSpec{BookMetric::Depth, 0},
+                           MetricSpec{BookMetric::Depth, 17},
+                           MetricSpec{BookMetric::Custom}}) {
+      try {
+        cache.add_metric(bad);
+      } catch (const std::invalid_argument &) {
+        ++thrown;
+      }
+    }
+    CHECK(thrown == 3 && cache.num_metrics() == 0);
+    for (int i = 0; i < MarketDataCache::MAX_METRICS; ++i)
+      CHECK(cache.add_metric({BookMetric::Depth, i + 1}) == i);
+    try {
+      cache.add_metric({BookMetric::Mid});
+    } catch (const std::length_error &) {
+      ++thrown;
+    }
+    for (int id : {-1, MarketDataCache::MAX_METRICS}) {
+      try {
+        cache.metric_summary(id, 0, 1);
+      } catch (const std::out_of_range &) {
+        ++thrown;
+      }
+    }
+    CHECK(thrown == 6);
+    CHECK(cache.metric_summary(0, 0, 1).count == 0);
+  }
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 33: worker pool runs every index once, nests and rethrows
+// ---------------------------------------------------------------------------
+void test_worker_pool() {
+  std::printf("  test_worker_pool ... ");
+
+  // Explicit threads: the shared pool may have none on a small machine.
+  WorkerPool pool(3);
+  CHECK(pool.concurrency() == 4);
+  for (unsigned count : {0u, 1u, 2u, 7u, 64u}) {
+    std::vector<std::atomic<int>> hits(count);
+    pool.run(count, [&](unsigned i) { hits[i].fetch_add(1); });
+    for (auto &h : hits)
+      CHECK(h.load() == 1);
+  }
+
+  // Every outer index fans out again on the same pool while all workers are
+  // busy with the outer job.
+  std::atomic<int64_t> sum{0};
+  pool.run(8, [&](unsigned i) {
+    pool.run(8, [&](unsigned j) { sum.fetch_add(i * 8 + j); });
+  });
+  CHECK(sum.load() == 63 * 64 / 2);
+
+  // Concurrent callers share the workers.
+  std::vector<std::thread> callers;
+  std::atomic<int> total{0};
+  for (int c = 0; c < 4; ++c)
+    callers.emplace_back([&] {
+      for (int k = 0; k < 200; ++k)
+        pool.run(5, [&](unsigned) { total.fetch_add(1); });
+    });
+  for (auto &th : callers)
+    th.join();
+  CHECK(total.load() == 4 * 200 * 5);
+
+  std::atomic<int> ran{0};
+  bool threw = false;
+  try {
+    pool.run(16, [&](unsigned i) {
+      ran.fetch_add(1);
+      if (i % 5 == 3)
+        throw std::runtime_error("task failed");
+    });
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  CHECK(threw && ran.load() == 16);
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Test 34: a partial gap costs the writer no tree pass over the cut
+// ---------------------------------------------------------------------------
+void test_partial_gap_latency() {
+  std::printf("  test_partial_gap_latency ... ");
+
+  using HI = MarketDataCache::HistIndex;
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const int64_t t_end = t0 + 3600LL * SEC;
+
+  // Bounds are loose against timer noise; clearing the half window on the
+  // spot takes ~15 ms.
+  const double op_limit_us = 2000.0, p99_limit_ns = 50'000.0;
+  for (auto layout : {HI::BinMajorFenwick, HI::BucketMajorFenwick}) {
+    for (bool remove : {false, true}) {
+      double best = 1e300;
+      std::pair<double, double> next{};
+      for (int rep = 0; rep < 3; ++rep) {
+        MarketDataCache cache(0.0, 10.0, layout);
+        std::vector<MarketDataEntry> batch;
+        for (int64_t t = t0; t < t_end; t += 36'000'000LL)
+          batch.push_back(make_entry(t, 100.0, 100.5 + (t / SEC % 73) * 0.1));
+        cache.insert_batch(batch);
+
+        int64_t resume = remove ? t_end : t_end + 1800LL * SEC;
+        double us = bench_us([&] {
+          if (remove)
+            cache.remove_up_to(t0 + 1800LL * SEC);
+          else
+            cache.insert(make_entry(resume, 100.0, 101.0));
+        });
+        best = std::min(best, us);
+        // The feed resumes across the cut while it is being swept.
+        next = latency_p50_p99(
+            [&](int i) {
+              cache.insert(make_entry(resume + (i + 1) * 10'000'000LL, 100.0,
+                                      101.0));
+            },
+            20'000);
+        CHECK(cache.count() == cache.count_range(t0, resume + 200LL * SEC));
+      }
+      CHECK(best < op_limit_us);
+      CHECK(next.second < p99_limit_ns);
+    }
+  }
+
+  std::printf("PASS\n");
+}
+
+// ---------------------------------------------------------------------------
+// Performance benchmark
+// ---------------------------------------------------------------------------
+void benchmark_registry() {
+  std::printf("\n=== Registry fan-out (500 symbols, p50 over last 5 min) ===\n");
+
+  MarketDataRegistry reg(0, 0.0, 10.0);
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::vector<std::string> symbols;
+  for (int i = 0; i < 500; ++i)
+    symbols.push_back("SYM" + std::to_string(i));
+  // A few liquid instruments tick every bucket; the long tail (compact
+  // storage) ticks every 5 s; the rest stay idle.
+  const int liquid = 16, active = 400;
+  std::vector<MarketDataEntry> ticks, sparse;
+  for (int k = 0; k < 36'000; ++k) {
+    ticks.push_back(make_entry(t0 + k * 100'000'000LL, 100.0,
+                               100.0 + 1.0 + (k % 50) * 0.1));
+    if (k % 50 == 0)
+      sparse.push_back(ticks.back());
+  }
+  for (int i = 0; i < 500; ++i) {
+    if (i < liquid)
+      reg.insert_batch(symbols[i], ticks);
+    else if (i < active)
+      reg.insert_batch(symbols[i], sparse);
+    else
+      reg.get_or_create(symbols[i]);
+  }
+  size_t liquid_bytes = 0, sparse_bytes = 0;
+  for (int i = 0; i < active; ++i)
+    (i < liquid ? liquid_bytes : sparse_bytes) +=
+        reg.find(symbols[i])->memory_usage();
+  std::printf("  sizeof(MarketDataCache) = %zu bytes (idle instrument)\n",
+              sizeof(MarketDataCache));
+  std::printf("  %d liquid: %6.1f MB each   %d sparse: %6.2f MB each\n",
+              liquid, liquid_bytes / 1e6 / liquid, active - liquid,
+              sparse_bytes / 1e6 / (active - liquid));
+
+  int64_t hi = ticks.back().time, lo = hi - 300 * SEC;
+  volatile double sink = 0;
+  double seq_us = bench_us(
+      [&] {
+        for (auto &s : symbols)
+          sink = std::get<1>(reg.find(s)->spread_percentiles(lo, hi));
+      },
+      20);
+  double par_us = bench_us(
+      [&] { sink = std::get<1>(reg.spread_percentiles(symbols, lo, hi)[0]); },
+      20);
+  std::printf("  sequential loop: %8.1f us   parallel fan-out (%zu shards): "
+              "%8.1f us\n",
+              seq_us, reg.num_shards(), par_us);
+}
+
+void benchmark_reader_stress() {
+  std::printf("\n=== Multi-reader Stress (1 writer, seqlock readers) ===\n");
+
+  unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+  for (int readers = 1; readers <= static_cast<int>(std::max(4u, hw));
+       readers *= 2) {
+    const int ms = 500;
+    auto res = run_reader_stress(readers, ms);
+    CHECK(res.consistent);
+    std::printf("  %2d readers:  %8.2f M queries/s total  (%6.2f M/s per "
+                "reader)   writer %6.2f M inserts/s\n",
+                readers, res.reads / (ms * 1e3),
+                res.reads / (ms * 1e3) / readers, res.writes / (ms * 1e3));
+  }
+}
+
+void benchmark_hist_index() {
+  std::printf("\n=== Histogram Index Benchmark (spread_percentiles) ===\n");
+
+  const int N = 1'000'000;
+  const int Q = 50'000;
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> spread_dist(0.5, 8.0);
+  std::uniform_int_distribution<int64_t> time_dist(0, 3500LL * SEC);
+  std::vector<MarketDataEntry> entries(N);
+  for (auto &e : entries)
+    e = make_entry(t0 + time_dist(rng), 100.0, 100.0 + spread_dist(rng));
+  std::sort(entries.begin(), entries.end(),
+            [](auto &a, auto &b) { return a.time < b.time; });
+
+  std::uniform_int_distribution<int64_t> qdist(0, 3000LL * SEC);
+  std::uniform_int_distribution<int64_t> wdist(1LL * SEC, 600LL * SEC);
+  std::vector<std::pair<int64_t, int64_t>> queries(Q);
+  for (auto &q : queries) {
+    q.first = t0 + qdist(rng);
+    q.second = q.first + wdist(rng);
+  }
+
+  using HI = MarketDataCache::HistIndex;
+  using ST = MarketDataCache::Storage;
+  struct Config {
+    const char *name;
+    HI hi;
+    ST st;
+  };
+  for (auto [name, hi, st] :
+       {Config{"bin-major Fenwick   ", HI::BinMajorFenwick, ST::Dense},
+        Config{"bucket-major Fenwick", HI::BucketMajorFenwick, ST::Dense},
+        Config{"compact (blocked)   ", HI::BucketMajorFenwick, ST::Compact}}) {
+    MarketDataCache cache(0.0, 10.0, hi, st);
+    double ins_us = bench_us([&] {
+      for (auto &e : entries)
+        cache.insert(e);
+    });
+    volatile double sink = 0;
+    auto [p50, p99] = latency_p50_p99(
+        [&](int i) {
+          auto [a, b, c] =
+              cache.spread_percentiles(queries[i].first, queries[i].second);
+          sink = a + b + c;
+        },
+        Q);
+    std::printf("  %s  insert %4.0f ns/op   query p50 %6.0f ns  p99 %6.0f ns"
+                "   %5.1f MB\n",
+                name, ins_us * 1000.0 / N, p50, p99,
+                cache.memory_usage() / 1e6);
+  }
+}
+
+void benchmark_json_load() {
+  std::printf("\n=== JSON Load Benchmark ===\n");
+
+  std::string path = temp_path("market_cache_load_bench.json");
+  size_t bytes = write_synthetic_json(path, 20'000, 10);
+  double mb = bytes / (1024.0 * 1024.0);
+  std::printf("  Synthetic file: %.1f MB, 20000 entries x 10 levels\n", mb);
+
+  auto report = [&](const char *name, double us) {
+    std::printf("  %-34s %8.1f ms  (%7.1f MB/s)\n", name, us / 1000.0,
+                mb / (us / 1e6));
+  };
+
+  volatile size_t sink = 0;
+  report("parse_market_data_json (legacy):", bench_us([&] {
+           std::ifstream ifs(path);
+           std::ostringstream oss;
+           oss << ifs.rdbuf();
+           sink = parse_market_data_json(oss.str()).size();
+         }));
+  report("MarketDataJsonReader (mmap):", bench_us([&] {
+           MappedFile file(path);
+           MarketDataJsonReader reader(file.begin(), file.end());
+           MarketDataEntry e{};
+           size_t n = 0;
+           while (reader.next(e))
+             ++n;
+           sink = n;
+         }));
+  report("with_file (legacy, + insert):", bench_us([&] {
+           sink = MarketDataCache::with_file(path, 0.0, 10.0).count();
+         }));
+  report("with_file_mmap (+ insert):", bench_us([&] {
+           sink = MarketDataCache::with_file_mmap(path, 0.0, 10.0).count();
+         }));
+  unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned threads = 2; threads <= hw; threads *= 2) {
+    char name[64];
+    std::snprintf(name, sizeof(name), "with_file_parallel (%u threads):",
+                  threads);
+    report(name, bench_us([&] {
+             sink = MarketDataCache::with_file_parallel(path, 0.0, 10.0,
+                                                        threads)
+                        .count();
+           }));
+  }
+
+  std::filesystem::remove(path);
+}
+
+void benchmark_performance() {
+  std::printf("\n=== Performance Benchmark ===\n");
+
+  const int N = 1'000'000;
+  const int Q = 100'000;
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> spread_dist(0.5, 8.0);
+  std::uniform_int_distribution<int64_t> time_dist(0, 3500LL * SEC);
+
+  MarketDataCache cache(0.0, 10.0);
+
+  // --- Insertion benchmark ---
+  std::vector<MarketDataEntry> entries(N);
+  for (int i = 0; i < N; ++i) {
+    double spread = spread_dist(rng);
+    double bid = 100.0;
+    entries[i] = make_entry(t0 + time_dist(rng), bid, bid + spread);
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](auto &a, auto &b) { return a.time < b.time; });
+
+  double ins_us = bench_us(
+      [&] {
+        MarketDataCache c(0.0, 10.0);
+        for (auto &e : entries)
+          c.insert(e);
+      },
+      1);
+  std::printf("  Insert %d entries:          %.1f ms  (%.0f ns/insert, "
+              "%.2f M entries/s)\n",
+              N, ins_us / 1000.0, ins_us * 1000.0 / N, N / ins_us);
+
+  for (size_t batch : {64, 1024, 16384}) {
+    double us = bench_us(
+        [&] {
+          MarketDataCache c(0.0, 10.0);
+          for (size_t i = 0; i < entries.size(); i += batch)
+            c.insert_batch(std::span(entries).subspan(
+                i, std::min(batch, entries.size() - i)));
+        },
+        1);
+    std::printf("  insert_batch (batch=%5zu):   %.1f ms  (%.0f ns/insert, "
+                "%.2f M entries/s)\n",
+                batch, us / 1000.0, us * 1000.0 / N, N / us);
+  }
+
+  for (auto &e : entries)
+    cache.insert(e);
+  std::printf("  Cache count: %lld\n", (long long)cache.count());
+
+  // --- Generate random query ranges ---
+  struct QueryRange {
+    int64_t s, e;
+  };
+  std::vector<QueryRange> queries(Q);
+  std::uniform_int_distribution<int64_t> qdist(0, 3000LL * SEC);
+  std::uniform_int_distribution<int64_t> wdist(1LL * SEC, 600LL * SEC);
+  for (int i = 0; i < Q; ++i) {
+    int64_t qs = t0 + qdist(rng);
+    int64_t qe = qs + wdist(rng);
+    queries[i] = {qs, qe};
+  }
+
+  // --- count_range ---
+  {
+    volatile int64_t sink = 0;
+    double us = bench_us(
+        [&] {
+          for (auto &q : queries)
+            sink = cache.count_range(q.s, q.e);
+        },
+        3);
+    std::printf("  count_range  (%d queries):  %.1f ms  (%.0f ns/query)\n", Q,
+                us / 1000.0, us * 1000.0 / Q);
+  }
+
+  // --- min_spread ---
+  {
+    volatile double sink = 0;
+    double us = bench_us(
+        [&] {
+          for (auto &q : queries)
+            sink = cache.min_spread(q.s, q.e);
+        },
+        3);
+    std::printf("  min_spread   (%d queries):  %.1f ms  (%.0f ns/query)\n", Q,
+                us / 1000.0, us * 1000.0 / Q);
+  }
+
+  // --- max_spread ---
+  {
+    volatile double sink = 0;
+    double us = bench_us(
+        [&] {
+          for (auto &q : queries)
+            sink = cache.max_spread(q.s, q.e);
+        },
+        3);
+    std::printf("  max_spread   (%d queries):  %.1f ms  (%.0f ns/query)\n", Q,
+                us / 1000.0, us * 1000.0 / Q);
+  }
+
+  // --- spread_percentiles (approximate) ---
+  {
+    volatile double sink = 0;
+    double us = bench_us(
+        [&] {
+          for (auto &q : queries) {
+            auto [a, b, c] = cache.spread_percentiles(q.s, q.e);
+            sink = a + b + c;
+          }
+        },
+        3);
+    std::printf(
+        "  spread_pctls (%d queries):  %.1f ms  (%.0f ns/query)  [approx]\n", Q,
+        us / 1000.0, us * 1000.0 / Q);
+  }
+
+  // --- spread_percentiles (exact, fewer queries since it's slower) ---
+  {
+    int Qe = std::min(Q, 1000);
+    volatile double sink = 0;
+    double us = bench_us(
+        [&] {
+          for (int i = 0; i < Qe; ++i) {
+            auto &q = queries[i];
+            auto [a, b, c] = cache.spread_percentiles_exact(q.s, q.e);
+            sink = a + b + c;
+          }
+        },
+        1);
+    std::printf(
+        "  spread_pctls (%d queries):  %.1f ms  (%.0f ns/query)  [exact]\n", Qe,
+        us / 1000.0, us * 1000.0 / Qe);
+  }
+
+  // --- spread_quantiles: nine quantiles per call ---
+  {
+    const double qs[] = {0.001, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999};
+    volatile double sink = 0;
+    double us = bench_us(
+        [&] {
+          for (auto &q : queries)
+            sink = cache.spread_quantiles(q.s, q.e, qs)[4];
+        },
+        3);
+    std::printf(
+        "  spread_quantiles k=9 (%d queries):  %.1f ms  (%.0f ns/query)  "
+        "[approx]\n",
+        Q, us / 1000.0, us * 1000.0 / Q);
+
+    int Qe = std::min(Q, 1000);
+    us = bench_us(
+        [&] {
+          for (int i = 0; i < Qe; ++i)
+            sink = cache.spread_quantiles_exact(queries[i].s, queries[i].e,
+                                                qs)[4];
+        },
+        1);
+    std::printf(
+        "  spread_quantiles k=9 (%d queries):  %.1f ms  (%.0f ns/query)  "
+        "[exact]\n",
+        Qe, us / 1000.0, us * 1000.0 / Qe);
+
+    double enable_ms = bench_us([&] { cache.enable_sketch(0.01); }) / 1000.0;
+    us = bench_us(
+        [&] {
+          for (auto &q : queries)
+            sink = cache.spread_quantiles_sketch(q.s, q.e, qs)[4];
+        },
+        3);
+    std::printf(
+        "  spread_quantiles k=9 (%d queries):  %.1f ms  (%.0f ns/query)  "
+        "[sketch 1%%, built in %.1f ms]\n",
+        Q, us / 1000.0, us * 1000.0 / Q, enable_ms);
+  }
+}
+
+void benchmark_exact_index() {
+  std::printf("\n=== Exact quantiles: collect + select vs index "
+              "(1M ticks / hour, p10/p50/p90) ===\n");
+
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::mt19937_64 rng(11);
+  std::uniform_real_distribution<double> spread_dist(0.5, 8.0);
+  std::uniform_int_distribution<int64_t> time_dist(0, 3600LL * SEC - 1);
+  std::vector<MarketDataEntry> entries(1'000'000);
+  for (auto &e : entries) {
+    double spread = spread_dist(rng);
+    e = make_entry(t0 + time_dist(rng), 100.0, 100.0 + spread);
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](auto &a, auto &b) { return a.time < b.time; });
+
+  MarketDataCache plain(0.0, 10.0), indexed(0.0, 10.0);
+  indexed.enable_exact_index();
+  double plain_ms = bench_us([&] {
+                      for (auto &e : entries)
+                        plain.insert(e);
+                    }) /
+                    1000.0;
+  double indexed_ms = bench_us([&] {
+                        for (auto &e : entries)
+                          indexed.insert(e);
+                      }) /
+                      1000.0;
+  std::printf("  insert 1M:  %.1f ms plain, %.1f ms indexed;  %.1f MB plain, "
+              "%.1f MB indexed\n",
+              plain_ms, indexed_ms, plain.memory_usage() / 1048576.0,
+              indexed.memory_usage() / 1048576.0);
+
+  int64_t t_end = t0 + 3600LL * SEC - 1;
+  std::uniform_int_distribution<int64_t> jitter(0, 30LL * SEC);
+  volatile double sink = 0;
+  for (int minutes : {1, 10, 60}) {
+    int64_t len = minutes * 60LL * SEC;
+    const int Q = 200;
+    std::vector<std::pair<int64_t, int64_t>> ranges(Q);
+    for (auto &r : ranges) {
+      int64_t e = t_end - (minutes == 60 ? 0 : jitter(rng));
+      r = {e - len + 1, e};
+    }
+    for (auto &[a, b] : ranges)
+      CHECK(same_pctls(plain.spread_percentiles_exact(a, b),
+                       indexed.spread_percentiles_exact(a, b)));
+    auto [p50_plain, p99_plain] = latency_p50_p99(
+        [&](int i) {
+          sink = std::get<1>(plain.spread_percentiles_exact(
+              ranges[i % Q].first, ranges[i % Q].second));
+        },
+        Q);
+    auto [p50_idx, p99_idx] = latency_p50_p99(
+        [&](int i) {
+          sink = std::get<1>(indexed.spread_percentiles_exact(
+              ranges[i % Q].first, ranges[i % Q].second));
+        },
+        Q);
+    std::printf("  %2d min:  collect p50 %8.1f us  p99 %8.1f us  |  index p50 "
+                "%6.1f us  p99 %6.1f us\n",
+                minutes, p50_plain / 1000.0, p99_plain / 1000.0,
+                p50_idx / 1000.0, p99_idx / 1000.0);
+  }
+  (void)sink;
+}
+
+void benchmark_rollups() {
+  std::printf("\n=== Rollup tiers (1 week at 1 tick/s, spread_summary p50) "
+              "===\n");
+
+  const int64_t HOUR = 3600LL * SEC;
+  const int64_t t0 = 277'000LL * HOUR;
+  MarketDataCache cache(0.0, 10.0);
+  cache.enable_rollups();
+  std::vector<MarketDataEntry> batch;
+  double insert_ms = bench_us([&] {
+                       for (int64_t t = t0; t < t0 + 168 * HOUR; t += SEC) {
+                         batch.push_back(make_entry(
+                             t, 100.0, 101.0 + (t / SEC % 50) * 0.1));
+                         if (batch.size() == 4096) {
+                           cache.insert_batch(batch);
+                           batch.clear();
+                         }
+                       }
+                       cache.insert_batch(batch);
+                     }) /
+                     1000.0;
+  std::printf("  insert 604800 ticks:  %.1f ms;  %.1f MB\n", insert_ms,
+              cache.memory_usage() / 1048576.0);
+
+  const double qs[] = {0.1, 0.5, 0.9};
+  int64_t t_end = t0 + 168 * HOUR - 1;
+  volatile int64_t sink = 0;
+  for (auto [label, len] : {std::pair{"1 h", HOUR}, std::pair{"1 day", 24 * HOUR},
+                            std::pair{"1 week", 168 * HOUR}}) {
+    auto [p50, p99] = latency_p50_p99(
+        [&](int i) {
+          sink = cache.spread_summary(t_end - len + 1 - i * SEC, t_end, qs)
+                     .count;
+        },
+        2000);
+    std::printf("  %-7s p50 %6.1f us  p99 %6.1f us\n", label, p50 / 1000.0,
+                p99 / 1000.0);
+  }
+  (void)sink;
+}
+
+void benchmark_eviction() {
+  std::printf("\n=== Eviction across feed gaps (writer latency) ===\n");
+
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  auto fill = [&](MarketDataCache &cache) {
+    std::vector<MarketDataEntry> batch;
+    for (int i = 0; i < 1'000'000; ++i) {
+      batch.push_back(make_entry(t0 + i * 3'600'000LL, 100.0,
+                                 100.0 + 0.5 + (i % 73) * 0.1));
+      if (batch.size() == 16384) {
+        cache.insert_batch(batch);
+        batch.clear();
+      }
+    }
+    cache.insert_batch(batch);
+  };
+  int64_t t_end = t0 + 3600LL * SEC;
+
+  // One stalled operation on a full window, then the feed resumes at
+  // `resume`, while partly evicted buckets are still being swept.
+  struct Case {
+    const char *label;
+    int64_t resume;
+    std::function<void(MarketDataCache &)> op;
+  };
+  auto gap = [&](int64_t len) {
+    return [=](MarketDataCache &c) {
+      c.insert(make_entry(t_end + len, 100.0, 101.0));
+    };
+  };
+  Case cases[] = {
+      {"gap 2 h, then one tick", t_end + 7200LL * SEC, gap(7200LL * SEC)},
+      {"gap 30 min, then one tick", t_end + 1800LL * SEC, gap(1800LL * SEC)},
+      {"gap 55 min, then one tick", t_end + 3300LL * SEC, gap(3300LL * SEC)},
+      {"gap 1 min, then one tick", t_end + 60LL * SEC, gap(60LL * SEC)},
+      {"remove_up_to(half window)", t_end,
+       [&](MarketDataCache &c) { c.remove_up_to(t0 + 1800LL * SEC); }},
+      {"remove_up_to(everything)", t_end,
+       [&](MarketDataCache &c) { c.remove_up_to(t_end + SEC); }},
+  };
+  for (auto &layout : {MarketDataCache::HistIndex::BinMajorFenwick,
+                       MarketDataCache::HistIndex::BucketMajorFenwick}) {
+    std::printf("  %s:\n", layout == MarketDataCache::HistIndex::BinMajorFenwick
+                               ? "bin-major"
+                               : "bucket-major");
+    for (auto &c : cases) {
+      MarketDataCache cache(0.0, 10.0, layout);
+      fill(cache);
+      double us = bench_us([&] { c.op(cache); });
+      // Inserts right after the stall, 10 per bucket.
+      auto [p50, p99] = latency_p50_p99(
+          [&](int i) {
+            cache.insert(make_entry(c.resume + (i + 1) * 10'000'000LL, 100.0,
+                                    101.0));
+          },
+          20'000);
+      std::printf("    %-28s %9.1f us   next inserts p50 %4.0f ns  p99 %5.0f "
+                  "ns\n",
+                  c.label, us, p50, p99);
+    }
+  }
+}
+
+void benchmark_snapshot() {
+  std::printf("\n=== Restart from snapshot (full 1 h window, 1M ticks) ===\n");
+
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::vector<MarketDataEntry> entries;
+  for (int i = 0; i < 1'000'000; ++i)
+    entries.push_back(make_entry(t0 + i * 3'600'000LL, 100.0,
+                                 100.0 + 0.5 + (i % 73) * 0.1));
+  std::string path = temp_path("market_cache_snapshot_bench.bin");
+
+  volatile int64_t sink = 0;
+  for (auto &layout : {MarketDataCache::HistIndex::BinMajorFenwick,
+                       MarketDataCache::HistIndex::BucketMajorFenwick}) {
+    std::printf("  %s:\n", layout == MarketDataCache::HistIndex::BinMajorFenwick
+                               ? "bin-major"
+                               : "bucket-major");
+    double rebuild = bench_us([&] {
+      MarketDataCache cache(0.0, 10.0, layout);
+      for (size_t i = 0; i < entries.size(); i += 16384)
+        cache.insert_batch(std::span(entries).subspan(
+            i, std::min<size_t>(16384, entries.size() - i)));
+      sink = cache.count();
+    });
+    MarketDataCache cache(0.0, 10.0, layout);
+    cache.insert_batch(entries);
+    double save = bench_us([&] { cache.save_snapshot(path); });
+    double load = bench_us(
+        [&] { sink = MarketDataCache::load_snapshot(path).count(); });
+    std::printf("    re-insert every tick       %9.1f ms\n", rebuild / 1000);
+    std::printf("    save_snapshot (%4.0f MB)    %9.1f ms\n",
+                std::filesystem::file_size(path) / (1024.0 * 1024.0),
+                save / 1000);
+    std::printf("    load_snapshot              %9.1f ms\n", load / 1000);
+    std::filesystem::remove(path);
+  }
+  (void)sink;
+}
+
+void benchmark_subscriptions() {
+  std::printf("\n=== Rolling 5 min stats: polling vs subscription "
+              "(1M ticks, full window) ===\n");
+
+  const int64_t MIN = 60LL * SEC;
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::vector<MarketDataEntry> entries;
+  for (int i = 0; i < 1'000'000; ++i)
+    entries.push_back(make_entry(t0 + i * 3'600'000LL, 100.0,
+                                 100.0 + 0.5 + (i % 73) * 0.1));
+  const double qs[] = {0.5, 0.99};
+  volatile double sink = 0;
+
+  // Ingest cost with 0, 1 and 8 live subscriptions.
+  for (int n : {0, 1, 8}) {
+    MarketDataCache cache(0.0, 10.0);
+    for (int s = 0; s < n; ++s)
+      cache.subscribe((s + 1) * MIN, qs);
+    double us = bench_us([&] {
+      for (auto &e : entries)
+        cache.insert(e);
+    });
+    std::printf("  insert, %d subscription(s)   %8.1f ns/tick\n", n,
+                us * 1000.0 / entries.size());
+  }
+
+  MarketDataCache cache(0.0, 10.0);
+  int id = cache.subscribe(5 * MIN, qs);
+  cache.insert_batch(entries);
+  int64_t now = entries.back().time;
+  const int reps = 2000;
+  double poll = bench_us(
+      [&] {
+        auto s = cache.spread_summary(now - 5 * MIN + 1, now, qs);
+        sink = s.quantiles[1];
+      },
+      reps);
+  double sub = bench_us(
+      [&] {
+        auto s = cache.rolling_stats(id);
+        sink = s.quantiles[1];
+      },
+      reps);
+  std::printf("  spread_summary(now - 5 min)  %8.2f us/query\n", poll);
+  std::printf("  rolling_stats                %8.2f us/query\n", sub);
+  (void)sink;
+}
+
+void benchmark_level_order() {
+  std::printf("\n=== compute_spread, 50 levels per side (200k entries) ===\n");
+
+  std::mt19937_64 rng(17);
+  int64_t t0 = 1'000'000'000'000'000'000LL;
+  std::vector<MarketDataEntry> entries;
+  for (int i = 0; i < 200'000; ++i)
+    entries.push_back(make_book(rng, t0 + i * 18'000'000LL, 50));
+
+  // Once over all entries (books come from memory), then many times over
+  // the first 500 (books stay in cache, so the kernel itself is timed).
+  volatile double sink = 0;
+  auto per_entry = [&](size_t n, int reps, auto &&spread) {
+    double us = bench_us([&] {
+      double acc = 0;
+      for (int r = 0; r < reps; ++r)
+        for (size_t i = 0; i < n; ++i)
+          acc += spread(entries[i]);
+      sink = acc;
+    });
+    return us * 1000.0 / (static_cast<double>(n) * reps);
+  };
+  std::printf("                               cold       hot  (ns/entry)\n");
+  auto row = [&](const char *name, auto &&spread) {
+    double cold = per_entry(entries.size(), 1, spread);
+    double hot = per_entry(500, 400, spread);
+    std::printf("  %-28s %6.1f %9.1f\n", name, cold, hot);
+  };
+  row("scalar scan", [](auto &e) { return reference_spread(e); });
+  row("compute_spread (Unsorted)", [](auto &e) { return e.compute_spread(); });
+  row("compute_spread (BestFirst)",
+      [](auto &e) { return e.compute_spread(LevelOrder::BestFirst); });
+
+  for (LevelOrder order : {LevelOrder::Unsorted, LevelOrder::BestFirst}) {
+    MarketDataCache cache(0.0, 10.0);
+    cache.set_level_order(order);
+    double us = bench_us([&] {
+      for (size_t i = 0; i < entries.size(); i += 4096)
+        cache.insert_batch(std::span(entries).subspan(
+            i, std::min<size_t>(4096, entries.size() - i)));
+    });
+    std::printf("  %-28s %6.1f\n",
+                order == LevelOrder::Unsorted ? "insert_batch (Unsorted)"
+                                              : "insert_batch (BestFirst)",
+                us * 1000.0 / entries.size());
+  }
+  (void)sink;
+}
+
+void benchmark_entry_views() {
+  std::printf("\n=== Ingest from JSON: entries vs arena views "
+              "(200k entries, 10 levels) ===\n");
+
+  std::string path = temp_path("market_cache_views_bench.json");
+  const int n = 200'000;
+  write_synthetic_json(path, n, 10, 18);
+  MappedFile file(path);
+
+  auto run = [&](const char *name, auto &&ingest) {
+    MarketDataCache cache(0.0, 10.0);
+    MarketDataJsonReader reader(file.begin(), file.end());
+    int64_t allocs = g_allocations.load();
+    double us = bench_us([&] { ingest(reader, cache); });
+    allocs = g_allocations.load() - allocs;
+    std::printf("  %-34s %7.1f ns/entry  %6.2f allocs/entry\n", name,
+                us * 1000.0 / n, static_cast<double>(allocs) / n);
+  };
+  run("fresh MarketDataEntry + insert", [](auto &reader, auto &cache) {
+    while (true) {
+      MarketDataEntry e{};
+      if (!reader.next(e))
+        break;
+      cache.insert(e);
+    }
+  });
+  run("reused MarketDataEntry + insert", [](auto &reader, auto &cache) {
+    MarketDataEntry e{};
+    while (reader.next(e))
+      cache.insert(e);
+  });
+  run("arena views + insert_batch(4096)", [](auto &reader, auto &cache) {
+    RunArena<PriceLevel> levels;
+    std::vector<MarketDataEntryView> batch;
+    MarketDataEntryView v{};
+    while (reader.next(v, levels)) {
+      batch.push_back(v);
+      if (batch.size() == 4096) {
+        cache.insert_batch(batch);
+        batch.clear();
+        levels.reset();
+      }
+    }
+    cache.insert_batch(batch);
+  });
+  std::filesystem::remove(path);
+}
+
+void benchmark_spread_storage() {
+  std::printf("\n=== Bucket spread storage (1M ticks per hour, 2 hours) ===\n");
+
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const int per_hour = 1'000'000;
+  const int64_t step = 3'600'000LL; // 3.6 ms
+  volatile double sink = 0;
+  for (auto storage :
+       {MarketDataCache::Storage::Dense, MarketDataCache::Storage::Compact}) {
+    MarketDataCache cache(0.0, 10.0,
+                          MarketDataCache::HistIndex::BucketMajorFenwick,
+                          storage);
+    int64_t t = t0;
+    auto hour = [&](int64_t &allocs) {
+      allocs = g_allocations.load();
+      double us = bench_us([&] {
+        for (int i = 0; i < per_hour; ++i, t += step)
+          cache.insert(make_entry(t, 100.0, 100.0 + 0.5 + (i % 73) * 0.1));
+      });
+      allocs = g_allocations.load() - allocs - 2 * per_hour; // make_entry's
+      return us * 1000.0 / per_hour;
+    };
+    int64_t fill_allocs = 0, steady_allocs = 0;
+    double fill = hour(fill_allocs);
+    double steady = hour(steady_allocs);
+    double exact = bench_us(
+        [&] {
+          sink = std::get<1>(cache.spread_percentiles_exact(t - 3600 * SEC, t));
+        },
+        5);
+    std::printf("  %-8s fill %5.0f ns/tick %6.3f allocs/tick | steady %5.0f "
+                "ns/tick %6.3f allocs/tick | exact 1 h %6.1f ms | %5.1f MB\n",
+                storage == MarketDataCache::Storage::Dense ? "dense"
+                                                           : "compact",
+                fill, static_cast<double>(fill_allocs) / per_hour, steady,
+                static_cast<double>(steady_allocs) / per_hour, exact / 1000,
+                cache.memory_usage() / (1024.0 * 1024.0));
+  }
+  (void)sink;
+}
+
+void benchmark_ingestor() {
+  std::printf("\n=== Multi-producer ingest, 50-level unsorted books "
+              "(%u hardware threads) ===\n",
+              std::thread::hardware_concurrency());
+
+  std::mt19937_64 rng(20);
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const int total = 400'000;
+  // 512 distinct books, re-stamped per tick so they stay in cache.
+  std::vector<MarketDataEntry> books;
+  for (int i = 0; i < 512; ++i)
+    books.push_back(make_book(rng, 0, 50));
+
+  for (int producers : {1, 2, 4}) {
+    int per = total / producers;
+    auto feed = [&](int p, auto &&sink) {
+      for (int i = 0; i < per; ++i) {
+        const MarketDataEntry &b = books[(i + p * 61) & 511];
+        sink(MarketDataEntryView{
+            t0 + (static_cast<int64_t>(i) * producers + p) * 9'000'000LL,
+            b.bids, b.asks});
+      }
+    };
+    double direct = bench_us([&] {
+      MarketDataCache cache(0.0, 10.0);
+      std::vector<std::thread> threads;
+      for (int p = 0; p < producers; ++p)
+        threads.emplace_back([&, p] {
+          feed(p, [&](const MarketDataEntryView &v) { cache.insert(v); });
+        });
+      for (auto &t : threads)
+        t.join();
+    });
+    double staged = bench_us([&] {
+      MarketDataCache cache(0.0, 10.0);
+      MarketDataIngestor ingest(cache, producers);
+      std::vector<std::thread> threads;
+      for (int p = 0; p < producers; ++p)
+        threads.emplace_back([&, p] {
+          auto &prod = ingest.producer(p);
+          feed(p, [&](const MarketDataEntryView &v) { prod.push(v); });
+        });
+      for (auto &t : threads)
+        t.join();
+      ingest.flush();
+    });
+    std::printf("  %d producer(s):  insert() %6.2f M ticks/s   ingestor %6.2f "
+                "M ticks/s\n",
+                producers, total / direct, total / staged);
+  }
+}
+
+void benchmark_exact_parallel() {
+  std::printf("\n=== Exact p10/p50/p90: sequential vs parallel (4M ticks / "
+              "hour, %u hardware threads) ===\n",
+              std::thread::hardware_concurrency());
+
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const int64_t hour = 3600LL * SEC;
+  std::mt19937_64 rng(22);
+  std::uniform_int_distribution<int64_t> time_dist(0, hour - 1);
+  std::lognormal_distribution<double> spread_dist(0.5, 0.6);
+  std::vector<MarketDataCache::SpreadTick> ticks(4'000'000);
+  for (auto &t : ticks)
+    t = {t0 + time_dist(rng), spread_dist(rng)};
+  std::sort(ticks.begin(), ticks.end(),
+            [](auto &a, auto &b) { return a.time < b.time; });
+  MarketDataCache cache(0.0, 20.0);
+  cache.insert_spreads(ticks);
+
+  volatile double sink = 0;
+  for (int minutes : {10, 60}) {
+    int64_t end = t0 + hour - 1;
+    int64_t start = end - minutes * 60LL * SEC + 1;
+    const int Q = 20;
+    auto [seq50, seq99] = latency_p50_p99(
+        [&](int) {
+          sink = std::get<1>(cache.spread_percentiles_exact(start, end));
+        },
+        Q);
+    std::printf("  %2d min  sequential  p50 %8.1f us  p99 %8.1f us\n", minutes,
+                seq50 / 1000.0, seq99 / 1000.0);
+    for (unsigned threads : {1u, 2u, 4u}) {
+      CHECK(same_pctls(
+          cache.spread_percentiles_exact_parallel(start, end, threads),
+          cache.spread_percentiles_exact(start, end)));
+      auto [par50, par99] = latency_p50_p99(
+          [&](int) {
+            sink = std::get<1>(
+                cache.spread_percentiles_exact_parallel(start, end, threads));
+          },
+          Q);
+      std::printf("          %u thread(s) p50 %8.1f us  p99 %8.1f us\n",
+                  threads, par50 / 1000.0, par99 / 1000.0);
+    }
+  }
+  (void)sink;
+}
+
+void benchmark_daily_report() {
+  std::printf("\n=== Daily report: 1,440 one-minute ranges, count/min/max/"
+              "p10/p50/p90 (2M ticks / day) ===\n");
+
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const int64_t day = 86'400LL * SEC;
+  std::mt19937_64 rng(24);
+  std::uniform_int_distribution<int64_t> time_dist(0, day - 1);
+  std::lognormal_distribution<double> spread_dist(0.5, 0.6);
+  std::vector<DailyMarketDataCache::SpreadTick> ticks(2'000'000);
+  for (auto &t : ticks)
+    t = {t0 + time_dist(rng), spread_dist(rng)};
+  std::sort(ticks.begin(), ticks.end(),
+            [](auto &a, auto &b) { return a.time < b.time; });
+
+  for (auto layout : {DailyMarketDataCache::HistIndex::BinMajorFenwick,
+                      DailyMarketDataCache::HistIndex::BucketMajorFenwick}) {
+    DailyMarketDataCache cache(0.0, 20.0, layout);
+    cache.insert_spreads(ticks);
+    volatile double sink = 0;
+    double report = bench_us(
+        [&] {
+          for (int64_t m = 0; m < 1440; ++m) {
+            int64_t a = t0 + m * 60 * SEC, b = a + 60 * SEC - 1;
+            sink = static_cast<double>(cache.count_range(a, b));
+            sink = cache.min_spread(a, b) + cache.max_spread(a, b);
+            sink = std::get<1>(cache.spread_percentiles(a, b));
+          }
+        },
+        20);
+    std::printf("  %-12s  %6.2f ms\n",
+                layout == DailyMarketDataCache::HistIndex::BinMajorFenwick
+                    ? "bin-major"
+                    : "bucket-major",
+                report / 1000.0);
+    (void)sink;
+  }
+}
+
+void benchmark_instrumentation() {
+  std::printf("\n=== Instrumentation (%s) ===\n",
+              CacheInstrument::ENABLED ? "MARKET_CACHE_INSTRUMENT on"
+                                       : "compiled out");
+
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const int n = 1'000'000;
+  std::vector<MarketDataEntry> entries;
+  entries.reserve(n);
+  for (int i = 0; i < n; ++i)
+    entries.push_back(
+        make_entry(t0 + i * 3'600'000LL, 100.0, 100.5 + (i % 50) * 0.1));
+
+  MarketDataCache cache(0.0, 10.0);
+  double insert_us = bench_us([&] {
+    for (auto &e : entries)
+      cache.insert(e);
+  });
+  volatile int64_t sink = 0;
+  const int Q = 1'000'000;
+  double query_us = bench_us([&] {
+    for (int i = 0; i < Q; ++i)
+      sink = cache.count_range(t0 + (i % 3000) * SEC, t0 + 3599 * SEC);
+  });
+  (void)sink;
+  std::printf("  insert %.1f ns/call   count_range %.1f ns/call\n",
+              insert_us * 1000.0 / n, query_us * 1000.0 / Q);
+  if (CacheInstrument::ENABLED)
+    std::printf("%s", cache.stats().to_string().c_str());
+}
+
+void benchmark_book_metrics() {
+  std::printf("\n=== Book metrics (10-level unsorted books) ===\n");
+
+  const int64_t t0 = 1'000'000'000'000'000'000LL;
+  const int n = 500'000;
+  std::mt19937_64 rng(41);
+  std::vector<MarketDataEntry> entries;
+  entries.reserve(n);
+  for (int i = 0; i < n; ++i)
+    entries.push_back(make_book(rng, t0 + i * 7'200'000LL, 10));
+
+  const MetricSpec specs[] = {{BookMetric::Mid},
+                              {BookMetric::Microprice},
+                              {BookMetric::Depth, 5},
+                              {BookMetric::Imbalance, 5}};
+  volatile double sink = 0;
+  const int Q = 500'000;
+  for (int metrics : {0, 1, 4}) {
+    MarketDataCache single(0.0, 10.0), batched(0.0, 10.0);
+    for (int m = 0; m < metrics; ++m) {
+      single.add_metric(specs[m]);
+      batched.add_metric(specs[m]);
+    }
+    double insert_us = bench_us([&] {
+      for (auto &e : entries)
+        single.insert(e);
+    });
+    double batch_us = bench_us([&] {
+      for (size_t i = 0; i < entries.size(); i += 4096)
+        batched.insert_batch(std::span<const MarketDataEntry>(
+            entries.data() + i, std::min<size_t>(4096, entries.size() - i)));
+    });
+    std::printf("  %d metrics: insert %.1f ns/entry   insert_batch %.1f "
+                "ns/entry",
+                metrics, insert_us * 1000.0 / n, batch_us * 1000.0 / n);
+    if (metrics > 0) {
+      double query_us = bench_us([&] {
+        for (int i = 0; i < Q; ++i)
+          sink = single
+                     .metric_summary(i % metrics, t0 + (i % 3000) * SEC,
+                                     t0 + 3599 * SEC)
+                     .mean;
+      });
+      std::printf("   metric_summary %.1f ns/call", query_us * 1000.0 / Q);
+    }
+    std::printf("\n");
   }
+  (void)sink;
 }
 
 // ---------------------------------------------------------------------------
@@ -397,15 +3647,57 @@ int main(int argc, char *argv[]) {
   test_window_eviction();
   test_multiple_per_bucket();
   test_empty_range();
+  test_mmap_loader();
+  test_insert_batch();
+  test_range_queries_brute_force();
+  test_hist_index_layouts();
+  test_concurrent_readers();
+  test_registry();
+  test_compact_storage();
+  test_geometries();
+  test_spread_quantiles();
+  test_exact_index();
+  test_spread_sketch();
+  test_rollups();
+  test_gap_eviction();
+  test_snapshot();
+  test_subscriptions();
+  test_level_order();
+  test_entry_views();
+  test_spread_slab();
+  test_ingestor();
+  test_exact_parallel();
+  test_instrumentation();
+  test_book_metrics();
+  test_worker_pool();
+  test_partial_gap_latency();
 
   std::string json_path = "market_data.json";
   if (argc > 1)
     json_path = argv[1];
   test_json_load(json_path);
+  test_parallel_loader(json_path);
 
   std::printf("\nAll correctness tests passed.\n");
 
   benchmark_performance();
+  benchmark_hist_index();
+  benchmark_exact_index();
+  benchmark_rollups();
+  benchmark_eviction();
+  benchmark_snapshot();
+  benchmark_subscriptions();
+  benchmark_level_order();
+  benchmark_entry_views();
+  benchmark_spread_storage();
+  benchmark_ingestor();
+  benchmark_exact_parallel();
+  benchmark_daily_report();
+  benchmark_instrumentation();
+  benchmark_book_metrics();
+  benchmark_reader_stress();
+  benchmark_registry();
+  benchmark_json_load();
 
   return 0;
 }
\ No newline at end of file